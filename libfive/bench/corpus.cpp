@@ -0,0 +1,86 @@
+/*
+libfive: a CAD kernel for modeling with implicit functions
+
+Copyright (C) 2019  Matt Keeter
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+#include "corpus.hpp"
+#include "util/shapes.hpp"
+
+using namespace Kernel;
+
+/*  Port of studio/examples/charm.io, with its free variable fixed  */
+static Tree charm()
+{
+    auto x = Tree::X();
+    auto y = Tree::Y();
+    auto z = Tree::Z();
+    auto cutout = max(max(0.2 - abs(x), 0.2 - abs(y)), 0.2 - abs(z));
+    return max(max(sphere(1), -cutout), -sphere(0.8));
+}
+
+/*  Port of studio/examples/klein.io  */
+static Tree klein()
+{
+    auto x = Tree::X();
+    auto y = Tree::Y();
+    auto z = Tree::Z();
+    auto r = square(x) + square(y) + square(z);
+    auto a = r + 2 * y - 1;
+    auto b = r - 2 * y - 1;
+    return a * (square(b) - 8 * square(z)) + 16 * x * z * b;
+}
+
+/*  Port of studio/examples/bilinsky.io  */
+static Tree bilinsky()
+{
+    auto x = Tree::X();
+    auto y = Tree::Y();
+    auto z = Tree::Z();
+    Tree out = x + y - 4;
+    for (auto t : {y + z, x + z, -x - y, -x - z, -z - y,
+                   x - y, z - y, -z + y, x - z, -x + z, -x + y})
+    {
+        out = max(out, t - 4);
+    }
+    return out;
+}
+
+/*  Port of studio/examples/taper.io  */
+static Tree taper()
+{
+    const float zmin = -1;
+    const float zmax = 1.1;
+    auto scale = (Tree::Z() - zmax) / (zmax - zmin);
+    return sphere(1).remap(Tree::X() / scale, Tree::Y() / scale, Tree::Z());
+}
+
+std::vector<Model> corpus()
+{
+    return {
+        {"sphere", sphere(1), Region<3>({-2, -2, -2}, {2, 2, 2}), 0.05, 50},
+        {"blend", blend(box({-1, -1, -1}, {0.5, 0.5, 0.5}),
+                        sphere(1, {0.5, 0.5, 0.5}), 0.25),
+            Region<3>({-2, -2, -2}, {2, 2, 2}), 0.05, 50},
+        {"menger", max(menger(2), -sphere(1, {1.5, 1.5, 1.5})),
+            Region<3>({-2.5, -2.5, -2.5}, {2.5, 2.5, 2.5}), 0.05, 40},
+        {"gyroid", sphereGyroid(),
+            Region<3>({-5, -5, -5}, {5, 5, 5}), 0.1, 20},
+        {"cylinder", cylinder(1, 2, {0, 0, -1}),
+            Region<3>({-2, -2, -2}, {2, 2, 2}), 0.05, 50},
+        {"charm", charm(), Region<3>({-2, -2, -2}, {2, 2, 2}), 0.05, 50},
+        {"klein", klein(), Region<3>({-3, -3, -3}, {3, 3, 3}), 0.1, 30},
+        {"bilinsky", bilinsky(),
+            Region<3>({-5, -5, -5}, {5, 5, 5}), 0.1, 20},
+        {"taper", taper(), Region<3>({-2, -2, -2}, {2, 2, 2}), 0.05, 50},
+    };
+}
+
+Model loadModel(const std::string& filename)
+{
+    return {filename, Tree::load(filename),
+            Region<3>({-10, -10, -10}, {10, 10, 10}), 0.1, 10};
+}
@@ -0,0 +1,48 @@
+/*
+libfive: a CAD kernel for modeling with implicit functions
+
+Copyright (C) 2019  Matt Keeter
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "libfive/tree/tree.hpp"
+#include "libfive/render/brep/region.hpp"
+
+/*
+ *  A single benchmark model, with the settings used to render it
+ */
+struct Model
+{
+    std::string name;
+    Kernel::Tree tree;
+
+    /*  Bounds used for every benchmark on this model */
+    Kernel::Region<3> bounds;
+
+    /*  Minimum feature size passed to the BRep renderers */
+    double min_feature;
+
+    /*  Voxels per unit for the heightmap renderer */
+    float resolution;
+};
+
+/*
+ *  Returns the fixed benchmark corpus.  This must not change between
+ *  runs that are meant to be compared, so new models should be appended
+ *  rather than modifying existing ones.
+ */
+std::vector<Model> corpus();
+
+/*
+ *  Loads a serialized Tree (as written by Tree::serialize) as a model,
+ *  using the same default bounds as Studio.  On failure, the returned
+ *  model's tree has a null id.
+ */
+Model loadModel(const std::string& filename);
@@ -0,0 +1,555 @@
+/*
+libfive: a CAD kernel for modeling with implicit functions
+
+Copyright (C) 2019  Matt Keeter
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+#endif
+
+#include "libfive/eval/deck.hpp"
+#include "libfive/eval/eval_array.hpp"
+#include "libfive/eval/eval_interval.hpp"
+#include "libfive/eval/eval_xtree.hpp"
+#include "libfive/eval/tape.hpp"
+
+#include "libfive/render/brep/contours.hpp"
+#include "libfive/render/brep/dual.hpp"
+#include "libfive/render/brep/mesh.hpp"
+#include "libfive/render/brep/settings.hpp"
+#include "libfive/render/brep/dc/dc_pool.hpp"
+#include "libfive/render/brep/dc/dc_mesher.hpp"
+#include "libfive/render/brep/simplex/simplex_pool.hpp"
+#include "libfive/render/brep/simplex/simplex_mesher.hpp"
+#include "libfive/render/brep/hybrid/hybrid_pool.hpp"
+#include "libfive/render/brep/hybrid/hybrid_mesher.hpp"
+#include "libfive/render/discrete/heightmap.hpp"
+#include "libfive/render/discrete/voxels.hpp"
+
+#include "corpus.hpp"
+
+using namespace Kernel;
+
+/*
+ *  Resets the high-water mark returned by peakRSS, so that it covers a
+ *  single benchmark.  This is only possible on Linux; elsewhere, this
+ *  returns false and peakRSS stays a process-wide high-water mark.
+ */
+static bool resetPeakRSS()
+{
+#if defined(__linux__)
+    std::ofstream f("/proc/self/clear_refs");
+    f << "5";
+    f.close();
+    return !f.fail();
+#else
+    return false;
+#endif
+}
+
+/*  Returns the process's current resident set size, in kilobytes */
+static uint64_t currentRSS()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS info;
+    GetProcessMemoryInfo(GetCurrentProcess(), &info, sizeof(info));
+    return info.WorkingSetSize / 1024;
+#elif defined(__APPLE__)
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+              reinterpret_cast<task_info_t>(&info), &count);
+    return info.resident_size / 1024;
+#else
+    std::ifstream f("/proc/self/statm");
+    uint64_t size = 0, resident = 0;
+    f >> size >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+#endif
+}
+
+/*  Returns the process's peak resident set size (since the last call to
+ *  resetPeakRSS, where supported), in kilobytes */
+static uint64_t peakRSS()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS info;
+    GetProcessMemoryInfo(GetCurrentProcess(), &info, sizeof(info));
+    return info.PeakWorkingSetSize / 1024;
+#else
+#if defined(__linux__)
+    // VmHWM is the value that's reset by resetPeakRSS
+    std::ifstream f("/proc/self/status");
+    std::string line;
+    while (std::getline(f, line))
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+        {
+            return strtoull(line.c_str() + 6, nullptr, 10);
+        }
+    }
+#endif
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;  // reported in bytes
+#else
+    return usage.ru_maxrss;         // reported in kilobytes
+#endif
+#endif
+}
+
+/*
+ *  One timed run of a benchmark.  Benchmarks that only want to time part
+ *  of their work (e.g. Tape::push, which needs a preceding evaluation)
+ *  fill in seconds themselves; otherwise, the whole run is timed.
+ *
+ *  Benchmarks with named phases (see Runner::run) also fill in the time
+ *  spent in each phase.
+ */
+struct Sample
+{
+    double items;
+    double seconds;
+    std::vector<double> phases;
+};
+
+static double median(std::vector<double> s)
+{
+    std::sort(s.begin(), s.end());
+    return s[s.size() / 2];
+}
+
+struct Result
+{
+    std::string model;
+    std::string bench;
+    std::string unit;
+    double items;
+    std::vector<double> seconds;
+
+    /*  Names of the benchmark's phases, and the time spent in each phase
+     *  for every run (indexed by phase, then by run) */
+    std::vector<std::string> phase_names;
+    std::vector<std::vector<double>> phase_seconds;
+
+    /*  Resident set size before the timed runs, and its peak during them.
+     *  If the peak can't be reset (see resetPeakRSS), then the peak is a
+     *  process-wide high-water mark instead.  */
+    uint64_t rss_start_kb;
+    uint64_t rss_peak_kb;
+
+    double min() const
+    { return *std::min_element(seconds.begin(), seconds.end()); }
+    double max() const
+    { return *std::max_element(seconds.begin(), seconds.end()); }
+    double median() const { return ::median(seconds); }
+};
+
+struct Options
+{
+    unsigned repeat=3;
+    unsigned workers=8;
+    std::string filter;
+    std::string json;
+    std::vector<std::string> load;
+};
+
+class Runner
+{
+public:
+    Runner(const Options& opts) : opts(opts) { /* Nothing to do here */ }
+
+    /*
+     *  Runs fn opts.repeat times (after one untimed warm-up run, which
+     *  also fills caches and the Tree cache) and stores the result.
+     *
+     *  If phases is non-empty, then fn must return one time per phase
+     *  in Sample::phases.
+     *
+     *  The benchmark is skipped if "model/bench" doesn't contain the
+     *  filter string.
+     */
+    void run(const std::string& model, const std::string& bench,
+             const std::string& unit, std::function<Sample()> fn,
+             const std::vector<std::string>& phases={})
+    {
+        const auto name = model + "/" + bench;
+        if (name.find(opts.filter) == std::string::npos)
+        {
+            return;
+        }
+
+        Result r = {model, bench, unit, 0, {}, phases,
+                    std::vector<std::vector<double>>(phases.size()), 0, 0};
+        fn();
+
+        peak_reset = resetPeakRSS();
+        r.rss_start_kb = currentRSS();
+        for (unsigned i=0; i < std::max(1u, opts.repeat); ++i)
+        {
+            auto start = std::chrono::steady_clock::now();
+            auto s = fn();
+            std::chrono::duration<double> dt =
+                std::chrono::steady_clock::now() - start;
+            r.items = s.items;
+            r.seconds.push_back(s.seconds >= 0 ? s.seconds : dt.count());
+            for (unsigned j=0; j < phases.size(); ++j)
+            {
+                r.phase_seconds[j].push_back(s.phases.at(j));
+            }
+        }
+        r.rss_peak_kb = std::max(peakRSS(), r.rss_start_kb);
+
+        fprintf(stderr, "%-32s %10.3f ms %14.0f %s\n", name.c_str(),
+                r.median() * 1000, r.items / r.median(), unit.c_str());
+        results.push_back(r);
+    }
+
+    /*  Writes a string as a JSON string literal */
+    static std::string quote(const std::string& s)
+    {
+        std::string out = "\"";
+        for (auto c : s)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out += '\\';
+            }
+            out += c;
+        }
+        return out + "\"";
+    }
+
+    void writeJSON(std::ostream& out) const
+    {
+        out << "{\n  \"repeat\": " << opts.repeat
+            << ",\n  \"workers\": " << opts.workers
+            << ",\n  \"rss_peak_per_benchmark\": "
+            << (peak_reset ? "true" : "false")
+            << ",\n  \"results\": [";
+        for (unsigned i=0; i < results.size(); ++i)
+        {
+            const auto& r = results[i];
+            out << (i ? ",\n" : "\n")
+                << "    {\"model\": " << quote(r.model)
+                << ", \"bench\": " << quote(r.bench)
+                << ", \"items\": " << r.items
+                << ", \"unit\": " << quote(r.unit)
+                << ", \"throughput\": " << r.items / r.median()
+                << ", \"wall_ms\": {\"min\": " << r.min() * 1000
+                << ", \"median\": " << r.median() * 1000
+                << ", \"max\": " << r.max() * 1000 << "}";
+            if (r.phase_names.size())
+            {
+                out << ", \"phase_ms\": {";
+                for (unsigned j=0; j < r.phase_names.size(); ++j)
+                {
+                    out << (j ? ", " : "") << quote(r.phase_names[j])
+                        << ": " << ::median(r.phase_seconds[j]) * 1000;
+                }
+                out << "}";
+            }
+            out << ", \"rss_kb\": {\"start\": " << r.rss_start_kb
+                << ", \"peak\": " << r.rss_peak_kb
+                << ", \"delta\": " << r.rss_peak_kb - r.rss_start_kb << "}}";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+protected:
+    const Options& opts;
+    std::vector<Result> results;
+
+    /*  Records whether resetPeakRSS worked, i.e. whether each result's
+     *  peak RSS only covers its own benchmark  */
+    bool peak_reset=false;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ *  Splits the model's bounds into n^3 subregions, used for interval
+ *  evaluation and tape pushing.
+ */
+static std::vector<Region<3>> subregions(const Region<3>& r, unsigned n)
+{
+    std::vector<Region<3>> out;
+    const auto d = (r.upper - r.lower) / n;
+    for (unsigned i=0; i < n; ++i)
+    {
+        for (unsigned j=0; j < n; ++j)
+        {
+            for (unsigned k=0; k < n; ++k)
+            {
+                Region<3>::Pt lower =
+                    r.lower + d * Eigen::Array3i(i, j, k).cast<double>();
+                out.push_back(Region<3>(lower, lower + d));
+            }
+        }
+    }
+    return out;
+}
+
+static void benchEval(Runner& runner, const Model& m)
+{
+    runner.run(m.name, "deck", "clauses/s", [&]() {
+        auto deck = std::make_shared<Deck>(m.tree);
+        return Sample{double(deck->num_clauses), -1, {}};
+    });
+
+    auto deck = std::make_shared<Deck>(m.tree);
+
+    // Points are drawn from a fixed seed so that runs are comparable
+    std::mt19937 rng(1);
+    std::vector<Eigen::Vector3f> pts(ArrayEvaluator::N * 64);
+    for (auto& p : pts)
+    {
+        for (unsigned i=0; i < 3; ++i)
+        {
+            std::uniform_real_distribution<float> dist(
+                    m.bounds.lower(i), m.bounds.upper(i));
+            p(i) = dist(rng);
+        }
+    }
+
+    ArrayEvaluator array(deck);
+    runner.run(m.name, "array/values", "points/s", [&]() {
+        for (unsigned i=0; i < pts.size(); i += ArrayEvaluator::N)
+        {
+            for (unsigned j=0; j < ArrayEvaluator::N; ++j)
+            {
+                array.set(pts[i + j], j);
+            }
+            array.values(ArrayEvaluator::N);
+        }
+        return Sample{double(pts.size()), -1, {}};
+    });
+
+    const auto rs = subregions(m.bounds, 16);
+    IntervalEvaluator interval(deck);
+    runner.run(m.name, "interval/evalAndPush", "regions/s", [&]() {
+        for (const auto& r : rs)
+        {
+            interval.evalAndPush(r.lower.template cast<float>(),
+                                 r.upper.template cast<float>());
+        }
+        return Sample{double(rs.size()), -1, {}};
+    });
+
+    runner.run(m.name, "tape/push", "pushes/s", [&]() {
+        std::chrono::duration<double> dt(0);
+        for (const auto& r : rs)
+        {
+            interval.eval(r.lower.template cast<float>(),
+                          r.upper.template cast<float>());
+            auto start = std::chrono::steady_clock::now();
+            interval.push();
+            dt += std::chrono::steady_clock::now() - start;
+        }
+        return Sample{double(rs.size()), dt.count(), {}};
+    });
+}
+
+/*  Builds a mesher for Dual::walk_, which only some meshers need an
+ *  evaluator for */
+template <typename M>
+M makeMesher(PerThreadBRep<3>& brep, XTreeEvaluator* e,
+             const BRepSettings& settings)
+{
+    return M(brep, e, settings.edge_tolerance);
+}
+
+template <>
+DCMesher makeMesher<DCMesher>(PerThreadBRep<3>& brep, XTreeEvaluator*,
+                              const BRepSettings&)
+{
+    return DCMesher(brep);
+}
+
+/*  Called between the build and walk phases, for trees that need it */
+static void prepare(Root<DCTree<3>>&, const BRepSettings&)
+{
+    // Nothing to do here
+}
+
+template <typename T>
+void prepare(Root<T>& t, const BRepSettings& settings)
+{
+    t->assignIndices(settings);
+}
+
+/*
+ *  Does the same work as Mesh::render, but times the Pool::build and
+ *  Dual::walk phases separately.
+ */
+template <typename Pool, typename M>
+Sample renderPhases(const Model& m, const BRepSettings& settings)
+{
+    typedef std::chrono::steady_clock clock;
+
+    auto deck = std::make_shared<Deck>(m.tree);
+    std::vector<XTreeEvaluator, Eigen::aligned_allocator<XTreeEvaluator>> es;
+    es.reserve(settings.workers);
+    for (unsigned i=0; i < settings.workers; ++i)
+    {
+        es.emplace_back(XTreeEvaluator(i ? deck->fork() : deck));
+    }
+
+    const auto start = clock::now();
+    auto t = Pool::build(es.data(), m.bounds, settings);
+    prepare(t, settings);
+    const auto built = clock::now();
+
+    auto e = es.data();
+    auto mesh = Dual<3>::walk_<M>(t, settings,
+            [e, &settings](PerThreadBRep<3>& brep, int i) {
+                return makeMesher<M>(brep, &e[i], settings);
+            });
+    const auto walked = clock::now();
+    t.reset(settings);
+
+    std::chrono::duration<double> build = built - start;
+    std::chrono::duration<double> walk = walked - built;
+    return Sample{double(mesh ? mesh->branes.size() : 0), -1,
+                  {build.count(), walk.count()}};
+}
+
+static void benchRender(Runner& runner, const Model& m, unsigned workers)
+{
+    BRepSettings settings;
+    settings.min_feature = m.min_feature;
+    settings.workers = workers;
+
+    const std::vector<std::string> phases = {"build", "walk"};
+    runner.run(m.name, "mesh/dc", "triangles/s", [&]() {
+        return renderPhases<DCPool<3>, DCMesher>(m, settings);
+    }, phases);
+    runner.run(m.name, "mesh/simplex", "triangles/s", [&]() {
+        return renderPhases<SimplexTreePool<3>, SimplexMesher>(m, settings);
+    }, phases);
+    runner.run(m.name, "mesh/hybrid", "triangles/s", [&]() {
+        return renderPhases<HybridTreePool<3>, HybridMesher>(m, settings);
+    }, phases);
+
+    runner.run(m.name, "heightmap", "pixels/s", [&]() {
+        Voxels vs(m.bounds.lower.template cast<float>(),
+                  m.bounds.upper.template cast<float>(), m.resolution);
+        std::atomic_bool abort(false);
+        auto h = Heightmap::render(m.tree, vs, abort, workers);
+        return Sample{double(h->depth.size()), -1, {}};
+    });
+
+    runner.run(m.name, "contours", "points/s", [&]() {
+        // Contours are taken at the middle of the model's Z range
+        Region<2> r(m.bounds.lower.template head<2>(),
+                    m.bounds.upper.template head<2>(),
+                    Region<2>::Perp((m.bounds.lower.z() +
+                                     m.bounds.upper.z()) / 2));
+        BRepSettings settings;
+        settings.min_feature = m.min_feature;
+        settings.workers = workers;
+        auto cs = Contours::render(m.tree, r, settings);
+        double count = 0;
+        for (const auto& c : cs->contours)
+        {
+            count += c.size();
+        }
+        return Sample{count, -1, {}};
+    });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --repeat N     Timed runs per benchmark (default 3)\n"
+        "  --workers N    Worker threads for rendering (default 8)\n"
+        "  --filter S     Only run benchmarks whose model/name contains S\n"
+        "  --json FILE    Write results as JSON to FILE ('-' for stdout)\n"
+        "  --load FILE    Add a serialized Tree to the corpus\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    Options opts;
+    for (int i=1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        else if (arg == "--repeat")     opts.repeat = atoi(argv[++i]);
+        else if (arg == "--workers")    opts.workers = atoi(argv[++i]);
+        else if (arg == "--filter")     opts.filter = argv[++i];
+        else if (arg == "--json")       opts.json = argv[++i];
+        else if (arg == "--load")       opts.load.push_back(argv[++i]);
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    auto models = corpus();
+    for (auto& f : opts.load)
+    {
+        auto m = loadModel(f);
+        if (m.tree.id() == nullptr)
+        {
+            fprintf(stderr, "Could not load %s\n", f.c_str());
+            return 1;
+        }
+        models.push_back(m);
+    }
+
+    Runner runner(opts);
+    for (const auto& m : models)
+    {
+        benchEval(runner, m);
+        benchRender(runner, m, opts.workers);
+    }
+
+    if (opts.json == "-")
+    {
+        runner.writeJSON(std::cout);
+    }
+    else if (!opts.json.empty())
+    {
+        std::ofstream out(opts.json);
+        if (!out.is_open())
+        {
+            fprintf(stderr, "Could not open %s\n", opts.json.c_str());
+            return 1;
+        }
+        runner.writeJSON(out);
+    }
+    return 0;
+}
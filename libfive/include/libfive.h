@@ -12,6 +12,7 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 #include <cstdint>
 #include "libfive/tree/tree.hpp"
 #include "libfive/tree/archive.hpp"
+namespace Kernel { class XTreeEvaluator; }
 extern "C" {
 #else
 #include <stdint.h>
@@ -74,6 +75,15 @@ typedef struct libfive_contours {
     uint32_t count;
 } libfive_contours;
 
+/*
+ *  libfive_slices is a stack of 2D slices, consisting of one
+ *  libfive_contours object per layer and a count of how many are stored
+ */
+typedef struct libfive_slices {
+    libfive_contours* slices;
+    uint32_t count;
+} libfive_slices;
+
 /*
  *  libfive_contour3 is a single 2D contour, consisting of a sequence of
  *  3D points plus a count of how many points are stored
@@ -139,6 +149,11 @@ void libfive_contours_delete(libfive_contours* cs);
  */
 void libfive_contours3_delete(libfive_contours3* cs);
 
+/*
+ *  Frees an libfive_slices data structure
+ */
+void libfive_slices_delete(libfive_slices* s);
+
 /*
  *  Frees an libfive_mesh data structure
  */
@@ -184,6 +199,7 @@ void libfive_vars_delete(libfive_vars* j);
 typedef Kernel::Tree* libfive_tree;
 typedef Kernel::Tree::Id libfive_id;
 typedef Kernel::Archive* libfive_archive;
+typedef Kernel::XTreeEvaluator* libfive_evaluator;
 #else
 typedef struct libfive_tree_ libfive_tree_;
 typedef struct libfive_tree_* libfive_tree;
@@ -193,6 +209,9 @@ typedef struct libfive_id_* libfive_id;
 
 typedef struct libfive_archive_ libfive_archive_;
 typedef struct libfive_archive_* libfive_archive;
+
+typedef struct libfive_evaluator_ libfive_evaluator_;
+typedef struct libfive_evaluator_* libfive_evaluator;
 #endif
 
 /*
@@ -280,6 +299,60 @@ libfive_interval libfive_tree_eval_r(libfive_tree t, libfive_region3 r);
  */
 libfive_vec3 libfive_tree_eval_d(libfive_tree t, libfive_vec3 p);
 
+/*
+ *  Constructs an evaluator for the given tree.  Unlike the
+ *  libfive_tree_eval_* functions (which build a new evaluator on every
+ *  call), an evaluator can be reused for many evaluations.
+ *
+ *  An evaluator must only be used by one thread at a time; use
+ *  libfive_evaluator_fork to make evaluators for other threads.
+ *  Free variables are treated as zero until set with
+ *  libfive_evaluator_update_vars.
+ */
+libfive_evaluator libfive_evaluator_new(libfive_tree t);
+
+/*
+ *  Constructs a new evaluator for the same tree as e, which can be used
+ *  on a different thread.  This is much cheaper than libfive_evaluator_new,
+ *  because the flattened tree is shared between the two evaluators.
+ *  Free variables start out as zero (they are not copied from e).
+ */
+libfive_evaluator libfive_evaluator_fork(libfive_evaluator e);
+
+/*
+ *  Deletes an evaluator
+ */
+void libfive_evaluator_delete(libfive_evaluator e);
+
+/*
+ *  Sets the values of free variables, returning true if any changed
+ */
+bool libfive_evaluator_update_vars(libfive_evaluator e, libfive_vars vars);
+
+/*
+ *  Evaluates the tree at count points, writing results into out
+ *  (which must have room for count values).
+ */
+void libfive_evaluator_values(libfive_evaluator e, const libfive_vec3* ps,
+                              uint32_t count, float* out);
+
+/*
+ *  Evaluates the tree and its partial derivatives at count points,
+ *  writing [dx, dy, dz, value] into out (which must have room for
+ *  count values).
+ */
+void libfive_evaluator_derivs(libfive_evaluator e, const libfive_vec3* ps,
+                              uint32_t count, libfive_vec4* out);
+
+/*
+ *  Evaluates the tree over count regions, writing intervals that are
+ *  guaranteed to contain the result into out (which must have room for
+ *  count values).
+ */
+void libfive_evaluator_intervals(libfive_evaluator e,
+                                 const libfive_region3* rs,
+                                 uint32_t count, libfive_interval* out);
+
 /*
  *  Checks whether two trees are equal, taking deduplication into account
  */
@@ -335,6 +408,21 @@ libfive_contours3* libfive_tree_render_slice3(libfive_tree tree,
                                               libfive_region2 R,
                                               float z, float res);
 
+/*
+ *  Renders a tree to a stack of slices, one at each of the count
+ *  Z heights in zs (returned in the same order).  R and res are as in
+ *  libfive_tree_render_slice.
+ *
+ *  This is much faster than rendering each slice separately, because
+ *  setup and interval pruning are shared between nearby layers.
+ *
+ *  The returned struct must be freed with libfive_slices_delete
+ */
+libfive_slices* libfive_tree_render_slices(libfive_tree tree,
+                                           libfive_region2 R,
+                                           const float* zs, uint32_t count,
+                                           float res);
+
 /*
  *  Renders and saves a slice to a file
  *
@@ -8,10 +8,14 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 */
 #pragma once
 
+#include <cassert>
+#include <mutex>
+
 #include <boost/bimap.hpp>
 
 #include "libfive/tree/tree.hpp"
 #include "libfive/eval/clause.hpp"
+#include "libfive/eval/tape_cache.hpp"
 #include "libfive/oracle/oracle.hpp"
 
 namespace Kernel {
@@ -24,7 +28,10 @@ class Tape; /* Foward declaration */
  *  mapping.
  *
  *  When evaluating, you should have one Deck per thread, because
- *  Oracles are stored on a per-Deck basis.
+ *  Oracles and scratch data for pushing are stored on a per-Deck basis.
+ *  Use fork() to build the extra Decks:  it shares the flattened tape,
+ *  constants, and variables (which are never modified after construction)
+ *  instead of flattening the tree again.
  *
  *  The deck contains a list of constants and variables which are used
  *  to construct Evaluators, and pointers to Oracles that are used during
@@ -32,22 +39,96 @@ class Tape; /* Foward declaration */
  */
 class Deck
 {
+protected:
+    /*  Flattened data that is immutable after construction, and can be
+     *  shared by every Deck that is forked from the same tree.  This is
+     *  declared first so that the public references below can bind to it. */
+    struct Shared
+    {
+        std::map<Clause::Id, float> constants;
+        boost::bimap<Clause::Id, Tree::Id> vars;
+
+        /*  ORACLE nodes from the tree, used to build per-Deck Oracles  */
+        std::vector<std::shared_ptr<Tree::Tree_>> oracles;
+
+        /*  Positions in the base tape of the clauses downstream of each
+         *  variable, built on first use (see Deck::downstream)  */
+        std::map<Clause::Id, std::vector<uint32_t>> downstream;
+        std::once_flag downstream_once;
+
+        /*  Variable dependencies of each clause (see depsBegin)  */
+        std::vector<uint32_t> deps;
+        std::vector<size_t> deps_end;
+
+        /*  Interval specializations, shared between workers  */
+        TapeCache cache;
+    };
+    std::shared_ptr<Shared> shared;
+
 public:
-    Deck(const Tree root);
+    /*
+     *  Builds a Deck from the given tree.  If optimize is true, the tree
+     *  is first rewritten with Tree::optimized, which makes every later
+     *  evaluation cheaper at the cost of a slower construction.
+     */
+    Deck(const Tree root, bool optimize=false);
 
     Deck(const Deck&)=delete;
     Deck& operator=(const Deck& other)=delete;
 
+    /*
+     *  Returns a new Deck that shares this Deck's tape, constants, and
+     *  variables, with its own Oracles and scratch storage (so that it can
+     *  be used on a different thread).
+     */
+    std::shared_ptr<Deck> fork() const;
+
     /*  Indices of X, Y, Z coordinates */
     Clause::Id X, Y, Z;
 
     /*  Constants, unpacked from the tree at construction */
-    std::map<Clause::Id, float> constants;
+    const std::map<Clause::Id, float>& constants;
 
     /*  Map of variables (in terms of where they live in this Evaluator) to
      *  their ids in their respective Tree (e.g. what you get when calling
      *  Tree::var().id() */
-    boost::bimap<Clause::Id, Tree::Id> vars;
+    const boost::bimap<Clause::Id, Tree::Id>& vars;
+
+    /*  Returns the positions in tape->t of every clause in the base tape
+     *  that depends on the given variable (directly or indirectly), in
+     *  evaluation order (i.e. descending).  When a variable changes,
+     *  these are the only clauses that must be re-evaluated to bring
+     *  cached results up to date.  Variables that aren't used by any
+     *  clause (e.g. a bare variable as the root) have an empty list.
+     *
+     *  The lists for every variable are built the first time this is
+     *  called (by any Deck forked from the same tree), since only
+     *  ArrayEvaluator::valuesCached needs them. */
+    const std::vector<uint32_t>& downstream(Clause::Id var) const;
+
+    /*  For every clause, the variables that it depends on (directly or
+     *  indirectly), as a sorted list of indices in vars.left order.
+     *  These lists are packed end-to-end, and the list for clause c is
+     *  deps[depsBegin(c)] to deps[depsEnd(c) - 1].  Clauses that don't
+     *  depend on any variable have empty lists, so the total size scales
+     *  with the variable-dependent part of the tree, rather than with
+     *  the number of clauses times the number of variables. */
+    const std::vector<uint32_t>& deps;
+    size_t depsBegin(Clause::Id c) const
+    {
+        assert(c <= num_clauses);
+        return shared->deps_end[c + 1];
+    }
+    size_t depsEnd(Clause::Id c) const
+    {
+        assert(c <= num_clauses);
+        return shared->deps_end[c];
+    }
+
+    /*  Tapes specialized by IntervalEvaluator::evalAndPush, keyed by
+     *  parent tape, region, and variable values.  This is shared by
+     *  every Deck forked from this one (see TapeCache for details). */
+    TapeCache& cache;
 
     /*  Oracles are also unpacked from the tree at construction, and
      *  stored in this flat list.  The ORACLE opcode takes an index into
@@ -60,11 +141,41 @@ public:
      *  for results during Tape evaluation. */
     size_t num_clauses;
 
+    /*  Number of operations that the optimization pass removed from the
+     *  tape (always zero if the Deck was built without optimization). */
+    size_t saved;
+
+    /*  Returns the result slot for a leaf clause (X, Y, Z, a constant,
+     *  a variable, or an oracle).  Leaves are pinned to slots
+     *  [1, num_clauses - num_ops], so they keep their values across
+     *  tape walks; operations use the slots above them, which are
+     *  reused once a value is dead (see allocate below). */
+    Clause::Id slot(Clause::Id leaf) const
+    {
+        assert(leaf > num_ops && leaf <= num_clauses);
+        return leaf - num_ops;
+    }
+
+    /*  Returns the result row for any clause in a layout where nothing
+     *  is reused:  leaves keep their usual slots, and each operation gets
+     *  its own row above them.  Evaluators that cache intermediate
+     *  results (see ArrayEvaluator::valuesCached) need num_clauses + 1
+     *  rows to use this layout. */
+    Clause::Id pinned(Clause::Id c) const
+    {
+        assert(c <= num_clauses);
+        return (c == 0) ? 0
+             : (c <= num_ops) ? c + num_clauses - num_ops
+             : slot(c);
+    }
+
     /*  This is the top-level tape associated with this Deck. */
     std::shared_ptr<Tape> tape;
 
-    /*  Moves this tape into the spares bin, so it can be reused later */
-    void claim(std::shared_ptr<Tape> tape) { spares.push_back(tape); }
+    /*  Moves this tape into the spares bin, so it can be reused later.
+     *  Tapes that are stored in the cache are ignored, since they may be
+     *  in use by other workers. */
+    void claim(std::shared_ptr<Tape> tape);
 
     /*
      *  Sets the internal count of all oracles for array evaluation.
@@ -82,13 +193,38 @@ public:
     void unbindOracles();
 
 protected:
-    /*  Temporary storage, used when pushing into a Tape  */
+    /*  Used by fork() to build a Deck that shares data with other  */
+    explicit Deck(const Deck* other);
+
+    /*  Sizes the scratch arrays based on num_clauses  */
+    void resizeScratch();
+
+    /*  Temporary storage, used when pushing into a Tape.  These are
+     *  all-true and all-zero respectively between calls to Tape::push  */
     std::vector<uint8_t> disabled;
     std::vector<Clause::Id> remap;
 
     /*  We can keep spare tapes around, to avoid reallocating their data */
     std::vector<std::shared_ptr<Tape>> spares;
 
+    /*  Number of clauses with rank > 0, which always have ids in the
+     *  range [1, num_ops].  Everything above that is a leaf. */
+    Clause::Id num_ops;
+
+    /*
+     *  Assigns result slots to every clause in the given tape, based on
+     *  a liveness analysis of its (already-populated) clause list.
+     *
+     *  This populates tape.s and tape.s_i, and sets tape.num_slots.
+     */
+    void allocate(Tape& tape);
+
+    /*  Temporary storage, used when allocating slots  */
+    std::vector<uint8_t> seen;
+    std::vector<Clause::Id> slots;
+    std::vector<uint8_t> dies;
+    std::vector<Clause::Id> free_slots;
+
     friend class Tape;
 };
 
@@ -0,0 +1,59 @@
+/*
+libfive: a CAD kernel for modeling with implicit functions
+Copyright (C) 2019  Matt Keeter
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+#pragma once
+
+#include <Eigen/Eigen>
+
+#include "libfive/eval/eval_deriv.hpp"
+
+namespace Kernel {
+
+/*
+ *  The AdjointEvaluator computes the gradient with respect to free
+ *  variables using reverse-mode differentiation:  one value pass, then
+ *  one sweep from the root back down the tape.
+ *
+ *  This costs O(clauses) regardless of the number of variables, unlike
+ *  the JacobianEvaluator (which carries partial derivatives with respect
+ *  to every variable that a clause depends on, and so costs up to
+ *  O(clauses * vars)).
+ */
+class AdjointEvaluator : public DerivEvaluator
+{
+public:
+    AdjointEvaluator(const Tree& root);
+    AdjointEvaluator(const Tree& root,
+                     const std::map<Tree::Id, float>& vars);
+    AdjointEvaluator(std::shared_ptr<Deck> t);
+    AdjointEvaluator(std::shared_ptr<Deck> t,
+                     const std::map<Tree::Id, float>& vars);
+
+    /*
+     *  Returns the gradient with respect to all VAR nodes
+     */
+    std::map<Tree::Id, float> gradient(const Eigen::Vector3f& p);
+    std::map<Tree::Id, float> gradient(const Eigen::Vector3f& p,
+            std::shared_ptr<Tape> tape);
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+protected:
+    /*
+     *  Propagates the adjoint of clause id into its arguments
+     */
+    void operator()(Opcode::Opcode op, Clause::Id id,
+                    Clause::Id a, Clause::Id b);
+
+    /*  adj(clause) = droot / dclause.  This is accumulated in double
+     *  precision, since a variable may receive many contributions.  */
+    Eigen::Array<double, Eigen::Dynamic, 1> adj;
+
+    friend class Tape; // for walk<AdjointEvaluator>
+};
+
+}   // namespace Kernel
@@ -0,0 +1,115 @@
+/*
+libfive: a CAD kernel for modeling with implicit functions
+Copyright (C) 2019  Matt Keeter
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+#pragma once
+
+#include <vector>
+
+#include <Eigen/Eigen>
+
+#include "libfive/eval/eval_array.hpp"
+
+namespace Kernel {
+
+/*
+ *  The AdjointArrayEvaluator is the batched form of the AdjointEvaluator:
+ *  it evaluates up to N points at once, then computes the gradient of
+ *  every point with respect to every free variable in a single reverse
+ *  sweep over the tape.
+ *
+ *  Unlike the ArrayEvaluator, values are stored by clause id rather than
+ *  by slot, because the reverse sweep needs every intermediate value.
+ *  It inherits non-publicly so that slot-based calls can't be made on it.
+ */
+class AdjointArrayEvaluator : protected ArrayEvaluator
+{
+public:
+    AdjointArrayEvaluator(const Tree& root);
+    AdjointArrayEvaluator(const Tree& root,
+                          const std::map<Tree::Id, float>& vars);
+    AdjointArrayEvaluator(std::shared_ptr<Deck> t);
+    AdjointArrayEvaluator(std::shared_ptr<Deck> t,
+                          const std::map<Tree::Id, float>& vars);
+
+    /*
+     *  Stores the given position in the result arrays
+     */
+    void set(const Eigen::Vector3f& p, size_t index)
+    {
+        f(deck->X, index) = p.x();
+        f(deck->Y, index) = p.y();
+        f(deck->Z, index) = p.z();
+
+        for (auto& o : deck->oracles)
+        {
+            o->set(p, index);
+        }
+    }
+
+    /*
+     *  Multi-point evaluation (values must be stored with set)
+     */
+    Eigen::Block<decltype(f), 1, Eigen::Dynamic> values(size_t count);
+    Eigen::Block<decltype(f), 1, Eigen::Dynamic> values(
+            size_t count, std::shared_ptr<Tape> tape);
+
+    /*
+     *  Returns gradients with respect to free variables at the first
+     *  count points, which must have just been evaluated by values()
+     *  with the same tape.  Row i of the result is the variable
+     *  varIds()[i], and each column is a point.
+     *
+     *  Oracles and constant variables block the gradient.
+     */
+    Eigen::Block<decltype(f)> gradients(size_t count);
+    Eigen::Block<decltype(f)> gradients(
+            size_t count, std::shared_ptr<Tape> tape);
+
+    /*
+     *  Returns the free variables, in the order used by gradients()
+     */
+    const std::vector<Tree::Id>& varIds() const { return var_ids; }
+
+    /*
+     *  Changes a variable's value
+     *
+     *  If the variable isn't present in the tree, does nothing
+     *  Returns true if the variable's value changes
+     */
+    bool setVar(Tree::Id var, float value);
+
+    /*
+     *  Changes the i'th variable (in the order of varIds()), which
+     *  skips the lookup performed by setVar.
+     */
+    void setVarAt(size_t i, float value) { f.row(var_clauses[i]) = value; }
+
+    using ArrayEvaluator::N;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+protected:
+    /*
+     *  Propagates the adjoints of clause id into its arguments
+     */
+    void operator()(Opcode::Opcode op, Clause::Id id,
+                    Clause::Id a, Clause::Id b);
+
+    /*  adj(clause, index) = droot / dclause at the given point  */
+    Eigen::Array<float, Eigen::Dynamic, N, Eigen::RowMajor> adj;
+
+    /*  grad(var, index) is gathered from adj after the reverse sweep  */
+    Eigen::Array<float, Eigen::Dynamic, N, Eigen::RowMajor> grad;
+
+    /*  Free variables and their clause ids, in matching order  */
+    std::vector<Tree::Id> var_ids;
+    std::vector<Clause::Id> var_clauses;
+
+    friend class Tape; // for walk<AdjointArrayEvaluator>
+};
+
+}   // namespace Kernel
@@ -32,9 +32,10 @@ public:
      */
     void set(const Eigen::Vector3f& p, size_t index)
     {
-        f(deck->X, index) = p.x();
-        f(deck->Y, index) = p.y();
-        f(deck->Z, index) = p.z();
+        f(deck->slot(deck->X), index) = p.x();
+        f(deck->slot(deck->Y), index) = p.y();
+        f(deck->slot(deck->Z), index) = p.z();
+        cached = 0;
 
         for (auto& o : deck->oracles)
         {
@@ -59,9 +60,9 @@ public:
      *  Reads a position from the results arrays
      */
     Eigen::Vector3f get(size_t index) const {
-        return Eigen::Vector3f(f(deck->X, index),
-                               f(deck->Y, index),
-                               f(deck->Z, index));
+        return Eigen::Vector3f(f(deck->slot(deck->X), index),
+                               f(deck->slot(deck->Y), index),
+                               f(deck->slot(deck->Z), index));
     }
 
     /*  This is the number of samples that we can process in one pass */
@@ -72,12 +73,33 @@ protected:
      *  array we're addressing at once  */
     size_t count;
 
-    /*  f(clause, index) is a specific data point */
+    /*  f(slot, index) is a specific data point.  Slots are assigned
+     *  to clauses by the Deck (see Tape::rwalkSlots), so this only
+     *  holds as many rows as there are simultaneously-live values. */
     Eigen::Array<float, Eigen::Dynamic, N, Eigen::RowMajor> f;
 
     /*  ambig(index) returns whether a particular slot is ambiguous */
     Eigen::Array<bool, 1, N> ambig;
 
+    /*  equal(index) records whether any min or max clause saw equal
+     *  arguments during the most recent evaluation.  This is tracked
+     *  during the tape walk, since argument values may be overwritten
+     *  by the time that getAmbiguous is called. */
+    Eigen::Array<bool, 1, N> equal;
+
+    /*  Number of points whose intermediate results are held in f (using
+     *  the Deck's pinned layout) by valuesCached, or 0 if the cache has
+     *  been invalidated by set, values, or a call with a different count */
+    size_t cached=0;
+
+    /*  Clause ids of variables that have changed since the cache was
+     *  last brought up to date  */
+    std::vector<Clause::Id> dirty;
+
+    /*  Scratch space, used to collect the downstream clauses (as
+     *  positions in the base tape) of every dirty variable  */
+    std::vector<uint32_t> cone;
+
     /*
      *  Per-clause evaluation, used in tape walking
      */
@@ -91,6 +113,12 @@ protected:
      */
     void setCount(size_t count);
 
+    /*
+     *  Grows the result array (if necessary) so that it has room for
+     *  the given number of slots.  Leaf values are preserved.
+     */
+    void reserve(size_t slots);
+
 public:
     /*
      *  Multi-point evaluation (values must be stored with set)
@@ -99,6 +127,18 @@ public:
     Eigen::Block<decltype(f), 1, Eigen::Dynamic> values(
             size_t count, std::shared_ptr<Tape> tape);
 
+    /*
+     *  Cached multi-point evaluation, for evaluating the same points under
+     *  many different variable values (e.g. in a parameter sweep).
+     *
+     *  The first call evaluates the full base tape, keeping every
+     *  intermediate result.  After that, as long as the points and count
+     *  don't change, a call only re-evaluates the clauses downstream of
+     *  variables that were changed with setVar.  Calling set or values
+     *  invalidates the cache.
+     */
+    Eigen::Block<decltype(f), 1, Eigen::Dynamic> valuesCached(size_t count);
+
     /*
      *  Changes a variable's value
      *
@@ -25,12 +25,17 @@ public:
                         const std::map<Tree::Id, float>& vars);
 
 protected:
-    /*  d(clause).col(index) is a set of partial derivatives [dx, dy, dz] */
+    /*  d(slot).col(index) is a set of partial derivatives [dx, dy, dz] */
     Eigen::Array<Eigen::Array<float, 3, N>, Eigen::Dynamic, 1> d;
 
     /*  out(col) is a result [dx, dy, dz, w] */
     Eigen::Array<float, 4, N> out;
 
+    /*  equal_derivs(index) records whether any min or max clause saw
+     *  equal arguments with different derivatives during the most
+     *  recent call to derivs (see ArrayEvaluator::equal) */
+    Eigen::Array<bool, 1, N> equal_derivs;
+
 public:
     /*
      *  Multi-point evaluation (values must be stored with set)
@@ -40,7 +45,9 @@ public:
             size_t count, std::shared_ptr<Tape> tape);
 
     /*
-     *  Per-clause evaluation, used in tape walking
+     *  Per-clause evaluation, used in tape walking.  This evaluates
+     *  both the value and the derivatives of the clause, since values
+     *  from earlier clauses may not survive until a second walk.
      */
     void operator()(Opcode::Opcode op, Clause::Id id,
                     Clause::Id a, Clause::Id b);
@@ -53,7 +60,8 @@ public:
      *  a case where the tree has ended up calculating min(X, X)
      *  (for example).
      *
-     *  This call performs O(i) work to set up the ambig array
+     *  This call performs O(i) work to set up the ambig array, and is
+     *  only valid after a call to derivs().
      */
     Eigen::Block<decltype(ambig), 1, Eigen::Dynamic> getAmbiguousDerivs(
             size_t count, std::shared_ptr<Tape> tape);
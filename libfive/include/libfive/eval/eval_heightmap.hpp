@@ -17,7 +17,15 @@ class HeightmapEvaluator
 {
 public:
     HeightmapEvaluator(const Tree t)
-        : deck(new Deck(t)), array(deck), interval(deck)
+        : HeightmapEvaluator(std::make_shared<Deck>(t))
+    { /* Nothing to do here */ }
+
+    /*
+     *  Builds an evaluator from an existing Deck, which should not be
+     *  shared with evaluators on other threads (use Deck::fork instead)
+     */
+    HeightmapEvaluator(std::shared_ptr<Deck> d)
+        : deck(d), array(deck), interval(deck)
     { /* Nothing to do here */ }
 
 public:
@@ -36,6 +36,15 @@ public:
                      const Eigen::Vector3f& upper,
                      std::shared_ptr<Tape> tape);
 
+    /*
+     *  Interval evaluation, followed by pushing into the given tape.
+     *
+     *  If the Deck's TapeCache is enabled (and the tree doesn't contain
+     *  Oracles), results are stored there, so a region that has already
+     *  been evaluated with the same tape and variables returns the cached
+     *  result and tape.  In that case, the evaluator's intermediate
+     *  results aren't updated, so push() shouldn't be called afterwards.
+     */
     std::pair<Interval::I, std::shared_ptr<Tape>> evalAndPush(
                      const Eigen::Vector3f& lower,
                      const Eigen::Vector3f& upper);
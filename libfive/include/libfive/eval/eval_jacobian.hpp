@@ -8,6 +8,8 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 */
 #pragma once
 
+#include <vector>
+
 #include <Eigen/Eigen>
 
 #include "libfive/eval/eval_deriv.hpp"
@@ -39,8 +41,12 @@ protected:
     void operator()(Opcode::Opcode op, Clause::Id id,
                     Clause::Id a, Clause::Id b);
 
-    /*  j(clause, var) = dclause / dvar */
-    Eigen::Array<float, Eigen::Dynamic, Eigen::Dynamic> j;
+    /*  Partial derivatives, stored in parallel with deck->deps:  j[k] is
+     *  the derivative of clause c with respect to variable deps[k], for
+     *  k in [deck->depsBegin(c), deck->depsEnd(c)).  Derivatives with
+     *  respect to variables that a clause doesn't depend on are zero,
+     *  so they aren't stored. */
+    std::vector<float> j;
 
     friend class Tape; // for rwalk<JacobianEvaluator>
 };
@@ -46,6 +46,15 @@ public:
      */
     bool setVar(Tree::Id var, float value);
 
+    /*
+     *  Applies a single opcode to scalar arguments, with the same semantics
+     *  as evaluating that clause in a tape (b is ignored for unary opcodes).
+     *
+     *  op must not be ORACLE or a leaf opcode.  This is used by the Cache
+     *  to fold constant expressions without building a Deck.
+     */
+    static float evalOp(Opcode::Opcode op, float a, float b);
+
     /*  Make an aligned new operator, as this class has Eigen structs
      *  inside of it (which are aligned for SSE) */
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
@@ -22,7 +22,17 @@ public:
     { /* Nothing to do here */ }
 
     XTreeEvaluator(const Tree t, const std::map<Tree::Id, float>& vars)
-        : deck(new Deck(t)), array(deck, vars), interval(deck, vars),
+        : XTreeEvaluator(std::make_shared<Deck>(t), vars)
+    { /* Nothing to do here */ }
+
+    /*
+     *  Builds an evaluator from an existing Deck, which should not be
+     *  shared with evaluators on other threads (use Deck::fork instead)
+     */
+    XTreeEvaluator(std::shared_ptr<Deck> d,
+                   const std::map<Tree::Id, float>& vars=
+                        std::map<Tree::Id, float>())
+        : deck(d), array(deck, vars), interval(deck, vars),
           feature(deck, vars), deriv(deck, vars)
     { /* Nothing to do here */ }
 
@@ -8,16 +8,202 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 */
 #pragma once
 
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
 #include <boost/numeric/interval.hpp>
 
 namespace Kernel {
 namespace Interval {
 
+/*
+ *  Rounding policy for our intervals.
+ *
+ *  Boost's default policies switch the FPU rounding mode on every
+ *  operation (saving and restoring it around each one), which is slow
+ *  and prevents the compiler from vectorizing anything nearby.
+ *
+ *  Instead, we leave the FPU in round-to-nearest and fix up results
+ *  afterwards:  for arithmetic, the exact rounding error is recovered
+ *  with an error-free transformation (TwoSum or an FMA), and the result
+ *  is stepped by one ulp only if it was rounded the wrong way.  This
+ *  gives the same bounds as directed rounding, so exact results stay
+ *  exact.  The exception is a product or quotient that underflows, which
+ *  is always stepped outwards (see below).  Transcendental functions are
+ *  always padded by one ulp, since their rounding error can't be
+ *  recovered cheaply.
+ */
+struct Rounding : public boost::numeric::interval_lib::rounded_transc_exact<
+    float, boost::numeric::interval_lib::rounded_arith_exact<float>>
+{
+    /*  There's no rounding mode to protect, so this is its own
+     *  unprotected version (used by boost inside compound functions) */
+    typedef Rounding unprotected_rounding;
+
+    /*  Returns the smallest float that is greater than x */
+    static float nextUp(float x)
+    {
+        if (x != x || x == std::numeric_limits<float>::infinity())
+        {
+            return x;
+        }
+        else if (x == 0)
+        {
+            return std::numeric_limits<float>::denorm_min();
+        }
+        uint32_t bits;
+        memcpy(&bits, &x, sizeof(x));
+        bits += (x > 0) ? 1 : -1;
+        memcpy(&x, &bits, sizeof(x));
+        return x;
+    }
+
+    /*  Returns the largest float that is less than x */
+    static float nextDown(float x) { return -nextUp(-x); }
+
+    /*
+     *  Given a rounded result r and the sign of the exact error
+     *  (exact = r + err), returns a bound on the exact value.
+     *
+     *  An infinite result from finite inputs is an overflow, so it
+     *  is pulled back to the largest finite float; this is also
+     *  conservative when the inputs were infinite.
+     */
+    static float down(float r, float err)
+    {
+        return (err < 0 || r == std::numeric_limits<float>::infinity())
+            ? nextDown(r) : r;
+    }
+    static float up(float r, float err)
+    {
+        return (err > 0 || r == -std::numeric_limits<float>::infinity())
+            ? nextUp(r) : r;
+    }
+
+    /*  Error-free transformation for a sum s = x + y */
+    static float sumError(float x, float y, float s)
+    {
+        const float b = s - x;
+        return (x - (s - b)) + (y - b);
+    }
+    static float mulError(float x, float y, float p)
+    {
+        return std::fma(x, y, -p);
+    }
+    static float divError(float x, float y, float q)
+    {
+        // x / y = q + r / y, so the error has the sign of r / y
+        const float r = std::fma(-q, y, x);
+        return (y < 0) ? -r : r;
+    }
+
+    /*
+     *  Once a product or quotient underflows (i.e. is zero or subnormal),
+     *  its FMA residual can underflow to zero as well, hiding the
+     *  rounding direction.  In that case, we always step outwards.
+     */
+    static bool underflow(float x, float y, float r)
+    {
+        return x != 0 && y != 0 &&
+               std::abs(r) < std::numeric_limits<float>::min();
+    }
+
+    template <class U> float conv_down(const U& v)
+    {
+        const float f = static_cast<float>(v);
+        return (f > v) ? nextDown(f) : f;
+    }
+    template <class U> float conv_up(const U& v)
+    {
+        const float f = static_cast<float>(v);
+        return (f < v) ? nextUp(f) : f;
+    }
+
+    float add_down(const float& x, const float& y)
+    {
+        const float s = x + y;
+        return down(s, sumError(x, y, s));
+    }
+    float add_up(const float& x, const float& y)
+    {
+        const float s = x + y;
+        return up(s, sumError(x, y, s));
+    }
+    float sub_down(const float& x, const float& y)
+    {
+        const float s = x - y;
+        return down(s, sumError(x, -y, s));
+    }
+    float sub_up(const float& x, const float& y)
+    {
+        const float s = x - y;
+        return up(s, sumError(x, -y, s));
+    }
+    float mul_down(const float& x, const float& y)
+    {
+        const float p = x * y;
+        return underflow(x, y, p) ? nextDown(p)
+                                  : down(p, mulError(x, y, p));
+    }
+    float mul_up(const float& x, const float& y)
+    {
+        const float p = x * y;
+        return underflow(x, y, p) ? nextUp(p)
+                                  : up(p, mulError(x, y, p));
+    }
+    float div_down(const float& x, const float& y)
+    {
+        const float q = x / y;
+        return underflow(x, y, q) ? nextDown(q)
+                                  : down(q, divError(x, y, q));
+    }
+    float div_up(const float& x, const float& y)
+    {
+        const float q = x / y;
+        return underflow(x, y, q) ? nextUp(q)
+                                  : up(q, divError(x, y, q));
+    }
+    float sqrt_down(const float& x)
+    {
+        const float s = std::sqrt(x);
+        return down(s, std::fma(-s, s, x));
+    }
+    float sqrt_up(const float& x)
+    {
+        const float s = std::sqrt(x);
+        return up(s, std::fma(-s, s, x));
+    }
+
+#define LIBFIVE_INTERVAL_PADDED(f)                                  \
+    float f##_down(const float& x) { return nextDown(std::f(x)); }  \
+    float f##_up(const float& x)   { return nextUp(std::f(x)); }
+    LIBFIVE_INTERVAL_PADDED(exp)
+    LIBFIVE_INTERVAL_PADDED(log)
+    LIBFIVE_INTERVAL_PADDED(tan)
+    LIBFIVE_INTERVAL_PADDED(asin)
+    LIBFIVE_INTERVAL_PADDED(acos)
+    LIBFIVE_INTERVAL_PADDED(atan)
+    LIBFIVE_INTERVAL_PADDED(sinh)
+    LIBFIVE_INTERVAL_PADDED(cosh)
+    LIBFIVE_INTERVAL_PADDED(tanh)
+    LIBFIVE_INTERVAL_PADDED(asinh)
+    LIBFIVE_INTERVAL_PADDED(acosh)
+    LIBFIVE_INTERVAL_PADDED(atanh)
+#undef LIBFIVE_INTERVAL_PADDED
+
+    // sin and cos are also clamped, so that padding can't push
+    // them outside of [-1, 1]
+    float sin_down(const float& x) { return fmax(nextDown(std::sin(x)), -1); }
+    float sin_up(const float& x)   { return fmin(nextUp(std::sin(x)), 1); }
+    float cos_down(const float& x) { return fmax(nextDown(std::cos(x)), -1); }
+    float cos_up(const float& x)   { return fmin(nextUp(std::cos(x)), 1); }
+};
+
 typedef boost::numeric::interval<float,
     boost::numeric::interval_lib::policies<
-        boost::numeric::interval_lib::save_state<
-            boost::numeric::interval_lib::rounded_transc_std<float>>,
-        boost::numeric::interval_lib::checking_base<float>>> I;
+        Rounding, boost::numeric::interval_lib::checking_base<float>>> I;
 
 enum State { EMPTY, FILLED, AMBIGUOUS, UNKNOWN };
 
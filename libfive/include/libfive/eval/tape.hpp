@@ -8,6 +8,7 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 */
 #pragma once
 
+#include <cstdint>
 #include <vector>
 #include <memory>
 
@@ -45,6 +46,13 @@ public:
     /*  Returns tape length (used in unit tests to check for shrinkage) */
     size_t size() const { return t.size(); }
 
+    /*  Returns the clause at the given position in the tape (position 0
+     *  is the root, and evaluation runs from the end of the tape) */
+    const Clause& clause(size_t index) const { return t[index]; }
+
+    /*  Returns the clause id of the tape's root */
+    Clause::Id root() const { return i; }
+
     /*  Returns the assigned context from this tape */
     std::shared_ptr<OracleContext> getContext(unsigned i) const;
 
@@ -55,6 +63,16 @@ public:
      */
     bool isTerminal() const { return terminal; }
 
+    /*  Returns the number of result slots needed to evaluate this tape
+     *  with an array evaluator (including the dummy slot 0) */
+    size_t slots() const { return num_slots; }
+
+    /*  Returns a number that identifies this tape's contents.  It is
+     *  unique among tapes in the process, and changes when a Deck
+     *  recycles the tape, so it's safe to use where the address isn't
+     *  (e.g. in a TapeCache::Key). */
+    uint64_t serial() const { return serial_; }
+
 protected:
     /*  The tape itself, as a vector of clauses  */
     std::vector<Clause> t;
@@ -66,6 +84,17 @@ protected:
     /*  Root clause of the tape  */
     Clause::Id i;
 
+    /*  The same tape, stored in evaluation order, with clause ids replaced
+     *  by result slots.  Slots are assigned by Deck::allocate so that
+     *  operations whose values are dead can share storage; this is used
+     *  by the array evaluators, which have the largest per-clause cost.
+     *
+     *  s_i is the slot of the root clause, and num_slots is one more
+     *  than the highest slot used. */
+    std::vector<Clause> s;
+    Clause::Id s_i;
+    Clause::Id num_slots;
+
     /*  These bounds are only valid if type == INTERVAL  */
     Interval::I X, Y, Z;
     Type type;
@@ -78,6 +107,14 @@ protected:
      *  to traverse up through the tape. */
     Handle parent;
 
+    /*  Set when the tape is stored in a TapeCache, in which case it may
+     *  be shared between workers and must not be recycled by the Deck */
+    bool cached=false;
+
+    /*  See serial() above.  This is assigned from a global counter. */
+    uint64_t serial_=nextSerial();
+    static uint64_t nextSerial();
+
 public:
     /*
      *  Returns a new tape that is specialized with the given function.
@@ -115,8 +152,35 @@ public:
         return i;
     }
 
+    /*
+     *  Equivalent to rwalk, but passing result slots (rather than clause
+     *  ids) to the given function.  Returns the root clause's slot.
+     */
+    template <class T>
+    Clause::Id rwalkSlots(T& fn)
+    {
+        for (const auto& c : s)
+        {
+            fn(c.op, c.id, c.a, c.b);
+        }
+        return s_i;
+    }
+
     void  walk(WalkFunction fn, bool& abort);
 
+    /*
+     *  Inlined version of walk, which visits clauses from the root down
+     *  (used for reverse-mode differentiation)
+     */
+    template <class T>
+    void walk(T& fn)
+    {
+        for (const auto& c : t)
+        {
+            fn(c.op, c.id, c.a, c.b);
+        }
+    }
+
     /*
      *  Walks up the tape list until p is within the tape's region, then
      *  returns a Handle that restores the original tape.
@@ -129,6 +193,7 @@ public:
     static Handle getBase(Handle tape, const Region<3>& r);
 
     friend class Deck;
+    friend class TapeCache;
 };
 
 }   // namespace Kernel
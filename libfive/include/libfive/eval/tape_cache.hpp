@@ -0,0 +1,125 @@
+/*
+libfive: a CAD kernel for modeling with implicit functions
+Copyright (C) 2019  Matt Keeter
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "libfive/eval/interval.hpp"
+
+namespace Kernel {
+
+class Tape; /* Forward declaration */
+
+/*
+ *  A TapeCache stores the results of IntervalEvaluator::evalAndPush, so
+ *  that when the same region of the same tape is evaluated again (by a
+ *  different worker, or by a later render using the same Deck), the
+ *  specialized tape is shared instead of being pushed again.
+ *
+ *  The cache is shared by every Deck forked from the same tree, and is
+ *  safe to use from multiple threads.  Its size is bounded by the total
+ *  number of clauses in the cached tapes; when it is full, the
+ *  least-recently-used entries are evicted.
+ *
+ *  It is disabled (with a capacity of zero) by default:  within a single
+ *  render, every region is distinct, so lookups only add locking.  A
+ *  long-lived Deck that re-renders the same model (e.g. in Studio) should
+ *  enable it with setCapacity.
+ */
+class TapeCache
+{
+public:
+    /*  Identifies a specialization:  the tape that was pushed (by its
+     *  serial number, since Decks recycle tapes), the bounds of the
+     *  region, and the value of every variable in the Deck  */
+    struct Key
+    {
+        uint64_t parent;
+        std::array<float, 6> bounds;
+        std::vector<float> vars;
+
+        bool operator==(const Key& other) const;
+    };
+
+    /*  The results of interval evaluation and pushing for a Key  */
+    struct Entry
+    {
+        Interval::I result;
+        bool safe;
+        std::shared_ptr<Tape> tape;
+    };
+
+    /*  Default capacity (disabled), and a reasonable capacity for
+     *  users that enable the cache, as a total number of clauses  */
+    static const size_t DEFAULT_CAPACITY = 0;
+    static const size_t TYPICAL_CAPACITY = 1 << 20;
+
+    explicit TapeCache(size_t capacity=DEFAULT_CAPACITY);
+
+    /*
+     *  Looks up the given key, marking it as recently used.
+     *  Returns true and populates out if it is present.
+     */
+    bool find(const Key& key, Entry& out);
+
+    /*
+     *  Stores an entry, evicting older entries to stay within capacity.
+     *
+     *  Every tape in the cache is marked so that Deck::claim won't
+     *  recycle it, since it may be in use (or used as a parent in a Key)
+     *  by other workers.
+     */
+    void insert(const Key& key, const Entry& entry);
+
+    /*
+     *  Changes the capacity (in clauses), evicting entries as needed.
+     *  A capacity of zero disables the cache.
+     */
+    void setCapacity(size_t capacity);
+
+    /*  Returns the capacity.  This doesn't lock, so it is cheap enough
+     *  to check before building a Key.  */
+    size_t capacity() const { return cap; }
+
+    /*  Returns the number of cached entries  */
+    size_t size() const;
+
+    /*  Removes every entry from the cache  */
+    void clear();
+
+protected:
+    /*  Removes least-recently-used entries until we're within capacity.
+     *  This must be called with mut held.  */
+    void evict();
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& k) const;
+    };
+
+    mutable std::mutex mut;
+
+    /*  Entries in order of use, with the most recent at the front  */
+    std::list<std::pair<Key, Entry>> lru;
+    std::unordered_map<Key, std::list<std::pair<Key, Entry>>::iterator,
+                       KeyHash> map;
+
+    /*  Total number of clauses in cached tapes, and the limit on it  */
+    size_t total=0;
+    std::atomic<size_t> cap;
+};
+
+}   // namespace Kernel
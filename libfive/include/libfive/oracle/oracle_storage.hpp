@@ -74,7 +74,7 @@ protected:
     Eigen::Vector3f upper;
 
     /* Local storage for setCount*/
-    Eigen::Index stored_count;
+    Eigen::Index stored_count=0;
 };
 
 }   // namespace Kernel
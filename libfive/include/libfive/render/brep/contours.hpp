@@ -12,12 +12,15 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 #include "libfive/render/brep/region.hpp"
 
 #include <atomic>
+#include <memory>
+#include <vector>
 
 namespace Kernel {
 
 // Forward declarations
 template <unsigned N> class PerThreadBRep;
 class XTreeEvaluator;
+class Tape;
 struct BRepSettings;
 
 class Contours {
@@ -29,6 +32,24 @@ public:
         const Tree t, const Region<2>& r,
         const BRepSettings& settings);
 
+    /*
+     *  Renders a stack of slices through r, one at each of the given
+     *  Z heights, returning contours in the same order as zs.
+     *
+     *  This is much cheaper than calling render once per layer:  the tree
+     *  is only flattened once, and sorted layers are grouped into slabs
+     *  that are interval-pruned together, so each layer starts from a
+     *  tape that is already specialized for its neighborhood.  Slabs
+     *  which are entirely empty or filled skip meshing altogether.
+     *
+     *  Layers are rendered in parallel, with each of settings.workers
+     *  threads building one layer at a time.  cancel is checked between
+     *  groups of layers; if it is set, this returns an empty vector.
+     */
+    static std::vector<std::unique_ptr<Contours>> renderStack(
+        const Tree t, const Region<2>& r, const std::vector<double>& zs,
+        const BRepSettings& settings);
+
     /*
      *  Saves the contours to an SVG file
      */
@@ -50,6 +71,20 @@ public:
 
 protected:
     Contours(Region<2> bbox) : bbox(bbox) {}
+
+    /*
+     *  Renders the layers in [begin, end), which are indices into zs
+     *  (sorted by height), storing results in out.  The slab spanning
+     *  those layers is pruned with the given tape's interval evaluator,
+     *  then split in half recursively until there's one layer left.
+     */
+    static void renderSlab(XTreeEvaluator* eval, const Region<2>& r,
+                           const std::vector<double>& zs,
+                           std::vector<size_t>::const_iterator begin,
+                           std::vector<size_t>::const_iterator end,
+                           std::shared_ptr<Tape> tape,
+                           const BRepSettings& settings,
+                           std::vector<std::unique_ptr<Contours>>& out);
 };
 
 }   // namespace Kernel
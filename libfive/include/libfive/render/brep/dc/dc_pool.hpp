@@ -9,13 +9,35 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 #pragma once
 
 #include <memory>
+#include <utility>
 
 #include "libfive/render/brep/worker_pool.hpp"
+#include "libfive/render/brep/settings.hpp"
 #include "libfive/render/brep/dc/dc_neighbors.hpp"
 #include "libfive/render/brep/dc/dc_tree.hpp"
 
 namespace Kernel {
 
+template <unsigned N>
+struct LeafEval<DCTree<N>>
+{
+    static constexpr bool batch = true;
+
+    template <typename... Args>
+    static void leaf(DCTree<N>* t, const BRepSettings& settings,
+                     Args&&... args)
+    {
+        t->evalLeaf(std::forward<Args>(args)..., settings.edge_tolerance);
+    }
+
+    template <typename... Args>
+    static void leaves(DCTree<N>* t, const BRepSettings& settings,
+                       Args&&... args)
+    {
+        t->evalLeaves(std::forward<Args>(args)..., settings.edge_tolerance);
+    }
+};
+
 template <unsigned N>
 using DCPool = WorkerPool<DCTree<N>, DCNeighbors<N>, N>;
 
@@ -0,0 +1,116 @@
+/*
+libfive: a CAD kernel for modeling with implicit functions
+
+Copyright (C) 2019  Matt Keeter
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "libfive/eval/clause.hpp"
+#include "libfive/tree/tree.hpp"
+#include "libfive/render/brep/root.hpp"
+#include "libfive/render/brep/region.hpp"
+#include "libfive/render/brep/dc/dc_tree.hpp"
+
+namespace Kernel {
+
+/* Forward declarations */
+class XTreeEvaluator;
+class IntervalEvaluator;
+class Tape;
+class Mesh;
+struct BRepSettings;
+
+/*
+ *  A DCRefiner keeps the dual contouring octree from one render to the
+ *  next, so that interactive applications can re-mesh cheaply.
+ *
+ *  When the resolution increases, cells which were proven filled or empty
+ *  by interval arithmetic are kept, and only the remaining leaf cells are
+ *  subdivided further.  When variables change, only cells whose tapes
+ *  depend on those variables (before or after the change) are revisited,
+ *  and of those, only the cells whose interval result changed or which
+ *  contain the surface are rebuilt.
+ *
+ *  Any other change (bounds, max_err, or a coarser resolution) throws away
+ *  the stored tree and builds a new one from scratch.
+ */
+class DCRefiner
+{
+public:
+    /*
+     *  Builds or updates the stored octree, then meshes it.
+     *
+     *  es must be an array of at least settings.workers evaluators,
+     *  which have already been updated with the values in vars.  vars
+     *  should include every variable in the model, and is compared against
+     *  the values from the previous call to find which ones have changed.
+     *
+     *  Returns nullptr if the render is cancelled, in which case the
+     *  stored tree is discarded.
+     */
+    std::unique_ptr<Mesh> render(XTreeEvaluator* es, const Region<3>& region,
+                                 const BRepSettings& settings,
+                                 const std::map<Tree::Id, float>& vars);
+
+    /*
+     *  Discards the stored tree, so that the next render starts over
+     */
+    void reset();
+
+    /*
+     *  Returns the number of cells that were rebuilt by the most recent
+     *  call to render, or -1 if it built an entirely new tree.
+     */
+    int rebuilt() const { return rebuilt_count; }
+
+protected:
+    /*  A cell to be rebuilt, along with its region  */
+    struct Target
+    {
+        DCTree<3>* tree;
+        Region<3> region;
+    };
+
+    /*
+     *  Recursively walks the stored tree, storing cells which must be
+     *  rebuilt into targets.  old_tape and new_tape are specialized for
+     *  the parent cell with the previous and current variable values;
+     *  old_interval is an evaluator that uses the previous values.
+     */
+    void findTargets(XTreeEvaluator* eval, IntervalEvaluator& old_interval,
+                     DCTree<3>* t, const Region<3>& r,
+                     std::shared_ptr<Tape> old_tape,
+                     std::shared_ptr<Tape> new_tape,
+                     bool finer, std::vector<Target>& targets) const;
+
+    /*
+     *  Checks whether the given tape uses any of the changed variables
+     */
+    bool dependsOnChanges(const std::shared_ptr<Tape>& tape) const;
+
+    /*  The stored tree, which is finished (and unwalked) between renders */
+    Root<DCTree<3>> tree;
+
+    /*  Settings used to build the stored tree  */
+    Region<3> region;
+    double max_err=0;
+
+    /*  Variable values used to build the stored tree  */
+    std::map<Tree::Id, float> vars;
+
+    /*  Clause ids of variables changed in the current render  */
+    std::set<Clause::Id> changed;
+
+    int rebuilt_count=-1;
+};
+
+}   // namespace Kernel
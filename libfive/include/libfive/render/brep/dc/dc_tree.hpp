@@ -127,7 +127,34 @@ public:
                   std::shared_ptr<Tape> tape,
                   const Region<N>& region,
                   Pool& spare_leafs,
-                  const DCNeighbors<N>& neighbors);
+                  const DCNeighbors<N>& neighbors,
+                  double edge_tolerance);
+
+    /*
+     *  Evaluates every grandchild of this cell as a leaf, given that the
+     *  grandchildren are at the lowest level of the tree.
+     *
+     *  Each child must already have been evaluated with evalInterval,
+     *  which returned tapes[i].  If child i is ambiguous, then leaves[i]
+     *  holds its children (which are built here); otherwise, leaves[i]
+     *  is all nullptr.
+     *
+     *  The corners of every leaf are evaluated in a single batch, on a
+     *  5^N lattice with this cell's tape (rather than up to 2^N points
+     *  for each of 4^N leaves).  Then, the edge searches for each child's
+     *  leaves are batched with that child's tape, searching edges that
+     *  are shared between leaves only once.  Finally, each leaf is built
+     *  as in evalLeaf.
+     */
+    void evalLeaves(
+            XTreeEvaluator* eval,
+            std::shared_ptr<Tape> tape,
+            const Region<N>& region,
+            const std::array<std::shared_ptr<Tape>, 1 << N>& tapes,
+            const std::array<std::array<DCTree<N>*, 1 << N>, 1 << N>& leaves,
+            Pool& spare_leafs,
+            const DCNeighbors<N>& neighbors,
+            double edge_tolerance);
 
     /*
      *  If all children are present, then collapse based on the error
@@ -215,7 +242,37 @@ public:
      */
     void releaseTo(Pool& object_pool);
 
+    /*
+     *  Copies the cells of this tree that touch its outer boundary into
+     *  the given object pool, returning the root of the copy.  Children
+     *  away from the boundary are replaced with the placeholder (which
+     *  should be an EMPTY cell, e.g. from DCTree::empty()), so the copy
+     *  can still be walked by face and edge procedures along its sides.
+     *
+     *  Only the leaf data used by DCMesher is copied, and vertex indices
+     *  are cleared.  The copy should be freed with releaseSurface.
+     */
+    DCTree<N>* copySurface(Pool& object_pool, DCTree<N>* placeholder) const;
+
+    /*
+     *  Walks the tree, clearing the vertex indices that are assigned
+     *  while meshing, so that the tree can be meshed again.
+     */
+    void resetIndices() const;
+
 protected:
+    /*
+     *  Edge searches that were done ahead of time for a leaf (see
+     *  evalLeaves), indexed by directed edge (as found with
+     *  MarchingTable<N>::e(a)[b]).  Only edges with their bit set in
+     *  mask hold a narrowed [inside, outside] pair.
+     */
+    struct SearchedEdges
+    {
+        std::array<std::pair<Vec, Vec>, _edges(N) * 2> targets;
+        uint32_t mask=0;
+    };
+
     /*
      *  Searches for a vertex within the DCTree cell, using the QEF matrices
      *  that are pre-populated in AtA, AtB, etc.
@@ -270,12 +327,47 @@ protected:
      */
     static std::array<unsigned, 2*N> edgesFromChild(unsigned childIndex);
 
+    /*
+     *  Finds the filled / empty state of the first count points in pos,
+     *  storing results in the matching slots of corners.
+     */
+    template <int C>
+    static void evalCorners(XTreeEvaluator* eval,
+                            std::shared_ptr<Tape> tape,
+                            const Eigen::Matrix<float, 3, C>& pos,
+                            unsigned count,
+                            Interval::State* corners);
+
+    /*
+     *  Given the states of every corner of the cell, sets type and (if the
+     *  cell is ambiguous) solves for vertex positions.  This is the second
+     *  half of evalLeaf.
+     *
+     *  Edges that can't be copied from a neighbor are taken from searched
+     *  (if it is non-null and holds them), or searched here otherwise.
+     */
+    void buildLeaf(XTreeEvaluator* eval,
+                   std::shared_ptr<Tape> tape,
+                   const Region<N>& region,
+                   Pool& spare_leafs,
+                   const DCNeighbors<N>& neighbors,
+                   const std::array<Interval::State, 1 << N>& corners,
+                   double edge_tolerance,
+                   const SearchedEdges* searched=nullptr);
+
     /*
      *  Returns a corner mask bitfield from the given array
      */
     static uint8_t buildCornerMask(
             const std::array<Interval::State, 1 << N>& corners);
 
+    /*
+     *  Recursive helper for copySurface, where outer is the region of
+     *  the tree being copied.
+     */
+    DCTree<N>* copySurface(Pool& object_pool, DCTree<N>* placeholder,
+                           const Region<N>& outer, DCTree<N>* parent) const;
+
     /*  Eigenvalue threshold for determining feature rank  */
     constexpr static double EIGENVALUE_CUTOFF=0.1f;
 };
@@ -62,6 +62,14 @@ public:
             const BRepSettings& settings,
             std::function<M(PerThreadBRep<N>&, int)> MesherFactory);
 
+    /*
+     *  Calls the mesher on every dual cell inside of t (but not those
+     *  which cross its boundary, which are handled by its ancestors).
+     *  t and its subtree must be finished.
+     */
+    template <typename T, typename Mesher>
+    static void work(const T* t, Mesher& m);
+
 protected:
     template<typename T, typename Mesher>
     static void run(Mesher& m,
@@ -70,9 +78,6 @@ protected:
                     const BRepSettings& settings,
                     std::atomic_bool& done);
 
-    template <typename T, typename Mesher>
-    static void work(const T* t, Mesher& m);
-
     template <typename T, typename Mesher>
     static void handleTopEdges(T* t, Mesher& m);
 };
@@ -0,0 +1,43 @@
+/*
+libfive: a CAD kernel for modeling with implicit functions
+Copyright (C) 2019  Matt Keeter
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+#pragma once
+
+#include <memory>
+#include <utility>
+
+#include <Eigen/Eigen>
+
+namespace Kernel {
+
+/* Forward declarations */
+class XTreeEvaluator;
+class Tape;
+template <unsigned N> class Region;
+
+/*
+ *  Searches for the surface along count edges at once.  Each target is a
+ *  pair of points [inside, outside], which is narrowed in place until the
+ *  two points are within tolerance (as a fraction of the starting edge
+ *  length) of each other.  region is only used for its perpendicular
+ *  coordinates, and count must be at most ArrayEvaluator::N / 2.
+ *
+ *  This is a bracketed Newton search: each step uses the derivative at
+ *  the most recent point, falling back to false position (with the
+ *  Illinois modification) when the Newton step would leave the bracket
+ *  and to bisection when the bracket isn't shrinking quickly enough.
+ *  On smooth fields, this takes a handful of evaluations per edge.
+ */
+template <unsigned N>
+void searchEdges(XTreeEvaluator* eval, std::shared_ptr<Tape> tape,
+                 const Region<N>& region,
+                 std::pair<Eigen::Matrix<double, N, 1>,
+                           Eigen::Matrix<double, N, 1>>* targets,
+                 unsigned count, double tolerance);
+
+}   // namespace Kernel
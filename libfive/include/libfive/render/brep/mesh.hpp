@@ -44,15 +44,58 @@ public:
             const BRepSettings& settings);
 
     /*
-     *  Writes the mesh to a file
+     *  Out-of-core render function, which streams a dual contoured
+     *  mesh to a binary STL file instead of returning it.
+     *
+     *  The region is split into bricks that each hold brick_level levels
+     *  of the octree that render() would build.  Each brick is built
+     *  and meshed on its own, then only the cells on its boundary are
+     *  kept, until the seams with its neighbors have been meshed.  This
+     *  bounds memory by the size of one brick plus a slab of boundary
+     *  cells, rather than by the whole model.
+     *
+     *  Cells can't be collapsed across brick boundaries, so the result
+     *  may have slightly more triangles than render() would produce.
+     *  settings.alg is ignored, and cancel is only checked between bricks.
+     *
+     *  Returns false if the file can't be written, a brick can't be
+     *  built, or cancel is set.  In each case, the partially-written file
+     *  is removed, so a file is only left behind on success.
+     */
+    static bool renderTiled(const Tree t, const Region<3>& r,
+                            const BRepSettings& settings,
+                            const std::string& filename,
+                            unsigned brick_level=6);
+
+    /*
+     *  Writes the mesh to a binary STL file, with facet normals.
+     *
+     *  Triangles are encoded into large buffers in parallel (with up to
+     *  workers threads, or one per hardware thread if workers is 0), then
+     *  written out sequentially.
      */
-    bool saveSTL(const std::string& filename) const;
+    bool saveSTL(const std::string& filename, unsigned workers=0) const;
 
     /*
      *  Merge multiple bodies and write them to a single file
      */
     static bool saveSTL(const std::string& filename,
-                        const std::list<const Mesh*>& meshes);
+                        const std::list<const Mesh*>& meshes,
+                        unsigned workers=0);
+
+    /*
+     *  Writes the mesh to a binary PLY file, as indexed vertices and
+     *  triangles (which is much smaller than STL, since vertices are
+     *  shared between triangles).  Encoding works as in saveSTL.
+     */
+    bool savePLY(const std::string& filename, unsigned workers=0) const;
+
+    /*
+     *  Merge multiple bodies and write them to a single PLY file
+     */
+    static bool savePLY(const std::string& filename,
+                        const std::list<const Mesh*>& meshes,
+                        unsigned workers=0);
 
 protected:
 
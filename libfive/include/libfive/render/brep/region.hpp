@@ -264,6 +264,15 @@ public:
         return Region<N>(lower, upper, perp, level);
     }
 
+    /*
+     *  Returns a version of this region with the given level, for when
+     *  the number of subdivisions must match some other tree (rather
+     *  than being derived from a minimum feature size).
+     */
+    Region<N> withLevel(int32_t level) const {
+        return Region<N>(lower, upper, perp, level);
+    }
+
 
     /*  Finds the intersection of a ray with this region, setting *found to
      *  true on success and false otherwise. */
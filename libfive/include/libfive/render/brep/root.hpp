@@ -44,6 +44,9 @@ public:
     const T* operator->() const { return ptr; }
     const T* get() const { return ptr; }
 
+    /*  Mutable access, for callers that edit a finished tree in place */
+    T* get() { return ptr; }
+
     void claim(typename T::Pool& pool) {
         tree_count += pool.size();
         object_pool.claim(pool);
@@ -51,7 +54,40 @@ public:
 
     int64_t size() const { return tree_count; }
 
+    /*
+     *  Replaces target (which must be this root's tree or one of its
+     *  descendants) with the tree from other, taking ownership of all of
+     *  other's objects.  The old subtree is released for reuse.
+     */
+    void splice(T* target, Root<T>&& other)
+    {
+        T* t = other.ptr;
+        other.ptr = nullptr;
+        object_pool.claim(other.object_pool);
+
+        if (target == ptr) {
+            ptr = t;
+        } else {
+            t->parent = target->parent;
+            t->parent_index = target->parent_index;
+            target->parent->children[target->parent_index] = t;
+        }
+        release(target);
+        tree_count = object_pool.size();
+    }
+
 protected:
+    /*  Releases a tree and all of its descendants into object_pool  */
+    void release(T* t)
+    {
+        if (t->isBranch()) {
+            for (auto& c : t->children) {
+                release(c.exchange(nullptr));
+            }
+        }
+        t->releaseTo(object_pool);
+    }
+
     T* ptr;
     typename T::Pool object_pool;
 
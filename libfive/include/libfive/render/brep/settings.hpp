@@ -33,13 +33,28 @@ public:
     void reset() {
         min_feature = 0.1;
         max_err = 1e-8;
+        edge_tolerance = 1e-5;
         workers = 8;
         alg = DUAL_CONTOURING;
+        pipelined = false;
         free_thread_handler = nullptr;
         progress_handler = nullptr;
         cancel.store(false);
     }
 
+    /*  Copies every setting except the progress handler and cancel flag,
+     *  which belong to a single render.  (The struct itself isn't
+     *  copyable, because cancel is atomic.)  */
+    void copyFrom(const BRepSettings& other) {
+        min_feature = other.min_feature;
+        max_err = other.max_err;
+        edge_tolerance = other.edge_tolerance;
+        workers = other.workers;
+        alg = other.alg;
+        pipelined = other.pipelined;
+        free_thread_handler = other.free_thread_handler;
+    }
+
     /*  The meshing region is subdivided until the smallest region edge
      *  is below min_feature in size.  Make this smaller to get a
      *  higher-resolution model. */
@@ -50,6 +65,13 @@ public:
      *  completely disable cell merging.  */
     double max_err;
 
+    /*  Surface crossings on cell edges are found to within this fraction
+     *  of the edge length (by dual contouring, and by the simplex and
+     *  hybrid meshers when they place surface vertices).  The search is
+     *  guided by derivatives, so tightening this costs only a few
+     *  evaluations. */
+    double edge_tolerance;
+
     /*  Number of worker threads to use while meshing.  Set as 0 to use the
      *  platform-default number of threads. */
     unsigned workers;
@@ -57,6 +79,12 @@ public:
     /*  This is the meshing algorti */
     BRepAlgorithm alg;
 
+    /*  If true, dual contouring meshes each subtree as soon as it is built
+     *  (rather than walking the finished tree in a second pass), then
+     *  releases cells that can no longer affect the mesh.  This lowers
+     *  peak memory on large models.  Other algorithms ignore this flag. */
+    bool pipelined;
+
     /*  Optional function called when a thread finds itself without anything
      *  to do.  This can be used to keep threads from spinning if libfive
      *  is embedded in a larger application with its own pooling system. */
@@ -34,14 +34,15 @@ public:
      *  Constructs a mesher that owns an evaluator,
      *  which is built from the given tree.
      */
-    SimplexMesher(PerThreadBRep<3>& m, Tree t);
+    SimplexMesher(PerThreadBRep<3>& m, Tree t, double edge_tolerance=1e-5);
 
     /*
      *  Constructs a mesher that has borrowed an evaluator,
      *  which is useful in cases where constructing evaluators
      *  is expensive and they should be re-used.
      */
-    SimplexMesher(PerThreadBRep<3>& m, XTreeEvaluator* es);
+    SimplexMesher(PerThreadBRep<3>& m, XTreeEvaluator* es,
+                  double edge_tolerance=1e-5);
 
     ~SimplexMesher();
 
@@ -59,9 +60,9 @@ public:
 
 protected:
     /*
-     *  Performs a binary search along a particular edge using the
-     *  provided tape.  Stores the resulting vertex into the Mesh m,
-     *  and returns its index.
+     *  Searches for the surface along a particular edge using the
+     *  provided tape (see searchEdges).  Stores the resulting vertex
+     *  into the Mesh m, and returns its index.
      */
     uint64_t searchEdge(Eigen::Vector3d inside, Eigen::Vector3d outside,
                         std::shared_ptr<Tape> tape);
@@ -69,6 +70,7 @@ protected:
     PerThreadBRep<3>& m;
     XTreeEvaluator* eval;
     bool owned;
+    double edge_tolerance;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
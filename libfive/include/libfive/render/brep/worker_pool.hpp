@@ -10,7 +10,14 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 #pragma once
 
 #include <atomic>
-#include <boost/lockfree/stack.hpp>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <utility>
+#include <vector>
 
 #include "libfive/render/brep/root.hpp"
 #include "libfive/tree/tree.hpp"
@@ -23,6 +30,28 @@ template <unsigned N> class Region;
 class Tape;
 struct BRepSettings;
 
+/*
+ *  Adapts WorkerPool to each tree's leaf-building functions.  By default,
+ *  each leaf is built on its own with evalLeaf(eval, tape, region, pool,
+ *  neighbors).  Trees that need settings while building leaves, or that
+ *  can build all of the leaves below a level-2 cell in one batch (with
+ *  batch set to true), specialize this (see DCPool).
+ */
+template <typename T>
+struct LeafEval
+{
+    static constexpr bool batch = false;
+
+    template <typename... Args>
+    static void leaf(T* t, const BRepSettings&, Args&&... args)
+    {
+        t->evalLeaf(std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    static void leaves(T*, const BRepSettings&, Args&&...) { assert(false); }
+};
+
 /*
  *  A WorkerPool is used to construct a recursive tree (quadtree / octree)
  *  by sharing the work among a pool of threads.
@@ -37,13 +66,35 @@ public:
      */
     static Root<T> build(Tree t, const Region<N>& region,
                          const BRepSettings& settings);
+    /*
+     *  Called by a worker when a tree finishes construction as a branch.
+     *  Such a tree can't be collapsed by its parent, so its subtree is
+     *  final.  The arguments are the tree, the worker's index, and the
+     *  worker's object pool (into which the callback may release trees).
+     */
+    using BranchCallback =
+        std::function<void(T*, unsigned, typename T::Pool&)>;
+
     /*
      *  General-purpose evaluation function
      *
      *  eval must be an array of at least [settings.workers] evaluators
+     *
+     *  The tree is subdivided down to settings.min_feature, unless the
+     *  region already has a level (see Region::withLevel), in which case
+     *  it is subdivided exactly that many times.
+     *
+     *  If on_branch is provided, it is invoked on every finished branch
+     *  (children before parents) before the parent is collected.
+     *
+     *  If tape is provided, it is used as the starting tape (instead of
+     *  the deck's base tape), so it must be valid over the whole region
+     *  (e.g. the result of an interval evalAndPush on a larger region).
      */
     static Root<T> build(XTreeEvaluator* eval, const Region<N>& region,
-                         const BRepSettings& settings);
+                         const BRepSettings& settings,
+                         BranchCallback on_branch=nullptr,
+                         std::shared_ptr<Tape> tape=nullptr);
 
 protected:
     struct Task {
@@ -53,12 +104,65 @@ protected:
         Neighbors parent_neighbors;
     };
 
-    using LockFreeStack =
-        boost::lockfree::stack<Task, boost::lockfree::fixed_sized<true>>;
+    /*
+     *  Per-worker task deques with work stealing.
+     *
+     *  Each worker pushes and pops tasks at the back of its own deque, so it
+     *  walks the tree depth-first; idle workers steal from the front of
+     *  other workers' deques (where the larger, shallower tasks live),
+     *  starting from a random victim.  Workers that can't find anything to
+     *  do park on a condition variable until a task is pushed.
+     */
+    class TaskQueues
+    {
+    public:
+        explicit TaskQueues(unsigned workers);
+
+        /*  Pushes a task to the back of the given worker's deque  */
+        void push(unsigned worker, const Task& task);
+
+        /*
+         *  Pops a task from the back of the given worker's deque,
+         *  stealing from another worker if it is empty.
+         *  Returns false if no task was found.
+         */
+        bool pop(unsigned worker, Task& task);
+
+        /*
+         *  Blocks until a task may be available, the pool is stopped,
+         *  or a short timeout passes (so that cancellation is noticed).
+         */
+        void park();
+
+        /*  Wakes all parked workers so that they notice termination  */
+        void stop();
+
+    protected:
+        struct Queue
+        {
+            std::mutex mut;
+            std::deque<Task> tasks;
+
+            /*  Used by the owning worker to pick victims when stealing  */
+            std::minstd_rand rng;
+        };
+        std::vector<Queue> queues;
+
+        /*  Total number of tasks across all deques  */
+        std::atomic<unsigned> queued;
+
+        /*  Number of workers in park(), used to skip needless notifies */
+        std::atomic<unsigned> parked;
+        std::atomic_bool stopped;
+
+        std::mutex park_mut;
+        std::condition_variable park_cv;
+    };
 
-    static void run(XTreeEvaluator* eval, LockFreeStack& tasks,
+    static void run(XTreeEvaluator* eval, TaskQueues& tasks, unsigned worker,
                     Root<T>& root, std::mutex& root_lock,
                     const BRepSettings& settings,
+                    const BranchCallback& on_branch,
                     std::atomic_bool& done);
 };
 
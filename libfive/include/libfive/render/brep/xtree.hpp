@@ -49,6 +49,31 @@ public:
      */
     void resetPending() const;
 
+    /*
+     *  Releases every descendant of this tree that doesn't touch its
+     *  outer boundary into the given object pool.  This must only be
+     *  called on a finished branch, after each of its child branches
+     *  has done the same.
+     *
+     *  Cells away from the boundary can't be reached by neighbor lookups
+     *  or by the dual walk of any ancestor, so this lets a pipelined
+     *  mesher reclaim them once it has walked this tree.  Since released
+     *  cells are reused elsewhere in the tree, their slots in the children
+     *  arrays of surviving cells are pointed at placeholder, which must
+     *  outlive the tree (e.g. an empty tree from DCTree::empty).
+     */
+    template <typename Pool>
+    void releaseInterior(Pool& object_pool, T* placeholder);
+
+    /*
+     *  Releases this tree and every descendant that touches its outer
+     *  boundary into the given object pool.  Other children are skipped,
+     *  since they're shared placeholders (left by releaseInterior or
+     *  DCTree::copySurface).
+     */
+    template <typename Pool>
+    void releaseSurface(Pool& object_pool);
+
     /*  Parent tree, or nullptr if this is the root */
     T* parent;
 
@@ -83,6 +108,28 @@ protected:
     template <typename Pool>
     void releaseChildren(Pool& object_pool);
 
+    /*
+     *  Checks whether the i'th child of this tree touches the boundary
+     *  of the given region.  This doesn't dereference the child, which
+     *  may already have been released.
+     */
+    bool childTouches(unsigned i, const Region<N>& bounds) const;
+
+    /*
+     *  Helpers for releaseInterior.  Both expect that the only surviving
+     *  descendants of this tree are those touching the boundary of outer.
+     *
+     *  pruneInterior releases descendants that don't also touch the
+     *  boundary of inner, replacing them with placeholder;
+     *  releaseSurviving releases this tree and all of its surviving
+     *  descendants.
+     */
+    template <typename Pool>
+    void pruneInterior(Pool& object_pool, const Region<N>& outer,
+                       const Region<N>& inner, T* placeholder);
+    template <typename Pool>
+    void releaseSurviving(Pool& object_pool, const Region<N>& outer);
+
     /*
      *  Call this when construction is complete; it will atomically install
      *  this tree into the parent's array of children pointers.
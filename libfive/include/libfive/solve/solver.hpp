@@ -10,11 +10,14 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 #pragma once
 #include <map>
 #include <set>
+#include <vector>
 
 #include <Eigen/Eigen>
 
 #include "libfive/tree/cache.hpp"
 #include "libfive/eval/eval_jacobian.hpp"
+#include "libfive/eval/eval_adjoint.hpp"
+#include "libfive/eval/eval_adjoint_array.hpp"
 
 namespace Kernel {
 
@@ -30,6 +33,10 @@ namespace Solver
      *
      *  pos is the x,y,z coordinates at which to solve
      *  Initial conditions are the variable values in vars
+     *
+     *  Gradients are found with an AdjointEvaluator, which scales better
+     *  with the number of variables; the JacobianEvaluator overload is
+     *  kept for existing callers.
      */
     std::pair<float, Solution> findRoot(
             const Tree& t, const std::map<Tree::Id, float>& vars,
@@ -40,6 +47,44 @@ namespace Solver
             std::map<Tree::Id, float> vars,
             const Eigen::Vector3f pos={0,0,0}, const Mask& mask=Mask(),
             unsigned gas=25000);
+    std::pair<float, Solution> findRoot(
+            AdjointEvaluator& e, std::shared_ptr<Tape> tape,
+            std::map<Tree::Id, float> vars,
+            const Eigen::Vector3f pos={0,0,0}, const Mask& mask=Mask(),
+            unsigned gas=25000);
+
+    /*
+     *  Finds a set of variables that drive t to zero at every point in
+     *  pts, in the least-squares sense (i.e. minimizing the sum of t^2
+     *  over all points), using Levenberg-Marquardt steps.  The damping
+     *  shrinks as steps succeed, so this approaches Gauss-Newton near
+     *  the solution.
+     *
+     *  Residuals and Jacobians are evaluated in batches of up to
+     *  AdjointArrayEvaluator::N points.  Only variables in vars (and not
+     *  in mask) are solved for; gas is the number of steps attempted.
+     *
+     *  Returns the final sum of squared residuals and the solution.
+     */
+    std::pair<float, Solution> findRoots(
+            const Tree& t, const std::map<Tree::Id, float>& vars,
+            const std::vector<Eigen::Vector3f>& pts,
+            const Mask& mask=Mask(), unsigned gas=100);
+    std::pair<float, Solution> findRoots(
+            AdjointArrayEvaluator& e, std::shared_ptr<Tape> tape,
+            const std::map<Tree::Id, float>& vars,
+            const std::vector<Eigen::Vector3f>& pts,
+            const Mask& mask=Mask(), unsigned gas=100);
+
+    /*
+     *  Runs findRoots from each set of initial conditions in starts
+     *  (sharing a single evaluator), returning the best result.
+     *  This is useful for escaping local minima.
+     */
+    std::pair<float, Solution> findRootsMultiStart(
+            const Tree& t, const std::vector<Solution>& starts,
+            const std::vector<Eigen::Vector3f>& pts,
+            const Mask& mask=Mask(), unsigned gas=100);
 
 }   // namespace Solver
 }   // namespace Kernel
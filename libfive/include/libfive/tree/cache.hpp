@@ -9,9 +9,13 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 */
 #pragma once
 
+#include <array>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
 
 #include "libfive/export.hpp"
 #include "libfive/tree/tree.hpp"
@@ -20,25 +24,26 @@ namespace Kernel {
 
 /*
  *  A Cache stores values in a deduplicated math expression
+ *
+ *  The Cache is safe to use from multiple threads:  its tables are split
+ *  into independently-locked shards (selected by hashing the key), so
+ *  that unrelated trees can be built and destroyed concurrently.
  */
 class Cache
 {
     /*  Helper typedef to avoid writing this over and over again  */
     typedef std::shared_ptr<Tree::Tree_> Node;
 
-    /*  Handle to safely access cache  */
+    /*  Handle to access the cache (which does its own locking)  */
     class Handle
     {
     public:
-        Handle() : lock(mut) {}
         Cache* operator->() const { return &_instance; }
-    protected:
-        std::unique_lock<std::recursive_mutex> lock;
     };
 
 public:
     /*
-     *  Returns a safe (locking) handle to the global Cache
+     *  Returns a handle to the global Cache
      */
     static Handle instance() { return Handle(); }
 
@@ -52,12 +57,38 @@ public:
 
     Node var();
 
+    /*
+     *  A Key uniquely identifies an operation Node, so that we can
+     *  deduplicate based on opcode  and arguments
+     */
+    typedef std::tuple<Opcode::Opcode,  /* opcode */
+                       Tree::Id,        /* lhs */
+                       Tree::Id         /* rhs */ > Key;
+
     /*
      *  Called when the last Tree_ is destroyed
+     *
+     *  By the time this is called, another thread may have already
+     *  replaced the expired entry with a new Tree_, so the entry is
+     *  only erased if it is still expired.
      */
     void del(float v);
     void del(Opcode::Opcode op, Node lhs=nullptr, Node rhs=nullptr);
 
+    /*
+     *  Batched version of del, called when a whole subgraph of Tree_
+     *  objects is destroyed at once.  Entries are grouped by shard, so
+     *  each shard's lock is only taken once per batch.
+     */
+    void del(const std::vector<float>& vs, const std::vector<Key>& ks);
+
+    /*
+     *  Returns the number of constants and operations in the cache
+     *  (including expired entries that haven't been removed yet).
+     *  This locks every shard, so it's mainly useful for unit testing.
+     */
+    size_t size();
+
     /*
      *  Returns the given node as an affine sum-of-multiplications
      *
@@ -96,26 +127,47 @@ protected:
      */
     Node checkAffine(Opcode::Opcode op, Node a, Node b);
 
+    /*  Hashes a Key by combining its fields  */
+    struct KeyHash
+    {
+        size_t operator()(const Key& k) const;
+    };
+
     /*
-     *  A Key uniquely identifies an operation Node, so that we can
-     *  deduplicate based on opcode  and arguments
+     *  A Shard is one independently-locked slice of a table
      */
-    typedef std::tuple<Opcode::Opcode,  /* opcode */
-                       Tree::Id,        /* lhs */
-                       Tree::Id         /* rhs */ > Key;
-    std::map<Key, std::weak_ptr<Tree::Tree_>> ops;
+    template <typename K, typename H>
+    struct Shard
+    {
+        std::mutex mut;
+        std::unordered_map<K, std::weak_ptr<Tree::Tree_>, H> map;
+    };
+
+    /*  Each table is split into (1 << SHARD_BITS) shards  */
+    static const unsigned SHARD_BITS = 6;
+
+    /*  Picks a shard based on the high bits of a scrambled hash  */
+    template <typename T>
+    static T& shard(std::array<T, 1 << SHARD_BITS>& shards, size_t hash);
+
+    /*  Erases expired entries for the given keys, grouped by shard  */
+    template <typename K, typename H>
+    static void erase(std::array<Shard<K, H>, 1 << SHARD_BITS>& shards,
+                      const std::vector<K>& keys);
+
+    std::array<Shard<Key, KeyHash>, 1 << SHARD_BITS> ops;
 
     /*  Constants in the tree are uniquely identified by their value  */
-    std::map<float, std::weak_ptr<Tree::Tree_>> constants;
+    std::array<Shard<float, std::hash<float>>, 1 << SHARD_BITS> constants;
 
     /*  nan cannot be stored in the usual map, so the nan constant lives here */
     std::weak_ptr<Tree::Tree_> nan_constant;
+    std::mutex nan_mut;
 
     /*  Oracles do not need to use the cache to be deduplicated, since they
      *  are created from unique_ptr's, and therefore are already impossible
      *  to duplicate.  */
 
-    static FIVE_EXPORT std::recursive_mutex mut;
     static FIVE_EXPORT Cache _instance;
 };
 
@@ -70,11 +70,6 @@ public:
      */
     static Tree var();
 
-    /*
-     *  Destructor to ensure thread-safety while manipulating the Cache
-     */
-    ~Tree();
-
     /*  Bitfield enum for node flags */
     enum Flags {
         /*  Does this Id only contain constants and variables
@@ -161,10 +156,32 @@ public:
     Tree makeVarsConstant() const;
 
     /*
-     *  Walks the tree in rank order, from lowest to highest
-     *  The last item in the list will be the tree this is called on
+     *  Returns an equivalent tree which is cheaper to evaluate:
+     *  -   Arguments to commutative operations are put in a canonical
+     *      order, so that (for example) min(a, b) and min(b, a) become
+     *      a single node.
+     *  -   pow(x, 2) and x * x become square(x), and pow(x, 1) becomes x
+     *  -   Division by a constant becomes multiplication by its reciprocal
+     *      (which may change the result in the last bit).
+     *  -   Chains of min or max are rebuilt as balanced trees, so that
+     *      interval pruning can discard half of a chain at each level.
+     *
+     *  Subtrees which are no longer used after rewriting are dropped.
+     *  Oracles are left untouched.
+     */
+    Tree optimized() const;
+
+    /*
+     *  Flattens the tree into a contiguous array in rank order, from
+     *  lowest to highest, so that every node comes after its arguments.
+     *  The last item in the array will be the tree this is called on.
+     *
+     *  Each item points to a shared_ptr within this tree (either this
+     *  tree's own pointer or another node's lhs / rhs), so building the
+     *  array doesn't touch any reference counts.  Items are only valid
+     *  while this tree is alive.
      */
-    std::list<Tree> ordered() const;
+    std::vector<const std::shared_ptr<Tree_>*> flat() const;
 
     void serialize(std::ostream& out) const;
     static Tree deserialize(std::istream& in);
@@ -7,6 +7,8 @@ This Source Code Form is subject to the terms of the Mozilla Public
 License, v. 2.0. If a copy of the MPL was not distributed with this file,
 You can obtain one at http://mozilla.org/MPL/2.0/.
 */
+#include <algorithm>
+#include <iterator>
 #include <unordered_map>
 
 #include "libfive/eval/deck.hpp"
@@ -14,9 +16,14 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 
 namespace Kernel {
 
-Deck::Deck(const Tree root)
+Deck::Deck(const Tree root_, bool optimize)
+    : shared(new Shared), constants(shared->constants), vars(shared->vars),
+      deps(shared->deps), cache(shared->cache), saved(0)
 {
-    auto flat = root.ordered();
+    // This must stay alive until the end of the constructor, since the
+    // flattened array points into it.
+    const Tree root = optimize ? root_.optimized() : root_;
+    auto flat = root.flat();
 
     // Helper function to create a new clause in the data array
     // The dummy clause (0) is mapped to the first result slot
@@ -35,22 +42,26 @@ Deck::Deck(const Tree root)
     };
 
     // Write the flattened tree into the tape!
-    for (const auto& m : flat)
+    num_ops = 0;
+    for (auto p : flat)
     {
+        const auto& m = *p;
+
         // Normal clauses end up in the tape
         if (m->rank > 0)
         {
-            newClause(m.id());
+            newClause(m.get());
+            num_ops++;
         }
         // For constants and variables, record their values so
         // that we can store those values in the result array
         else if (m->op == Opcode::CONSTANT)
         {
-            constants[id] = m->value;
+            shared->constants[id] = m->value;
         }
         else if (m->op == Opcode::VAR_FREE)
         {
-            vars.left.insert({id, m.id()});
+            shared->vars.left.insert({id, m.get()});
         }
         // For oracles, store their position in the oracles vector
         // as the LHS of the clause, so that we can find them during
@@ -61,6 +72,7 @@ Deck::Deck(const Tree root)
             tape_.push_front({Opcode::ORACLE, id,
                     static_cast<unsigned int>(oracles.size()), 0});
             oracles.push_back(m->oracle->getOracle());
+            shared->oracles.push_back(m);
         }
         else
         {
@@ -68,10 +80,21 @@ Deck::Deck(const Tree root)
                    m->op == Opcode::VAR_Y ||
                    m->op == Opcode::VAR_Z);
         }
-        clauses[m.id()] = id--;
+        clauses[m.get()] = id--;
     }
     assert(id == 0);
 
+    // Compare against the number of operations in the original tree
+    if (optimize)
+    {
+        size_t before = 0;
+        for (auto p : root_.flat())
+        {
+            before += ((*p)->rank > 0);
+        }
+        saved = (before > num_ops) ? (before - num_ops) : 0;
+    }
+
     //  Move from the list tape to a more-compact vector tape
     tape.reset(new Tape);
     tape->type = Tape::BASE;
@@ -96,8 +119,7 @@ Deck::Deck(const Tree root)
     num_clauses = clauses.size() - 1;
 
     // Allocate enough memory for all the clauses
-    disabled.resize(clauses.size());
-    remap.resize(clauses.size());
+    resizeScratch();
 
     // Save X, Y, Z ids
     X = clauses.at(axes[0].id());
@@ -110,6 +132,208 @@ Deck::Deck(const Tree root)
     // Store the index of the tree's root
     assert(clauses.at(root.id()) == 1);
     tape->i = clauses.at(root.id());
+
+    // Assign result slots for array evaluation
+    allocate(*tape);
+
+    // Find the variables that each clause depends on.  Clauses are visited
+    // in evaluation order (by descending id, starting with the leaves), so
+    // each list is packed directly after the previous one, and the lists
+    // for an operation's arguments are finished before the operation.
+    std::vector<Clause::Id> var_ids;
+    for (auto& v : shared->vars.left)
+    {
+        var_ids.push_back(v.first);
+    }
+    auto& deps_end = shared->deps_end;
+    deps_end.assign(num_clauses + 2, 0);
+    {
+        auto& deps = shared->deps;
+        auto v = var_ids.size();
+        for (Clause::Id c=num_clauses; c > num_ops; --c)
+        {
+            if (v && var_ids[v - 1] == c)
+            {
+                deps.push_back(--v);
+            }
+            deps_end[c] = deps.size();
+        }
+
+        std::vector<uint32_t> row;
+        for (auto itr = tape->t.rbegin(); itr != tape->t.rend(); ++itr)
+        {
+            // Oracles are leaves, which don't depend on any variables
+            if (itr->op == Opcode::ORACLE)
+            {
+                continue;
+            }
+            assert(itr->id <= num_ops);
+            row.clear();
+            std::set_union(deps.begin() + depsBegin(itr->a),
+                           deps.begin() + depsEnd(itr->a),
+                           deps.begin() + depsBegin(itr->b),
+                           deps.begin() + depsEnd(itr->b),
+                           std::back_inserter(row));
+            deps.insert(deps.end(), row.begin(), row.end());
+            deps_end[itr->id] = deps.size();
+        }
+        deps_end[0] = deps_end[1];
+    }
+}
+
+const std::vector<uint32_t>& Deck::downstream(Clause::Id var) const
+{
+    // Transposing the dependency lists gives the clauses downstream of
+    // each variable, which are also recorded in evaluation order.
+    std::call_once(shared->downstream_once, [this]() {
+        std::vector<std::vector<uint32_t>*> down;
+        for (auto& v : shared->vars.left)
+        {
+            down.push_back(&shared->downstream[v.first]);
+        }
+        for (uint32_t i=tape->t.size(); i-- > 0;)
+        {
+            const auto& c = tape->t[i];
+            if (c.op != Opcode::ORACLE)
+            {
+                for (auto k=depsBegin(c.id); k < depsEnd(c.id); ++k)
+                {
+                    down[deps[k]]->push_back(i);
+                }
+            }
+        }
+    });
+    return shared->downstream.at(var);
+}
+
+Deck::Deck(const Deck* other)
+    : shared(other->shared), X(other->X), Y(other->Y), Z(other->Z),
+      constants(shared->constants), vars(shared->vars),
+      deps(shared->deps), cache(shared->cache),
+      num_clauses(other->num_clauses),
+      saved(other->saved), tape(other->tape),
+      num_ops(other->num_ops)
+{
+    // Oracles carry per-thread state, so each Deck needs its own
+    for (const auto& o : shared->oracles)
+    {
+        oracles.push_back(o->oracle->getOracle());
+    }
+    resizeScratch();
+}
+
+std::shared_ptr<Deck> Deck::fork() const
+{
+    return std::shared_ptr<Deck>(new Deck(this));
+}
+
+void Deck::claim(std::shared_ptr<Tape> tape)
+{
+    if (!tape->cached)
+    {
+        spares.push_back(tape);
+    }
+}
+
+void Deck::resizeScratch()
+{
+    // Tape::push expects these arrays to start out (and be left)
+    // fully disabled and unmapped.
+    disabled.resize(num_clauses + 1, true);
+    remap.resize(num_clauses + 1, 0);
+    seen.resize(num_clauses + 1);
+    slots.resize(num_clauses + 1);
+}
+
+void Deck::allocate(Tape& tape)
+{
+    auto isOp = [this](Clause::Id c) { return c != 0 && c <= num_ops; };
+    auto slotOf = [&](Clause::Id c) {
+        return (c == 0) ? 0 : (isOp(c) ? slots[c] : slot(c));
+    };
+
+    // Walk the tape from the root down.  The first time that we see a
+    // clause used as an argument is its last use in evaluation order,
+    // so we record that its slot can be released after that point.
+    dies.resize(tape.t.size());
+    for (unsigned k=0; k < tape.t.size(); ++k)
+    {
+        const auto& c = tape.t[k];
+        uint8_t d = 0;
+
+        // Oracles use c.a as an index into the oracles array,
+        // so it isn't a clause that we need to track.
+        if (c.op != Opcode::ORACLE)
+        {
+            if (isOp(c.a) && !seen[c.a])
+            {
+                seen[c.a] = true;
+                d |= 1;
+            }
+            if (isOp(c.b) && !seen[c.b])
+            {
+                seen[c.b] = true;
+                d |= 2;
+            }
+        }
+        dies[k] = d;
+    }
+
+    // Then walk in evaluation order, assigning slots.  The output slot is
+    // claimed before the arguments' slots are released, so a clause never
+    // writes into one of its own inputs.
+    tape.s.clear();
+    tape.s.reserve(tape.t.size());
+    free_slots.clear();
+    Clause::Id next = num_clauses - num_ops + 1;
+    for (unsigned k=tape.t.size(); k-- > 0;)
+    {
+        const auto& c = tape.t[k];
+
+        Clause::Id out;
+        if (!isOp(c.id))
+        {
+            out = slot(c.id);
+        }
+        else if (free_slots.size())
+        {
+            out = free_slots.back();
+            free_slots.pop_back();
+        }
+        else
+        {
+            out = next++;
+        }
+
+        if (c.op == Opcode::ORACLE)
+        {
+            tape.s.push_back({c.op, out, c.a, c.b});
+        }
+        else
+        {
+            tape.s.push_back({c.op, out, slotOf(c.a), slotOf(c.b)});
+        }
+
+        if (dies[k] & 1)
+        {
+            free_slots.push_back(slots[c.a]);
+        }
+        if (dies[k] & 2)
+        {
+            free_slots.push_back(slots[c.b]);
+        }
+
+        // Store this clause's slot for later use (and reset its mark,
+        // which was set by whichever clause uses it as an argument)
+        if (isOp(c.id))
+        {
+            slots[c.id] = out;
+            seen[c.id] = false;
+        }
+    }
+
+    tape.s_i = slotOf(tape.i);
+    tape.num_slots = next;
 }
 
 void Deck::setOracleCount(Eigen::Index count)
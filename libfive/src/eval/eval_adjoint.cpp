@@ -0,0 +1,201 @@
+/*
+libfive: a CAD kernel for modeling with implicit functions
+
+Copyright (C) 2019  Matt Keeter
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+#include "libfive/eval/eval_adjoint.hpp"
+#include "libfive/eval/deck.hpp"
+#include "libfive/eval/tape.hpp"
+
+namespace Kernel {
+
+AdjointEvaluator::AdjointEvaluator(const Tree& root)
+    : AdjointEvaluator(std::make_shared<Deck>(root))
+{
+    // Nothing to do here
+}
+
+AdjointEvaluator::AdjointEvaluator(
+        const Tree& root, const std::map<Tree::Id, float>& vars)
+    : AdjointEvaluator(std::make_shared<Deck>(root), vars)
+{
+    // Nothing to do here
+}
+
+AdjointEvaluator::AdjointEvaluator(std::shared_ptr<Deck> d)
+    : AdjointEvaluator(d, std::map<Tree::Id, float>())
+{
+    // Nothing to do here
+}
+
+AdjointEvaluator::AdjointEvaluator(
+        std::shared_ptr<Deck> d, const std::map<Tree::Id, float>& vars)
+    : DerivEvaluator(d, vars), adj(deck->num_clauses + 1)
+{
+    // Nothing to do here
+}
+
+std::map<Tree::Id, float> AdjointEvaluator::gradient(
+        const Eigen::Vector3f& p)
+{
+    return gradient(p, deck->tape);
+}
+
+std::map<Tree::Id, float> AdjointEvaluator::gradient(
+        const Eigen::Vector3f& p,
+        std::shared_ptr<Tape> tape)
+{
+    // Perform value evaluation, to make sure the f array is correct
+    eval(p, tape);
+
+    // Seed the root, then sweep from the root down to the leaves,
+    // pushing each clause's adjoint into its arguments.
+    adj.setZero();
+    adj(tape->root()) = 1;
+    tape->walk(*this);
+
+    // Unpack from flat array into map
+    // (to allow correlating back to VARs in Tree)
+    std::map<Tree::Id, float> out;
+    for (auto v : deck->vars.left)
+    {
+        out[v.second] = adj(v.first);
+    }
+    return out;
+}
+
+void AdjointEvaluator::operator()(Opcode::Opcode op, Clause::Id id,
+                                  Clause::Id a, Clause::Id b)
+{
+    const double g = adj(id);
+
+    // Clauses that don't affect the root contribute nothing; skipping
+    // them also avoids producing NaNs from 0 * inf in unused branches.
+    if (g == 0)
+    {
+        return;
+    }
+
+#define av f(a)
+#define aa adj(a)
+
+#define bv f(b)
+#define ba adj(b)
+
+        switch (op) {
+            case Opcode::OP_ADD:
+                aa += g;
+                ba += g;
+                break;
+            case Opcode::OP_MUL:
+                aa += g * bv;
+                ba += g * av;
+                break;
+            case Opcode::OP_MIN:
+                if (av < bv)    aa += g;
+                else            ba += g;
+                break;
+            case Opcode::OP_MAX:
+                if (av < bv)    ba += g;
+                else            aa += g;
+                break;
+            case Opcode::OP_SUB:
+                aa += g;
+                ba -= g;
+                break;
+            case Opcode::OP_DIV:
+                aa += g / bv;
+                ba -= g * av / pow(bv, 2);
+                break;
+            case Opcode::OP_ATAN2:
+            {
+                const float d = pow(av, 2) + pow(bv, 2);
+                aa += g * bv / d;
+                ba -= g * av / d;
+                break;
+            }
+            case Opcode::OP_POW:
+                // As in the JacobianEvaluator, we skip the
+                // av * log(av) * bj term, since b must be constant.
+                aa += g * bv * pow(av, bv - 1);
+                break;
+            case Opcode::OP_NTH_ROOT:
+                aa += g * pow(av, 1.0f/bv - 1) / bv;
+                break;
+            case Opcode::OP_MOD:
+                // This isn't quite how partial derivatives of mod work,
+                // but close enough normals rendering.
+                aa += g;
+                break;
+            case Opcode::OP_NANFILL:
+                if (std::isnan(av)) ba += g;
+                else                aa += g;
+                break;
+            case Opcode::OP_COMPARE:
+                break;
+
+            case Opcode::OP_SQUARE:
+                aa += g * 2 * av;
+                break;
+            case Opcode::OP_SQRT:
+                if (av >= 0) aa += g / (2 * sqrt(av));
+                break;
+            case Opcode::OP_NEG:
+                aa -= g;
+                break;
+            case Opcode::OP_SIN:
+                aa += g * cos(av);
+                break;
+            case Opcode::OP_COS:
+                aa -= g * sin(av);
+                break;
+            case Opcode::OP_TAN:
+                aa += g * pow(1/cos(av), 2);
+                break;
+            case Opcode::OP_ASIN:
+                aa += g / sqrt(1 - pow(av, 2));
+                break;
+            case Opcode::OP_ACOS:
+                aa -= g / sqrt(1 - pow(av, 2));
+                break;
+            case Opcode::OP_ATAN:
+                aa += g / (pow(av, 2) + 1);
+                break;
+            case Opcode::OP_LOG:
+                aa += g / av;
+                break;
+            case Opcode::OP_EXP:
+                aa += g * exp(av);
+                break;
+            case Opcode::OP_ABS:
+                aa += (av > 0 ? g : -g);
+                break;
+            case Opcode::OP_RECIP:
+                aa -= g / pow(av, 2);
+                break;
+
+            // Constant variables and oracles block the gradient
+            case Opcode::CONST_VAR:
+            case Opcode::ORACLE:
+                break;
+
+            case Opcode::INVALID:
+            case Opcode::CONSTANT:
+            case Opcode::VAR_X:
+            case Opcode::VAR_Y:
+            case Opcode::VAR_Z:
+            case Opcode::VAR_FREE:
+            case Opcode::LAST_OP: assert(false);
+        }
+#undef av
+#undef aa
+
+#undef bv
+#undef ba
+}
+
+}   // namespace Kernel
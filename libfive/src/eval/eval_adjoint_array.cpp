@@ -0,0 +1,240 @@
+/*
+libfive: a CAD kernel for modeling with implicit functions
+
+Copyright (C) 2019  Matt Keeter
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+#include "libfive/eval/eval_adjoint_array.hpp"
+#include "libfive/eval/deck.hpp"
+#include "libfive/eval/tape.hpp"
+
+namespace Kernel {
+
+AdjointArrayEvaluator::AdjointArrayEvaluator(const Tree& root)
+    : AdjointArrayEvaluator(std::make_shared<Deck>(root))
+{
+    // Nothing to do here
+}
+
+AdjointArrayEvaluator::AdjointArrayEvaluator(
+        const Tree& root, const std::map<Tree::Id, float>& vars)
+    : AdjointArrayEvaluator(std::make_shared<Deck>(root), vars)
+{
+    // Nothing to do here
+}
+
+AdjointArrayEvaluator::AdjointArrayEvaluator(std::shared_ptr<Deck> d)
+    : AdjointArrayEvaluator(d, std::map<Tree::Id, float>())
+{
+    // Nothing to do here
+}
+
+AdjointArrayEvaluator::AdjointArrayEvaluator(
+        std::shared_ptr<Deck> d, const std::map<Tree::Id, float>& vars)
+    : ArrayEvaluator(d, vars)
+{
+    // The parent constructor unpacked leaves by slot, so re-size the
+    // result array to have one row per clause and unpack them again.
+    f.resize(deck->num_clauses + 1, Eigen::NoChange);
+    adj.resize(deck->num_clauses + 1, Eigen::NoChange);
+
+    for (auto& v : deck->vars.left)
+    {
+        auto var = vars.find(v.second);
+        f.row(v.first) = (var != vars.end()) ? var->second : 0;
+        var_ids.push_back(v.second);
+        var_clauses.push_back(v.first);
+    }
+    grad.resize(var_ids.size(), Eigen::NoChange);
+
+    for (auto& c : deck->constants)
+    {
+        f.row(c.first) = c.second;
+    }
+}
+
+Eigen::Block<decltype(AdjointArrayEvaluator::f), 1, Eigen::Dynamic>
+AdjointArrayEvaluator::values(size_t _count)
+{
+    return values(_count, deck->tape);
+}
+
+Eigen::Block<decltype(AdjointArrayEvaluator::f), 1, Eigen::Dynamic>
+AdjointArrayEvaluator::values(size_t count, Tape::Handle tape)
+{
+    setCount(count);
+    equal = false;
+
+    deck->bindOracles(tape);
+    deck->setOracleCount(count);
+    auto index = tape->rwalk(static_cast<ArrayEvaluator&>(*this));
+    deck->unbindOracles();
+
+    return f.block<1, Eigen::Dynamic>(index, 0, 1, count);
+}
+
+Eigen::Block<decltype(AdjointArrayEvaluator::f)>
+AdjointArrayEvaluator::gradients(size_t _count)
+{
+    return gradients(_count, deck->tape);
+}
+
+Eigen::Block<decltype(AdjointArrayEvaluator::f)>
+AdjointArrayEvaluator::gradients(size_t count, Tape::Handle tape)
+{
+    // Seed the root, then sweep from the root down to the leaves
+    adj.setZero();
+    adj.row(tape->root()).head(this->count) = 1;
+    tape->walk(*this);
+
+    for (unsigned i=0; i < var_clauses.size(); ++i)
+    {
+        grad.row(i) = adj.row(var_clauses[i]);
+    }
+    return grad.block(0, 0, grad.rows(), count);
+}
+
+bool AdjointArrayEvaluator::setVar(Tree::Id var, float value)
+{
+    auto v = deck->vars.right.find(var);
+    if (v != deck->vars.right.end())
+    {
+        bool changed = f(v->second, 0) != value;
+        f.row(v->second) = value;
+        return changed;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+void AdjointArrayEvaluator::operator()(Opcode::Opcode op, Clause::Id id,
+                                       Clause::Id a_, Clause::Id b_)
+{
+    const auto g = adj.row(id).head(count);
+
+    // Clauses that don't affect the root contribute nothing
+    if ((g == 0).all())
+    {
+        return;
+    }
+
+#define av f.row(a_).head(count)
+#define bv f.row(b_).head(count)
+
+    // Points where this clause doesn't affect the root are masked out,
+    // to avoid producing NaNs from 0 * inf in unused branches.
+#define aa(e) adj.row(a_).head(count) += (g == 0).select(0.0f, (e))
+#define ba(e) adj.row(b_).head(count) += (g == 0).select(0.0f, (e))
+
+    switch (op) {
+        case Opcode::OP_ADD:
+            aa(g);
+            ba(g);
+            break;
+        case Opcode::OP_MUL:
+            aa(g * bv);
+            ba(g * av);
+            break;
+        case Opcode::OP_MIN:
+            aa((av < bv).select(g, 0.0f));
+            ba((av < bv).select(0.0f, g));
+            break;
+        case Opcode::OP_MAX:
+            aa((av < bv).select(0.0f, g));
+            ba((av < bv).select(g, 0.0f));
+            break;
+        case Opcode::OP_SUB:
+            aa(g);
+            ba(-g);
+            break;
+        case Opcode::OP_DIV:
+            aa(g / bv);
+            ba(-g * av / bv.square());
+            break;
+        case Opcode::OP_ATAN2:
+            aa(g * bv / (av.square() + bv.square()));
+            ba(-g * av / (av.square() + bv.square()));
+            break;
+        case Opcode::OP_POW:
+            // As in the AdjointEvaluator, we skip the b term,
+            // since b must be constant.
+            aa(g * bv * av.pow(bv - 1));
+            break;
+        case Opcode::OP_NTH_ROOT:
+            aa(g * av.pow(1.0f / bv - 1) / bv);
+            break;
+        case Opcode::OP_MOD:
+            aa(g);
+            break;
+        case Opcode::OP_NANFILL:
+            aa(av.isNaN().select(0.0f, g));
+            ba(av.isNaN().select(g, 0.0f));
+            break;
+        case Opcode::OP_COMPARE:
+            break;
+
+        case Opcode::OP_SQUARE:
+            aa(g * 2 * av);
+            break;
+        case Opcode::OP_SQRT:
+            aa((av >= 0).select(g / (2 * av.sqrt()), 0.0f));
+            break;
+        case Opcode::OP_NEG:
+            aa(-g);
+            break;
+        case Opcode::OP_SIN:
+            aa(g * av.cos());
+            break;
+        case Opcode::OP_COS:
+            aa(-g * av.sin());
+            break;
+        case Opcode::OP_TAN:
+            aa(g / av.cos().square());
+            break;
+        case Opcode::OP_ASIN:
+            aa(g / (1 - av.square()).sqrt());
+            break;
+        case Opcode::OP_ACOS:
+            aa(-g / (1 - av.square()).sqrt());
+            break;
+        case Opcode::OP_ATAN:
+            aa(g / (av.square() + 1));
+            break;
+        case Opcode::OP_LOG:
+            aa(g / av);
+            break;
+        case Opcode::OP_EXP:
+            aa(g * av.exp());
+            break;
+        case Opcode::OP_ABS:
+            aa((av > 0).select(g, -g));
+            break;
+        case Opcode::OP_RECIP:
+            aa(-g / av.square());
+            break;
+
+        // Constant variables and oracles block the gradient
+        case Opcode::CONST_VAR:
+        case Opcode::ORACLE:
+            break;
+
+        case Opcode::INVALID:
+        case Opcode::CONSTANT:
+        case Opcode::VAR_X:
+        case Opcode::VAR_Y:
+        case Opcode::VAR_Z:
+        case Opcode::VAR_FREE:
+        case Opcode::LAST_OP: assert(false);
+    }
+#undef av
+#undef bv
+#undef aa
+#undef ba
+}
+
+}   // namespace Kernel
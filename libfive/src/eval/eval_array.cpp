@@ -7,14 +7,189 @@ This Source Code Form is subject to the terms of the Mozilla Public
 License, v. 2.0. If a copy of the MPL was not distributed with this file,
 You can obtain one at http://mozilla.org/MPL/2.0/.
 */
+#include <algorithm>
+#include <functional>
+
 #include "libfive/eval/eval_array.hpp"
 #include "libfive/eval/tape.hpp"
 #include "libfive/eval/deck.hpp"
 
+// Evaluation counts are rounded up to a multiple of the SIMD width (see
+// ArrayEvaluator::setCount), which the kernels below rely on.
+#if defined EIGEN_VECTORIZE_AVX512
+#define LIBFIVE_SIMD_SIZE 16
+#elif defined EIGEN_VECTORIZE_AVX
+#define LIBFIVE_SIMD_SIZE 8
+#elif defined EIGEN_VECTORIZE_SSE
+#define LIBFIVE_SIMD_SIZE 4
+#elif defined EIGEN_VECTORIZE
+#warning "EIGEN_VECTORIZE is set but no vectorization flag is found"
+#define LIBFIVE_SIMD_SIZE 0
+#else
+#warning "No SIMD flags detected"
+#define LIBFIVE_SIMD_SIZE 0
+#endif
+
 namespace Kernel {
 
 constexpr size_t ArrayEvaluator::N;
 
+namespace {
+
+using Row = Eigen::Map<Eigen::Array<float, 1, Eigen::Dynamic>>;
+using ConstRow = Eigen::Map<const Eigen::Array<float, 1, Eigen::Dynamic>>;
+
+/*  Packets are the SIMD width, or single values without SIMD  */
+constexpr size_t W = LIBFIVE_SIMD_SIZE ? LIBFIVE_SIMD_SIZE : 1;
+using Packet = Eigen::Map<Eigen::Array<float, 1, W>>;
+using ConstPacket = Eigen::Map<const Eigen::Array<float, 1, W>>;
+using EqualPacket = Eigen::Map<Eigen::Array<bool, 1, W>>;
+
+/*
+ *  Each kernel evaluates a single opcode over count values, reading and
+ *  writing raw rows of the result array.  Kernels are specialized by
+ *  opcode, so the only per-clause dispatch is a lookup in the table below.
+ */
+typedef void (*ArrayKernel)(float* out, const float* a, const float* b,
+                            bool* equal, size_t count);
+
+template <Opcode::Opcode op>
+void kernel(float* out_, const float* a_, const float* b_,
+            bool* equal_, size_t count);
+
+// Simple kernels work on fixed-size packets, so that Eigen can emit
+// straight-line SIMD code rather than handling arbitrary lengths
+#define PACKET_KERNEL(OP, EXPR)                                     \
+template <> void kernel<Opcode::OP>(float* out_, const float* a_,   \
+                                    const float* b_, bool* equal_,  \
+                                    size_t count)                   \
+{                                                                   \
+    for (size_t i=0; i < count; i += W)                             \
+    {                                                               \
+        Packet out(out_ + i);                                       \
+        ConstPacket a(a_ + i);                                      \
+        ConstPacket b(b_ + i);                                      \
+        EqualPacket equal(equal_ + i);                              \
+        (void)a; (void)b; (void)equal;                              \
+        EXPR;                                                       \
+    }                                                               \
+}
+
+PACKET_KERNEL(OP_ADD,       out = a + b)
+PACKET_KERNEL(OP_MUL,       out = a * b)
+PACKET_KERNEL(OP_SUB,       out = a - b)
+PACKET_KERNEL(OP_DIV,       out = a / b)
+PACKET_KERNEL(OP_POW,       out = a.pow(b))
+PACKET_KERNEL(OP_NANFILL,   out = a.isNaN().select(b, a))
+PACKET_KERNEL(OP_MIN,       out = a.cwiseMin(b); equal = equal || (a == b))
+PACKET_KERNEL(OP_MAX,       out = a.cwiseMax(b); equal = equal || (a == b))
+PACKET_KERNEL(OP_SQUARE,    out = a * a)
+PACKET_KERNEL(OP_SQRT,      out = sqrt(a))
+PACKET_KERNEL(OP_NEG,       out = -a)
+PACKET_KERNEL(OP_SIN,       out = sin(a))
+PACKET_KERNEL(OP_COS,       out = cos(a))
+PACKET_KERNEL(OP_TAN,       out = tan(a))
+PACKET_KERNEL(OP_ASIN,      out = asin(a))
+PACKET_KERNEL(OP_ACOS,      out = acos(a))
+PACKET_KERNEL(OP_ATAN,      out = atan(a))
+PACKET_KERNEL(OP_LOG,       out = log(a))
+PACKET_KERNEL(OP_EXP,       out = exp(a))
+PACKET_KERNEL(OP_ABS,       out = abs(a))
+PACKET_KERNEL(OP_RECIP,     out = 1 / a)
+PACKET_KERNEL(CONST_VAR,    out = a)
+
+#undef PACKET_KERNEL
+
+// Other kernels loop over scalar values in the whole row
+#define KERNEL(OP)                                                  \
+template <> void kernel<Opcode::OP>(float* out_, const float* a_,   \
+                                    const float* b_, bool* equal_,  \
+                                    size_t count)                   \
+{                                                                   \
+    Row out(out_, count);                                           \
+    ConstRow a(a_, count);                                          \
+    ConstRow b(b_, count);                                          \
+    (void)a; (void)b; (void)equal_;
+
+KERNEL(OP_ATAN2)
+    for (unsigned i=0; i < count; ++i)
+    {
+        out(i) = atan2(a(i), b(i));
+    }
+}
+KERNEL(OP_NTH_ROOT)
+    for (unsigned i=0; i < count; ++i)
+    {
+        // Work around a limitation in pow by using boost's nth-root
+        // function on a single-point interval
+        if (a(i) < 0)
+            out(i) = boost::numeric::nth_root(
+                    Interval::I(a(i), a(i)), b(i)).lower();
+        else
+            out(i) = pow(a(i), 1.0f/b(i));
+    }
+}
+KERNEL(OP_MOD)
+    for (unsigned i=0; i < count; ++i)
+    {
+        out(i) = std::fmod(a(i), b(i));
+        while (out(i) < 0)
+        {
+            out(i) += b(i);
+        }
+    }
+}
+KERNEL(OP_COMPARE)
+    for (unsigned i=0; i < count; ++i)
+    {
+        if      (a(i) < b(i))   out(i) = -1;
+        else if (a(i) > b(i))   out(i) =  1;
+        else                    out(i) =  0;
+    }
+}
+
+#undef KERNEL
+
+/*  Kernels indexed by opcode.  Leaves and oracles are left as nullptr,
+ *  since they're never evaluated by a kernel. */
+struct KernelTable
+{
+    KernelTable()
+    {
+        k[Opcode::OP_ADD] = kernel<Opcode::OP_ADD>;
+        k[Opcode::OP_MUL] = kernel<Opcode::OP_MUL>;
+        k[Opcode::OP_SUB] = kernel<Opcode::OP_SUB>;
+        k[Opcode::OP_DIV] = kernel<Opcode::OP_DIV>;
+        k[Opcode::OP_POW] = kernel<Opcode::OP_POW>;
+        k[Opcode::OP_NANFILL] = kernel<Opcode::OP_NANFILL>;
+        k[Opcode::OP_MIN] = kernel<Opcode::OP_MIN>;
+        k[Opcode::OP_MAX] = kernel<Opcode::OP_MAX>;
+        k[Opcode::OP_ATAN2] = kernel<Opcode::OP_ATAN2>;
+        k[Opcode::OP_NTH_ROOT] = kernel<Opcode::OP_NTH_ROOT>;
+        k[Opcode::OP_MOD] = kernel<Opcode::OP_MOD>;
+        k[Opcode::OP_COMPARE] = kernel<Opcode::OP_COMPARE>;
+        k[Opcode::OP_SQUARE] = kernel<Opcode::OP_SQUARE>;
+        k[Opcode::OP_SQRT] = kernel<Opcode::OP_SQRT>;
+        k[Opcode::OP_NEG] = kernel<Opcode::OP_NEG>;
+        k[Opcode::OP_SIN] = kernel<Opcode::OP_SIN>;
+        k[Opcode::OP_COS] = kernel<Opcode::OP_COS>;
+        k[Opcode::OP_TAN] = kernel<Opcode::OP_TAN>;
+        k[Opcode::OP_ASIN] = kernel<Opcode::OP_ASIN>;
+        k[Opcode::OP_ACOS] = kernel<Opcode::OP_ACOS>;
+        k[Opcode::OP_ATAN] = kernel<Opcode::OP_ATAN>;
+        k[Opcode::OP_LOG] = kernel<Opcode::OP_LOG>;
+        k[Opcode::OP_EXP] = kernel<Opcode::OP_EXP>;
+        k[Opcode::OP_ABS] = kernel<Opcode::OP_ABS>;
+        k[Opcode::OP_RECIP] = kernel<Opcode::OP_RECIP>;
+        k[Opcode::CONST_VAR] = kernel<Opcode::CONST_VAR>;
+    }
+    const ArrayKernel& operator[](Opcode::Opcode op) const { return k[op]; }
+    ArrayKernel k[Opcode::LAST_OP] = {};
+};
+const KernelTable kernels;
+
+}   // anonymous namespace
+
 ArrayEvaluator::ArrayEvaluator(const Tree& root)
     : ArrayEvaluator(std::make_shared<Deck>(root))
 {
@@ -36,19 +211,21 @@ ArrayEvaluator::ArrayEvaluator(std::shared_ptr<Deck> d)
 
 ArrayEvaluator::ArrayEvaluator(
         std::shared_ptr<Deck> d, const std::map<Tree::Id, float>& vars)
-    : BaseEvaluator(d, vars), f(deck->num_clauses + 1, N)
+    : BaseEvaluator(d, vars), f(deck->tape->slots(), N)
 {
+    equal = false;
+
     // Unpack variables into result array
     for (auto& v : deck->vars.right)
     {
         auto var = vars.find(v.first);
-        f.row(v.second) = (var != vars.end()) ? var->second : 0;
+        f.row(deck->slot(v.second)) = (var != vars.end()) ? var->second : 0;
     }
 
     // Unpack constants into result array
     for (auto& c : deck->constants)
     {
-        f.row(c.first) = c.second;
+        f.row(deck->slot(c.first)) = c.second;
     }
 }
 
@@ -63,30 +240,85 @@ Eigen::Block<decltype(ArrayEvaluator::f), 1, Eigen::Dynamic>
 ArrayEvaluator::values(size_t count, Tape::Handle tape)
 {
     setCount(count);
+    reserve(tape->slots());
+    equal = false;
+    cached = 0;
 
     deck->bindOracles(tape);
     deck->setOracleCount(count);
-    auto index = tape->rwalk(*this);
+    auto index = tape->rwalkSlots(*this);
     deck->unbindOracles();
 
     return f.block<1, Eigen::Dynamic>(index, 0, 1, count);
 }
 
+Eigen::Block<decltype(ArrayEvaluator::f), 1, Eigen::Dynamic>
+ArrayEvaluator::valuesCached(size_t count)
+{
+    const auto& tape = deck->tape;
+
+    if (cached != count)
+    {
+        // Evaluate the whole tape, giving each clause its own row so
+        // that intermediate results survive until the next call.
+        setCount(count);
+        reserve(deck->num_clauses + 1);
+        equal = false;
+
+        deck->bindOracles(tape);
+        deck->setOracleCount(count);
+        auto fn = [this](Opcode::Opcode op, Clause::Id id,
+                         Clause::Id a, Clause::Id b)
+            {
+                // Oracles use a as an index, not a clause
+                if (op == Opcode::ORACLE)
+                {
+                    (*this)(op, deck->pinned(id), a, b);
+                }
+                else
+                {
+                    (*this)(op, deck->pinned(id),
+                            deck->pinned(a), deck->pinned(b));
+                }
+            };
+        tape->rwalk(fn);
+        deck->unbindOracles();
+        cached = count;
+    }
+    else if (dirty.size())
+    {
+        // Collect the union of the dirty variables' downstream clauses,
+        // then sort them into evaluation order (descending tape position)
+        cone.clear();
+        for (auto d : dirty)
+        {
+            const auto& down = deck->downstream(d);
+            cone.insert(cone.end(), down.begin(), down.end());
+        }
+        if (dirty.size() > 1)
+        {
+            std::sort(cone.begin(), cone.end(), std::greater<uint32_t>());
+            cone.erase(std::unique(cone.begin(), cone.end()), cone.end());
+        }
+
+        // Variables never feed into oracles, so every clause here is an
+        // ordinary operation.  The equal array keeps accumulating, so
+        // that getAmbiguous remains conservative.
+        for (const auto i : cone)
+        {
+            const auto& c = tape->clause(i);
+            (*this)(c.op, deck->pinned(c.id),
+                    deck->pinned(c.a), deck->pinned(c.b));
+        }
+    }
+    dirty.clear();
+
+    return f.block<1, Eigen::Dynamic>(deck->pinned(tape->root()), 0, 1,
+                                      count);
+}
+
 void ArrayEvaluator::setCount(size_t count)
 {
-#if defined EIGEN_VECTORIZE_AVX512
-    #define LIBFIVE_SIMD_SIZE 16
-#elif defined EIGEN_VECTORIZE_AVX
-    #define LIBFIVE_SIMD_SIZE 8
-#elif defined EIGEN_VECTORIZE_SSE
-    #define LIBFIVE_SIMD_SIZE 4
-#elif defined EIGEN_VECTORIZE
-    #warning "EIGEN_VECTORIZE is set but no vectorization flag is found"
-    #define LIBFIVE_SIMD_SIZE 0
-#else
-    #warning "No SIMD flags detected"
-    #define LIBFIVE_SIMD_SIZE 0
-#endif
     // If we have SIMD instructions, then round the evaluation size up
     // to the nearest block, to avoid issues where Eigen's SIMD and
     // non-SIMD paths produce different results.
@@ -101,6 +333,17 @@ void ArrayEvaluator::setCount(size_t count)
     }
 }
 
+void ArrayEvaluator::reserve(size_t slots)
+{
+    // Pushed tapes are allocated independently, so they may occasionally
+    // need more slots than the base tape.  Leaves live in the lowest
+    // slots, so conservativeResize keeps them intact.
+    if (static_cast<size_t>(f.rows()) < slots)
+    {
+        f.conservativeResize(slots, Eigen::NoChange);
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 bool ArrayEvaluator::setVar(Tree::Id var, float value)
@@ -108,8 +351,13 @@ bool ArrayEvaluator::setVar(Tree::Id var, float value)
     auto v = deck->vars.right.find(var);
     if (v != deck->vars.right.end())
     {
-        bool changed = f(v->second, 0) != value;
-        f.row(v->second) = value;
+        const auto slot = deck->slot(v->second);
+        bool changed = f(slot, 0) != value;
+        f.row(slot) = value;
+        if (changed && cached)
+        {
+            dirty.push_back(v->second);
+        }
         return changed;
     }
     else
@@ -129,23 +377,19 @@ ArrayEvaluator::getAmbiguous(size_t i)
 Eigen::Block<decltype(ArrayEvaluator::ambig), 1, Eigen::Dynamic>
 ArrayEvaluator::getAmbiguous(size_t i, Tape::Handle tape)
 {
-    // Reset the ambiguous array to all false
+    // Start with min / max ambiguities recorded during evaluation
     ambig = false;
+    ambig.head(i) = equal.head(i);
 
     bool abort = false;
     tape->walk(
-        [&](Opcode::Opcode op, Clause::Id /* id */, Clause::Id a, Clause::Id b)
+        [&](Opcode::Opcode op, Clause::Id /* id */,
+            Clause::Id a, Clause::Id /* b */)
         {
             if (op == Opcode::ORACLE)
             {
                 deck->oracles[a]->checkAmbiguous(ambig.head(i));
             }
-            else if (op == Opcode::OP_MIN || op == Opcode::OP_MAX)
-            {
-                ambig.head(i) = ambig.head(i) ||
-                    (f.block(a, 0, 1, i) ==
-                     f.block(b, 0, 1, i));
-            }
         }, abort);
 
     return ambig.head(i);
@@ -154,133 +398,18 @@ ArrayEvaluator::getAmbiguous(size_t i, Tape::Handle tape)
 ////////////////////////////////////////////////////////////////////////////////
 
 void ArrayEvaluator::operator()(Opcode::Opcode op, Clause::Id id,
-                                Clause::Id a_, Clause::Id b_)
+                                Clause::Id a, Clause::Id b)
 {
-#define out f.block<1, Eigen::Dynamic>(id, 0, 1, count)
-#define a f.row(a_).head(count)
-#define b f.row(b_).head(count)
-    switch (op)
+    if (op == Opcode::ORACLE)
     {
-        case Opcode::OP_ADD:
-            out = a + b;
-            break;
-        case Opcode::OP_MUL:
-            out = a * b;
-            break;
-        case Opcode::OP_MIN:
-            out = a.cwiseMin(b);
-            break;
-        case Opcode::OP_MAX:
-            out = a.cwiseMax(b);
-            break;
-        case Opcode::OP_SUB:
-            out = a - b;
-            break;
-        case Opcode::OP_DIV:
-            out = a / b;
-            break;
-        case Opcode::OP_ATAN2:
-            for (auto i=0; i < a.size(); ++i)
-            {
-                out(i) = atan2(a(i), b(i));
-            }
-            break;
-        case Opcode::OP_POW:
-            out = a.pow(b);
-            break;
-        case Opcode::OP_NTH_ROOT:
-            for (auto i=0; i < a.size(); ++i)
-            {
-                // Work around a limitation in pow by using boost's nth-root
-                // function on a single-point interval
-                if (a(i) < 0)
-                    out(i) = boost::numeric::nth_root(
-                            Interval::I(a(i), a(i)), b(i)).lower();
-                else
-                    out(i) = pow(a(i), 1.0f/b(i));
-            }
-            break;
-        case Opcode::OP_MOD:
-            for (auto i=0; i < a.size(); ++i)
-            {
-                out(i) = std::fmod(a(i), b(i));
-                while (out(i) < 0)
-                {
-                    out(i) += b(i);
-                }
-            }
-            break;
-        case Opcode::OP_NANFILL:
-            out = a.isNaN().select(b, a);
-            break;
-        case Opcode::OP_COMPARE:
-            for (auto i=0; i < a.size(); ++i)
-            {
-                if      (a(i) < b(i))   out(i) = -1;
-                else if (a(i) > b(i))   out(i) =  1;
-                else                    out(i) =  0;
-            }
-            break;
-
-        case Opcode::OP_SQUARE:
-            out = a * a;
-            break;
-        case Opcode::OP_SQRT:
-            out = sqrt(a);
-            break;
-        case Opcode::OP_NEG:
-            out = -a;
-            break;
-        case Opcode::OP_SIN:
-            out = sin(a);
-            break;
-        case Opcode::OP_COS:
-            out = cos(a);
-            break;
-        case Opcode::OP_TAN:
-            out = tan(a);
-            break;
-        case Opcode::OP_ASIN:
-            out = asin(a);
-            break;
-        case Opcode::OP_ACOS:
-            out = acos(a);
-            break;
-        case Opcode::OP_ATAN:
-            out = atan(a);
-            break;
-        case Opcode::OP_LOG:
-            out = log(a);
-            break;
-        case Opcode::OP_EXP:
-            out = exp(a);
-            break;
-        case Opcode::OP_ABS:
-            out = abs(a);
-            break;
-        case Opcode::OP_RECIP:
-            out = 1 / a;
-            break;
-
-        case Opcode::CONST_VAR:
-            out = a;
-            break;
-
-        case Opcode::ORACLE:
-            deck->oracles[a_]->evalArray(out);
-            break;
-
-        case Opcode::INVALID:
-        case Opcode::CONSTANT:
-        case Opcode::VAR_X:
-        case Opcode::VAR_Y:
-        case Opcode::VAR_Z:
-        case Opcode::VAR_FREE:
-        case Opcode::LAST_OP: assert(false);
+        deck->oracles[a]->evalArray(
+                f.block<1, Eigen::Dynamic>(id, 0, 1, count));
+    }
+    else
+    {
+        assert(kernels[op] != nullptr);
+        kernels[op](&f(id, 0), &f(a, 0), &f(b, 0), equal.data(), count);
     }
-#undef out
-#undef a
-#undef b
 }
 
 }   // namespace Kernel
@@ -13,6 +13,146 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 
 namespace Kernel {
 
+namespace {
+
+/*  Packets are Eigen's SIMD width for floats (or single values without
+ *  SIMD), which matches the rounding in ArrayEvaluator::setCount  */
+constexpr size_t W = Eigen::internal::packet_traits<float>::size;
+using ConstPacket = Eigen::Map<const Eigen::Array<float, 1, W>>;
+using DerivPacket = Eigen::Map<Eigen::Array<float, 3, W>>;
+using ConstDerivPacket = Eigen::Map<const Eigen::Array<float, 3, W>>;
+using EqualPacket = Eigen::Map<Eigen::Array<bool, 1, W>>;
+
+/*
+ *  Each kernel evaluates the derivatives of a single opcode over count
+ *  points, given raw pointers to the derivative blocks (od, ad, bd) and
+ *  the value rows (ov, av, bv) of the result and its arguments.  Like the
+ *  ArrayEvaluator's kernels, they're specialized by opcode and found
+ *  through a table, rather than switching on the opcode for every clause.
+ */
+typedef void (*DerivKernel)(float* od, const float* ad, const float* bd,
+                            const float* ov, const float* av,
+                            const float* bv, bool* equal, size_t count);
+
+template <Opcode::Opcode op>
+void kernel(float* od_, const float* ad_, const float* bd_,
+            const float* ov_, const float* av_, const float* bv_,
+            bool* equal_, size_t count);
+
+#define PACKET_KERNEL(OP, EXPR)                                         \
+template <> void kernel<Opcode::OP>(float* od_, const float* ad_,       \
+                                    const float* bd_, const float* ov_, \
+                                    const float* av_, const float* bv_, \
+                                    bool* equal_, size_t count)         \
+{                                                                       \
+    assert(count % W == 0);                                             \
+    for (size_t i=0; i < count; i += W)                                 \
+    {                                                                   \
+        DerivPacket od(od_ + 3 * i);                                    \
+        ConstDerivPacket ad(ad_ + 3 * i);                               \
+        ConstDerivPacket bd(bd_ + 3 * i);                               \
+        ConstPacket ov(ov_ + i);                                        \
+        ConstPacket av(av_ + i);                                        \
+        ConstPacket bv(bv_ + i);                                        \
+        EqualPacket equal(equal_ + i);                                  \
+        (void)bd; (void)ov; (void)av; (void)bv; (void)equal;            \
+        EXPR;                                                           \
+    }                                                                   \
+}
+
+PACKET_KERNEL(OP_ADD,       od = ad + bd)
+// Product rule
+PACKET_KERNEL(OP_MUL,       od = bd.rowwise()*av + ad.rowwise()*bv)
+PACKET_KERNEL(OP_MIN,
+    for (unsigned j=0; j < 3; ++j)
+        od.row(j) = (av < bv).select(ad.row(j), bd.row(j));
+    equal = equal || ((av == bv) && (ad != bd).colwise().any()))
+PACKET_KERNEL(OP_MAX,
+    for (unsigned j=0; j < 3; ++j)
+        od.row(j) = (av < bv).select(bd.row(j), ad.row(j));
+    equal = equal || ((av == bv) && (ad != bd).colwise().any()))
+PACKET_KERNEL(OP_SUB,       od = ad - bd)
+PACKET_KERNEL(OP_DIV,
+    od = (ad.rowwise()*bv - bd.rowwise()*av).rowwise() / bv.pow(2))
+PACKET_KERNEL(OP_ATAN2,
+    od = (ad.rowwise()*bv - bd.rowwise()*av).rowwise() /
+         (av.pow(2) + bv.pow(2)))
+// The full form of the derivative is
+// od = m * (bv * ad + av * log(av) * bd))
+// However, log(av) is often NaN and bd is always zero,
+// (since it must be CONST), so we skip that part.
+PACKET_KERNEL(OP_POW,       od = ad.rowwise() * (bv * av.pow(bv - 1)))
+PACKET_KERNEL(OP_NTH_ROOT,
+    for (unsigned j=0; j < W; ++j)
+        od.col(j) = (ad.col(j) == 0)
+            .select(0, ad.col(j) * (pow(av(j), 1.0f / bv(j) - 1) / bv(j))))
+PACKET_KERNEL(OP_MOD,       od = ad)
+PACKET_KERNEL(OP_NANFILL,
+    for (unsigned j=0; j < 3; ++j)
+        od.row(j) = av.isNaN().select(bd.row(j), ad.row(j)))
+PACKET_KERNEL(OP_COMPARE,   od.setZero())
+PACKET_KERNEL(OP_SQUARE,    od = ad.rowwise() * av * 2)
+PACKET_KERNEL(OP_SQRT,
+    for (unsigned j=0; j < 3; ++j)
+        od.row(j) = (av < 0 || ad.row(j) == 0).select(
+            Eigen::Array<float, 1, W>::Zero(), ad.row(j) / (2 * ov)))
+PACKET_KERNEL(OP_NEG,       od = -ad)
+PACKET_KERNEL(OP_SIN,       od = ad.rowwise() * cos(av))
+PACKET_KERNEL(OP_COS,       od = ad.rowwise() * -sin(av))
+PACKET_KERNEL(OP_TAN,       od = ad.rowwise() * pow(1/cos(av), 2))
+PACKET_KERNEL(OP_ASIN,      od = ad.rowwise() / sqrt(1 - pow(av, 2)))
+PACKET_KERNEL(OP_ACOS,      od = ad.rowwise() / -sqrt(1 - pow(av, 2)))
+PACKET_KERNEL(OP_ATAN,      od = ad.rowwise() / (pow(av, 2) + 1))
+PACKET_KERNEL(OP_LOG,       od = ad.rowwise() / av)
+PACKET_KERNEL(OP_EXP,       od = ad.rowwise() * exp(av))
+PACKET_KERNEL(OP_ABS,
+    for (unsigned j=0; j < 3; ++j)
+        od.row(j) = (av > 0).select(ad.row(j), -ad.row(j)))
+PACKET_KERNEL(OP_RECIP,     od = ad.rowwise() / -av.pow(2))
+PACKET_KERNEL(CONST_VAR,    od = ad)
+
+#undef PACKET_KERNEL
+
+/*  Kernels indexed by opcode.  Leaves and oracles are left as nullptr,
+ *  since they're never evaluated by a kernel. */
+struct KernelTable
+{
+    KernelTable()
+    {
+        k[Opcode::OP_ADD] = kernel<Opcode::OP_ADD>;
+        k[Opcode::OP_MUL] = kernel<Opcode::OP_MUL>;
+        k[Opcode::OP_SUB] = kernel<Opcode::OP_SUB>;
+        k[Opcode::OP_DIV] = kernel<Opcode::OP_DIV>;
+        k[Opcode::OP_POW] = kernel<Opcode::OP_POW>;
+        k[Opcode::OP_NANFILL] = kernel<Opcode::OP_NANFILL>;
+        k[Opcode::OP_MIN] = kernel<Opcode::OP_MIN>;
+        k[Opcode::OP_MAX] = kernel<Opcode::OP_MAX>;
+        k[Opcode::OP_ATAN2] = kernel<Opcode::OP_ATAN2>;
+        k[Opcode::OP_NTH_ROOT] = kernel<Opcode::OP_NTH_ROOT>;
+        k[Opcode::OP_MOD] = kernel<Opcode::OP_MOD>;
+        k[Opcode::OP_COMPARE] = kernel<Opcode::OP_COMPARE>;
+        k[Opcode::OP_SQUARE] = kernel<Opcode::OP_SQUARE>;
+        k[Opcode::OP_SQRT] = kernel<Opcode::OP_SQRT>;
+        k[Opcode::OP_NEG] = kernel<Opcode::OP_NEG>;
+        k[Opcode::OP_SIN] = kernel<Opcode::OP_SIN>;
+        k[Opcode::OP_COS] = kernel<Opcode::OP_COS>;
+        k[Opcode::OP_TAN] = kernel<Opcode::OP_TAN>;
+        k[Opcode::OP_ASIN] = kernel<Opcode::OP_ASIN>;
+        k[Opcode::OP_ACOS] = kernel<Opcode::OP_ACOS>;
+        k[Opcode::OP_ATAN] = kernel<Opcode::OP_ATAN>;
+        k[Opcode::OP_LOG] = kernel<Opcode::OP_LOG>;
+        k[Opcode::OP_EXP] = kernel<Opcode::OP_EXP>;
+        k[Opcode::OP_ABS] = kernel<Opcode::OP_ABS>;
+        k[Opcode::OP_RECIP] = kernel<Opcode::OP_RECIP>;
+        k[Opcode::CONST_VAR] = kernel<Opcode::CONST_VAR>;
+    }
+    const DerivKernel& operator[](Opcode::Opcode op) const { return k[op]; }
+    DerivKernel k[Opcode::LAST_OP] = {};
+};
+const KernelTable kernels;
+
+}   // anonymous namespace
+
 DerivArrayEvaluator::DerivArrayEvaluator(const Tree& root)
     : DerivArrayEvaluator(std::make_shared<Deck>(root))
 {
@@ -34,7 +174,7 @@ DerivArrayEvaluator::DerivArrayEvaluator(std::shared_ptr<Deck> d)
 
 DerivArrayEvaluator::DerivArrayEvaluator(
         std::shared_ptr<Deck> deck, const std::map<Tree::Id, float>& vars)
-    : ArrayEvaluator(deck, vars), d(deck->num_clauses + 1, 1)
+    : ArrayEvaluator(deck, vars), d(deck->tape->slots(), 1)
 {
     // Initialize all derivatives to zero
     for (Eigen::Index i=0; i < d.rows(); ++i)
@@ -43,9 +183,11 @@ DerivArrayEvaluator::DerivArrayEvaluator(
     }
 
     // Load immutable derivatives for X, Y, Z
-    d(deck->X).row(0) = 1;
-    d(deck->Y).row(1) = 1;
-    d(deck->Z).row(2) = 1;
+    d(deck->slot(deck->X)).row(0) = 1;
+    d(deck->slot(deck->Y)).row(1) = 1;
+    d(deck->slot(deck->Z)).row(2) = 1;
+
+    equal_derivs = false;
 }
 
 Eigen::Block<decltype(DerivArrayEvaluator::ambig), 1, Eigen::Dynamic>
@@ -57,24 +199,19 @@ DerivArrayEvaluator::getAmbiguousDerivs(size_t i)
 Eigen::Block<decltype(DerivArrayEvaluator::ambig), 1, Eigen::Dynamic>
 DerivArrayEvaluator::getAmbiguousDerivs(size_t i, Tape::Handle tape)
 {
-    // Reset the ambiguous array to all false
+    // Start with min / max ambiguities recorded in derivs()
     ambig = false;
+    ambig.head(i) = equal_derivs.head(i);
 
     bool abort = false;
     tape->walk(
-        [&](Opcode::Opcode op, Clause::Id /* id */, Clause::Id a, Clause::Id b)
+        [&](Opcode::Opcode op, Clause::Id /* id */,
+            Clause::Id a, Clause::Id /* b */)
         {
             if (op == Opcode::ORACLE)
             {
                 deck->oracles[a]->checkAmbiguous(ambig.head(i));
             }
-            else if (op == Opcode::OP_MIN || op == Opcode::OP_MAX)
-            {
-                ambig.head(i) = ambig.head(i) ||
-                    ((f.block(a, 0, 1, i) ==
-                      f.block(b, 0, 1, i)) &&
-                      (d(a).leftCols(i) != d(b).leftCols(i)).colwise().sum());
-            }
         }, abort);
 
     return ambig.head(i);
@@ -90,151 +227,48 @@ DerivArrayEvaluator::derivs(size_t count)
 Eigen::Block<decltype(DerivArrayEvaluator::out), 4, Eigen::Dynamic>
 DerivArrayEvaluator::derivs(size_t count, Tape::Handle tape)
 {
-    // Perform value evaluation, copying results into the 4th row of out
-    out.row(3).head(count) = values(count, tape);
+    setCount(count);
+    reserve(tape->slots());
+    if (static_cast<size_t>(d.rows()) < tape->slots())
+    {
+        d.conservativeResize(tape->slots());
+    }
+    equal = false;
+    equal_derivs = false;
+    cached = 0;
 
-    // Perform derivative evaluation, copying results into the out array
+    // Perform value and derivative evaluation in a single walk,
+    // then copy results into the out array
     deck->bindOracles(tape);
-    out.topLeftCorner(3, count) = d(tape->rwalk(*this)).leftCols(count);
+    deck->setOracleCount(count);
+    auto index = tape->rwalkSlots(*this);
     deck->unbindOracles();
 
+    out.row(3).head(count) = f.row(index).head(count);
+    out.topLeftCorner(3, count) = d(index).leftCols(count);
+
     // Return a block of valid results from the out array
     return out.block<4, Eigen::Dynamic>(0, 0, 4, count);
 }
 
 void DerivArrayEvaluator::operator()(Opcode::Opcode op, Clause::Id id,
-                                     Clause::Id a_, Clause::Id b_)
+                                     Clause::Id a, Clause::Id b)
 {
-#define ov f.row(id).head(count)
-#define od d(id).leftCols(count)
-
-#define av f.row(a_).head(count)
-#define ad d(a_).leftCols(count)
-
-#define bv f.row(b_).head(count)
-#define bd d(b_).leftCols(count)
-
-    switch (op) {
-        case Opcode::OP_ADD:
-            od = ad + bd;
-            break;
-        case Opcode::OP_MUL:
-            // Product rule
-            od = bd.rowwise()*av + ad.rowwise()*bv;
-            break;
-        case Opcode::OP_MIN:
-            for (Eigen::Index i=0; i < od.rows(); ++i)
-                od.row(i) = (av < bv).select(ad.row(i), bd.row(i));
-            break;
-        case Opcode::OP_MAX:
-            for (Eigen::Index i=0; i < od.rows(); ++i)
-                od.row(i) = (av < bv).select(bd.row(i), ad.row(i));
-            break;
-        case Opcode::OP_SUB:
-            od = ad - bd;
-            break;
-        case Opcode::OP_DIV:
-            od = (ad.rowwise()*bv - bd.rowwise()*av).rowwise() /
-                 bv.pow(2);
-            break;
-        case Opcode::OP_ATAN2:
-            od = (ad.rowwise()*bv - bd.rowwise()*av).rowwise() /
-                 (av.pow(2) + bv.pow(2));
-            break;
-        case Opcode::OP_POW:
-            // The full form of the derivative is
-            // od = m * (bv * ad + av * log(av) * bd))
-            // However, log(av) is often NaN and bd is always zero,
-            // (since it must be CONST), so we skip that part.
-            od = ad.rowwise() * (bv * av.pow(bv - 1));
-            break;
-
-        case Opcode::OP_NTH_ROOT:
-            for (Eigen::Index i=0; i < od.cols(); ++i)
-                od.col(i) = (ad.col(i) == 0)
-                    .select(0, ad.col(i) * (pow(av(i), 1.0f / bv(i) - 1) / bv(i)));
-            break;
-        case Opcode::OP_MOD:
-            od = ad;
-            break;
-        case Opcode::OP_NANFILL:
-            for (Eigen::Index i=0; i < od.rows(); ++i)
-                od.row(i) = av.isNaN().select(bd.row(i), ad.row(i));
-            break;
-        case Opcode::OP_COMPARE:
-            for (Eigen::Index i=0; i < od.rows(); ++i)
-                od.row(i).setZero();
-            break;
-
-        case Opcode::OP_SQUARE:
-            od = ad.rowwise() * av * 2;
-            break;
-        case Opcode::OP_SQRT:
-            for (Eigen::Index i=0; i < od.rows(); ++i)
-                od.row(i) = (av < 0 || ad.row(i) == 0).select(
-                    Eigen::Array<float, 1, Eigen::Dynamic>::Zero(1, count),
-                    ad.row(i) / (2 * ov));
-            break;
-        case Opcode::OP_NEG:
-            od = -ad;
-            break;
-        case Opcode::OP_SIN:
-            od = ad.rowwise() * cos(av);
-            break;
-        case Opcode::OP_COS:
-            od = ad.rowwise() * -sin(av);
-            break;
-        case Opcode::OP_TAN:
-            od = ad.rowwise() * pow(1/cos(av), 2);
-            break;
-        case Opcode::OP_ASIN:
-            od = ad.rowwise() / sqrt(1 - pow(av, 2));
-            break;
-        case Opcode::OP_ACOS:
-            od = ad.rowwise() / -sqrt(1 - pow(av, 2));
-            break;
-        case Opcode::OP_ATAN:
-            od = ad.rowwise() / (pow(av, 2) + 1);
-            break;
-        case Opcode::OP_LOG:
-            od = ad.rowwise() / av;
-            break;
-        case Opcode::OP_EXP:
-            od = ad.rowwise() * exp(av);
-            break;
-        case Opcode::OP_ABS:
-            for (Eigen::Index i=0; i < od.rows(); ++i)
-                od.row(i) = (av > 0).select(ad.row(i), -ad.row(i));
-            break;
-        case Opcode::OP_RECIP:
-            od = ad.rowwise() / -av.pow(2);
-            break;
-
-        case Opcode::CONST_VAR:
-            od = ad;
-            break;
-
-        case Opcode::ORACLE:
-            deck->oracles[a_]->evalDerivArray(od);
-            break;
-
-        case Opcode::INVALID:
-        case Opcode::CONSTANT:
-        case Opcode::VAR_X:
-        case Opcode::VAR_Y:
-        case Opcode::VAR_Z:
-        case Opcode::VAR_FREE:
-        case Opcode::LAST_OP: assert(false);
-    }
-#undef ov
-#undef od
-
-#undef av
-#undef ad
-
-#undef bv
-#undef bd
+    // Evaluate the clause's value first, since some of the
+    // derivatives below depend on it.
+    ArrayEvaluator::operator()(op, id, a, b);
 
+    if (op == Opcode::ORACLE)
+    {
+        deck->oracles[a]->evalDerivArray(d(id).leftCols(count));
+    }
+    else
+    {
+        assert(kernels[op] != nullptr);
+        kernels[op](d(id).data(), d(a).data(), d(b).data(),
+                    &f(id, 0), &f(a, 0), &f(b, 0),
+                    equal_derivs.data(), count);
+    }
 }
 
 }   // namespace Kernel
@@ -106,8 +106,41 @@ std::pair<Interval::I, Tape::Handle> IntervalEvaluator::evalAndPush(
         const Eigen::Vector3f& upper,
         Tape::Handle tape)
 {
-    auto out = eval(lower, upper, tape);
-    return std::make_pair(out, push(tape));
+    auto uncached = [&]() -> std::pair<Interval::I, Tape::Handle> {
+        auto out = eval(lower, upper, tape);
+        return std::make_pair(out, push(tape));
+    };
+
+    // Oracles store per-Deck state in their tapes' contexts, so tapes
+    // that use them can't be shared through the cache.
+    if (deck->oracles.size() || deck->cache.capacity() == 0)
+    {
+        return uncached();
+    }
+
+    TapeCache::Key key = {tape->serial(),
+        {{lower.x(), lower.y(), lower.z(), upper.x(), upper.y(), upper.z()}},
+        {}};
+    for (auto& v : deck->vars.left)
+    {
+        // NaN variables would never match a key, so skip the cache
+        if (i[v.first].second)
+        {
+            return uncached();
+        }
+        key.vars.push_back(i[v.first].first.lower());
+    }
+
+    TapeCache::Entry e;
+    if (deck->cache.find(key, e))
+    {
+        safe = e.safe;
+        return std::make_pair(e.result, e.tape);
+    }
+
+    auto out = uncached();
+    deck->cache.insert(key, {out.first, safe, out.second});
+    return out;
 }
 
 std::shared_ptr<Tape> IntervalEvaluator::push()
@@ -35,13 +35,14 @@ JacobianEvaluator::JacobianEvaluator(std::shared_ptr<Deck> d)
 JacobianEvaluator::JacobianEvaluator(
         std::shared_ptr<Deck> d, const std::map<Tree::Id, float>& vars)
     : DerivEvaluator(d, vars),
-      j(Eigen::ArrayXXf::Zero(deck->num_clauses + 1, deck->vars.size()))
+      j(deck->deps.size(), 0)
 {
-    // Then drop a 1 at each var's position
-    size_t index = 0;
+    // Then drop a 1 at each var's position (which is the only entry
+    // in the var's list of dependencies)
     for (auto& v : deck->vars.left)
     {
-        j(v.first, index++) = 1;
+        assert(deck->depsEnd(v.first) == deck->depsBegin(v.first) + 1);
+        j[deck->depsBegin(v.first)] = 1;
     }
 }
 
@@ -62,13 +63,16 @@ std::map<Tree::Id, float> JacobianEvaluator::gradient(
     auto ti = tape->rwalk(*this);
     deck->unbindOracles();
 
-    // Unpack from flat array into map
+    // Unpack from the root's sparse row into map
     // (to allow correlating back to VARs in Tree)
     std::map<Tree::Id, float> out;
-    size_t index = 0;
+    uint32_t index = 0;
+    auto k = deck->depsBegin(ti);
+    const auto end = deck->depsEnd(ti);
     for (auto v : deck->vars.left)
     {
-        out[v.second] = j(ti, index++);
+        out[v.second] = (k < end && deck->deps[k] == index) ? j[k++] : 0;
+        index++;
     }
     return out;
 }
@@ -76,108 +80,130 @@ std::map<Tree::Id, float> JacobianEvaluator::gradient(
 void JacobianEvaluator::operator()(Opcode::Opcode op, Clause::Id id,
                                    Clause::Id a, Clause::Id b)
 {
-#define ov f(id)
-#define oj j.row(id)
+    // Clauses that don't depend on any variable have nothing to store
+    // (this also skips ORACLE clauses, which are leaves)
+    const auto begin = deck->depsBegin(id);
+    const auto end = deck->depsEnd(id);
+    if (begin == end)
+    {
+        return;
+    }
 
-#define av f(a)
-#define aj j.row(a)
+    // The arguments' variables are a subset of this clause's variables,
+    // so we walk all three sorted lists in lockstep, reading zero for
+    // variables that an argument doesn't depend on.
+    const auto& deps = deck->deps;
+    auto ak = deck->depsBegin(a);
+    auto bk = deck->depsBegin(b);
+    const auto a_end = deck->depsEnd(a);
+    const auto b_end = deck->depsEnd(b);
 
+#define av f(a)
 #define bv f(b)
-#define bj j.row(b)
+
+#define LOOP(expr)                                                      \
+    for (auto k=begin; k < end; ++k)                                    \
+    {                                                                   \
+        const auto v = deps[k];                                         \
+        const float aj = (ak < a_end && deps[ak] == v) ? j[ak++] : 0;   \
+        const float bj = (bk < b_end && deps[bk] == v) ? j[bk++] : 0;   \
+        (void)aj;                                                       \
+        (void)bj;                                                       \
+        j[k] = (expr);                                                  \
+    }
 
         switch (op) {
             case Opcode::OP_ADD:
-                oj = aj + bj;
+                LOOP(aj + bj);
                 break;
             case Opcode::OP_MUL:
-                oj = av * bj + bv * aj;
+                LOOP(av * bj + bv * aj);
                 break;
             case Opcode::OP_MIN:
-                oj = (av < bv) ? aj : bj;
+                LOOP((av < bv) ? aj : bj);
                 break;
             case Opcode::OP_MAX:
-                oj = (av < bv) ? bj : aj;
+                LOOP((av < bv) ? bj : aj);
                 break;
             case Opcode::OP_SUB:
-                oj = aj - bj;
+                LOOP(aj - bj);
                 break;
             case Opcode::OP_DIV:
-                oj = (bv*aj - av*bj) / pow(bv, 2);
+                LOOP((bv*aj - av*bj) / pow(bv, 2));
                 break;
             case Opcode::OP_ATAN2:
-                oj = (aj*bv - av*bj) / (pow(av, 2) + pow(bv, 2));
+                LOOP((aj*bv - av*bj) / (pow(av, 2) + pow(bv, 2)));
                 break;
             case Opcode::OP_POW:
                 // The full form of the derivative is
                 // oj = m * (bv * aj + av * log(av) * bj))
                 // However, log(av) is often NaN and bj is always zero,
                 // (since it must be CONST), so we skip that part.
-                oj = pow(av, bv - 1) * (bv * aj);
+                LOOP(pow(av, bv - 1) * (bv * aj));
                 break;
             case Opcode::OP_NTH_ROOT:
-                oj = pow(av, 1.0f/bv - 1) * (1.0f/bv * aj);
+                LOOP(pow(av, 1.0f/bv - 1) * (1.0f/bv * aj));
                 break;
             case Opcode::OP_MOD:
                 // This isn't quite how partial derivatives of mod work,
                 // but close enough normals rendering.
-                oj = aj;
+                LOOP(aj);
                 break;
             case Opcode::OP_NANFILL:
-                oj = std::isnan(av) ? bj : aj;
+                LOOP(std::isnan(av) ? bj : aj);
                 break;
             case Opcode::OP_COMPARE:
-                oj.setZero();
+                LOOP(0);
                 break;
 
             case Opcode::OP_SQUARE:
-                oj = 2 * av * aj;
+                LOOP(2 * av * aj);
                 break;
             case Opcode::OP_SQRT:
-                if (av < 0) oj.setZero();
-                else        oj = (aj / (2 * sqrt(av)));
+                LOOP((av < 0) ? 0 : (aj / (2 * sqrt(av))));
                 break;
             case Opcode::OP_NEG:
-                oj = -aj;
+                LOOP(-aj);
                 break;
             case Opcode::OP_SIN:
-                oj = aj * cos(av);
+                LOOP(aj * cos(av));
                 break;
             case Opcode::OP_COS:
-                oj = aj * -sin(av);
+                LOOP(aj * -sin(av));
                 break;
             case Opcode::OP_TAN:
-                oj = aj * pow(1/cos(av), 2);
+                LOOP(aj * pow(1/cos(av), 2));
                 break;
             case Opcode::OP_ASIN:
-                oj = aj / sqrt(1 - pow(av, 2));
+                LOOP(aj / sqrt(1 - pow(av, 2)));
                 break;
             case Opcode::OP_ACOS:
-                oj = aj / -sqrt(1 - pow(av, 2));
+                LOOP(aj / -sqrt(1 - pow(av, 2)));
                 break;
             case Opcode::OP_ATAN:
-                oj = aj / (pow(av, 2) + 1);
+                LOOP(aj / (pow(av, 2) + 1));
                 break;
             case Opcode::OP_LOG:
-                oj = aj / av;
+                LOOP(aj / av);
                 break;
             case Opcode::OP_EXP:
-                oj = exp(av) * aj;
+                LOOP(exp(av) * aj);
                 break;
             case Opcode::OP_ABS:
-                oj = (av > 0 ? 1 : -1) * aj;
+                LOOP((av > 0 ? 1 : -1) * aj);
                 break;
             case Opcode::OP_RECIP:
-                oj = -aj / pow(av, 2);
+                LOOP(-aj / pow(av, 2));
                 break;
 
+            // CONST_VAR depends on its argument's variables (so that
+            // its value is updated when they change), but its
+            // derivatives are always zero.
             case Opcode::CONST_VAR:
-                oj.setZero();
+                LOOP(0);
                 break;
 
             case Opcode::ORACLE:
-                oj.setZero();
-                break;
-
             case Opcode::INVALID:
             case Opcode::CONSTANT:
             case Opcode::VAR_X:
@@ -186,16 +212,10 @@ void JacobianEvaluator::operator()(Opcode::Opcode op, Clause::Id id,
             case Opcode::VAR_FREE:
             case Opcode::LAST_OP: assert(false);
         }
-#undef ov
-#undef oj
+#undef LOOP
 
 #undef av
-#undef aj
-
 #undef bv
-#undef bj
 }
 
 }   // namespace Kernel
-
-
@@ -148,110 +148,87 @@ bool PointEvaluator::setVar(Tree::Id var, float value)
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void PointEvaluator::operator()(Opcode::Opcode op, Clause::Id id,
-                                Clause::Id a_, Clause::Id b_)
+namespace {
+
+/*
+ *  Scalar implementation of each opcode, shared by the tape walker and
+ *  PointEvaluator::evalOp.  It lives in an anonymous namespace so that
+ *  it is always inlined into the tape walker.
+ */
+inline float apply(Opcode::Opcode op, float a, float b)
 {
-#define out f(id)
-#define a f(a_)
-#define b f(b_)
     switch (op)
     {
         case Opcode::OP_ADD:
-            out = a + b;
-            break;
+            return a + b;
         case Opcode::OP_MUL:
-            out = a * b;
-            break;
+            return a * b;
         case Opcode::OP_MIN:
-            out = fmin(a, b);
-            break;
+            return fmin(a, b);
         case Opcode::OP_MAX:
-            out = fmax(a, b);
-            break;
+            return fmax(a, b);
         case Opcode::OP_SUB:
-            out = a - b;
-            break;
+            return a - b;
         case Opcode::OP_DIV:
-            out = a / b;
-            break;
+            return a / b;
         case Opcode::OP_ATAN2:
-            out = atan2(a, b);
-            break;
+            return atan2(a, b);
         case Opcode::OP_POW:
-            out = pow(a, b);
-            break;
+            return pow(a, b);
         case Opcode::OP_NTH_ROOT:
             // Work around a limitation in pow by using boost's nth-root
             // function on a single-point interval
             if (a < 0)
-                out = boost::numeric::nth_root(Interval::I(a, a), b).lower();
+                return boost::numeric::nth_root(Interval::I(a, a), b).lower();
             else
-                out = pow(a, 1.0f/b);
-            break;
+                return pow(a, 1.0f/b);
         case Opcode::OP_MOD:
-            out = std::fmod(a, b);
+        {
+            float out = std::fmod(a, b);
             while (out < 0)
             {
                 out += b;
             }
-            break;
+            return out;
+        }
         case Opcode::OP_NANFILL:
-            out = std::isnan(a) ? b : a;
-            break;
+            return std::isnan(a) ? b : a;
         case Opcode::OP_COMPARE:
-            if      (a < b)     out = -1;
-            else if (a > b)     out =  1;
-            else                out =  0;
-            break;
+            if      (a < b)     return -1;
+            else if (a > b)     return  1;
+            else                return  0;
 
         case Opcode::OP_SQUARE:
-            out = a * a;
-            break;
+            return a * a;
         case Opcode::OP_SQRT:
-            out = sqrt(a);
-            break;
+            return sqrt(a);
         case Opcode::OP_NEG:
-            out = -a;
-            break;
+            return -a;
         case Opcode::OP_SIN:
-            out = sin(a);
-            break;
+            return sin(a);
         case Opcode::OP_COS:
-            out = cos(a);
-            break;
+            return cos(a);
         case Opcode::OP_TAN:
-            out = tan(a);
-            break;
+            return tan(a);
         case Opcode::OP_ASIN:
-            out = asin(a);
-            break;
+            return asin(a);
         case Opcode::OP_ACOS:
-            out = acos(a);
-            break;
+            return acos(a);
         case Opcode::OP_ATAN:
-            out = atan(a);
-            break;
+            return atan(a);
         case Opcode::OP_LOG:
-            out = log(a);
-            break;
+            return log(a);
         case Opcode::OP_EXP:
-            out = exp(a);
-            break;
+            return exp(a);
         case Opcode::OP_ABS:
-            out = fabs(a);
-            break;
+            return fabs(a);
         case Opcode::OP_RECIP:
-            out = 1 / a;
-            break;
+            return 1 / a;
 
         case Opcode::CONST_VAR:
-            out = a;
-            break;
+            return a;
 
         case Opcode::ORACLE:
-            deck->oracles[a_]->evalPoint(out);
-            break;
-
         case Opcode::INVALID:
         case Opcode::CONSTANT:
         case Opcode::VAR_X:
@@ -260,9 +237,27 @@ void PointEvaluator::operator()(Opcode::Opcode op, Clause::Id id,
         case Opcode::VAR_FREE:
         case Opcode::LAST_OP: assert(false);
     }
-#undef out
-#undef a
-#undef b
+    return std::nanf("");
+}
+
+}   // anonymous namespace
+
+float PointEvaluator::evalOp(Opcode::Opcode op, float a, float b)
+{
+    return apply(op, a, b);
+}
+
+void PointEvaluator::operator()(Opcode::Opcode op, Clause::Id id,
+                                Clause::Id a, Clause::Id b)
+{
+    if (op == Opcode::ORACLE)
+    {
+        deck->oracles[a]->evalPoint(f(id));
+    }
+    else
+    {
+        f(id) = apply(op, f(a), f(b));
+    }
 }
 
 }   // namespace Kernel
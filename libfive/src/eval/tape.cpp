@@ -7,6 +7,7 @@ This Source Code Form is subject to the terms of the Mozilla Public
 License, v. 2.0. If a copy of the MPL was not distributed with this file,
 You can obtain one at http://mozilla.org/MPL/2.0/.
 */
+#include <atomic>
 #include <unordered_map>
 
 #include "libfive/eval/tape.hpp"
@@ -15,6 +16,12 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 
 namespace Kernel {
 
+uint64_t Tape::nextSerial()
+{
+    static std::atomic<uint64_t> next(0);
+    return next++;
+}
+
 Clause::Id Tape::rwalk(WalkFunction fn, bool& abort)
 {
     for (auto itr = t.rbegin(); itr != t.rend() && !abort; ++itr)
@@ -47,10 +54,24 @@ std::shared_ptr<Tape> Tape::push(const std::shared_ptr<Tape>& tape, Deck& deck,
         return tape;
     }
 
-    // Since we'll be figuring out which clauses are disabled and
-    // which should be remapped, we reset those arrays here
-    std::fill(deck.disabled.begin(), deck.disabled.end(), true);
-    std::fill(deck.remap.begin(), deck.remap.end(), 0);
+    // Between pushes, every entry in deck.disabled is true and every
+    // entry in deck.remap is zero.  We only touch entries for clauses in
+    // this tape (and their arguments), then restore them before returning,
+    // so the cost of a push scales with the tape rather than the Deck.
+    auto reset = [&]()
+    {
+        deck.disabled[tape->i] = true;
+        for (const auto& c : tape->t)
+        {
+            deck.disabled[c.id] = true;
+            deck.remap[c.id] = 0;
+            if (c.op != Opcode::ORACLE)
+            {
+                deck.disabled[c.a] = true;
+                deck.disabled[c.b] = true;
+            }
+        }
+    };
 
     // Mark the root node as active
     deck.disabled[tape->i] = false;
@@ -119,6 +140,7 @@ std::shared_ptr<Tape> Tape::push(const std::shared_ptr<Tape>& tape, Deck& deck,
 
     if (!changed)
     {
+        reset();
         return tape;
     }
 
@@ -137,6 +159,8 @@ std::shared_ptr<Tape> Tape::push(const std::shared_ptr<Tape>& tape, Deck& deck,
     out->type = t;
     out->parent = tape;
     out->terminal = terminal;
+    out->cached = false;
+    out->serial_ = nextSerial();
     out->t.clear(); // preserves capacity
 
     // Now, use the data in disabled and remap to make the new tape
@@ -167,6 +191,9 @@ std::shared_ptr<Tape> Tape::push(const std::shared_ptr<Tape>& tape, Deck& deck,
     // Make sure that the tape got shorter
     assert(out->t.size() <= tape->t.size());
 
+    // Restore the scratch arrays for the next push
+    reset();
+
     // Store X / Y / Z bounds (may be irrelevant)
     out->X = {r.lower.x(), r.upper.x()};
     out->Y = {r.lower.y(), r.upper.y()};
@@ -175,6 +202,9 @@ std::shared_ptr<Tape> Tape::push(const std::shared_ptr<Tape>& tape, Deck& deck,
     // Store the Oracle contexts
     out->contexts = std::move(contexts);
 
+    // Assign result slots in the shortened tape
+    deck.allocate(*out);
+
     return out;
 }
 
@@ -0,0 +1,106 @@
+/*
+libfive: a CAD kernel for modeling with implicit functions
+Copyright (C) 2019  Matt Keeter
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+#include "libfive/eval/tape_cache.hpp"
+#include "libfive/eval/tape.hpp"
+
+namespace Kernel {
+
+const size_t TapeCache::DEFAULT_CAPACITY;
+const size_t TapeCache::TYPICAL_CAPACITY;
+
+bool TapeCache::Key::operator==(const Key& other) const
+{
+    return parent == other.parent && bounds == other.bounds &&
+           vars == other.vars;
+}
+
+size_t TapeCache::KeyHash::operator()(const Key& k) const
+{
+    size_t h = std::hash<uint64_t>()(k.parent);
+    auto combine = [&h](float f) {
+        h ^= std::hash<float>()(f) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    };
+    for (auto& f : k.bounds)
+    {
+        combine(f);
+    }
+    for (auto& f : k.vars)
+    {
+        combine(f);
+    }
+    return h;
+}
+
+TapeCache::TapeCache(size_t capacity)
+    : cap(capacity)
+{
+    // Nothing to do here
+}
+
+bool TapeCache::find(const Key& key, Entry& out)
+{
+    std::lock_guard<std::mutex> lock(mut);
+    auto itr = map.find(key);
+    if (itr == map.end())
+    {
+        return false;
+    }
+
+    lru.splice(lru.begin(), lru, itr->second);
+    out = itr->second->second;
+    return true;
+}
+
+void TapeCache::insert(const Key& key, const Entry& entry)
+{
+    std::lock_guard<std::mutex> lock(mut);
+    if (cap == 0 || map.count(key))
+    {
+        return;
+    }
+
+    entry.tape->cached = true;
+    lru.push_front({key, entry});
+    map.insert({key, lru.begin()});
+    total += entry.tape->size();
+    evict();
+}
+
+void TapeCache::evict()
+{
+    while ((total > cap || cap == 0) && lru.size())
+    {
+        total -= lru.back().second.tape->size();
+        map.erase(lru.back().first);
+        lru.pop_back();
+    }
+}
+
+void TapeCache::setCapacity(size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(mut);
+    cap = capacity;
+    evict();
+}
+
+size_t TapeCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mut);
+    return lru.size();
+}
+
+void TapeCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mut);
+    map.clear();
+    lru.clear();
+    total = 0;
+}
+
+}   // namespace Kernel
@@ -8,6 +8,7 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 */
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 
 #include "libfive.h"
 
@@ -16,6 +17,7 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include "libfive/eval/eval_point.hpp"
 #include "libfive/eval/eval_deriv.hpp"
+#include "libfive/eval/eval_xtree.hpp"
 
 #include "libfive/render/brep/region.hpp"
 #include "libfive/render/brep/contours.hpp"
@@ -47,6 +49,20 @@ void libfive_contours3_delete(libfive_contours3* cs)
     delete cs;
 }
 
+void libfive_slices_delete(libfive_slices* s)
+{
+    for (unsigned i=0; i < s->count; ++i)
+    {
+        for (unsigned j=0; j < s->slices[i].count; ++j)
+        {
+            delete [] s->slices[i].cs[j].pts;
+        }
+        delete [] s->slices[i].cs;
+    }
+    delete [] s->slices;
+    delete s;
+}
+
 void libfive_mesh_delete(libfive_mesh* m)
 {
     delete [] m->verts;
@@ -210,6 +226,82 @@ libfive_vec3 libfive_tree_eval_d(libfive_tree t, libfive_vec3 p)
     return {v.x(), v.y(), v.z()};
 }
 
+libfive_evaluator libfive_evaluator_new(libfive_tree t)
+{
+    return new XTreeEvaluator(*t);
+}
+
+libfive_evaluator libfive_evaluator_fork(libfive_evaluator e)
+{
+    return new XTreeEvaluator(e->deck->fork());
+}
+
+void libfive_evaluator_delete(libfive_evaluator e)
+{
+    delete e;
+}
+
+bool libfive_evaluator_update_vars(libfive_evaluator e, libfive_vars vars)
+{
+    std::map<Tree::Id, float> vs;
+    for (unsigned i=0; i < vars.size; ++i)
+    {
+        vs[static_cast<Tree::Id>(vars.vars[i])] = vars.values[i];
+    }
+    return e->updateVars(vs);
+}
+
+void libfive_evaluator_values(libfive_evaluator e, const libfive_vec3* ps,
+                              uint32_t count, float* out)
+{
+    // Evaluate in chunks that fill the array evaluator
+    for (uint32_t start=0; start < count; start += ArrayEvaluator::N)
+    {
+        const uint32_t n = std::min<uint32_t>(count - start,
+                                              ArrayEvaluator::N);
+        for (uint32_t i=0; i < n; ++i)
+        {
+            const auto& p = ps[start + i];
+            e->array.set({p.x, p.y, p.z}, i);
+        }
+        auto vs = e->array.values(n);
+        std::copy(vs.data(), vs.data() + n, out + start);
+    }
+}
+
+void libfive_evaluator_derivs(libfive_evaluator e, const libfive_vec3* ps,
+                              uint32_t count, libfive_vec4* out)
+{
+    for (uint32_t start=0; start < count; start += ArrayEvaluator::N)
+    {
+        const uint32_t n = std::min<uint32_t>(count - start,
+                                              ArrayEvaluator::N);
+        for (uint32_t i=0; i < n; ++i)
+        {
+            const auto& p = ps[start + i];
+            e->array.set({p.x, p.y, p.z}, i);
+        }
+        auto ds = e->array.derivs(n);
+        for (uint32_t i=0; i < n; ++i)
+        {
+            out[start + i] = {ds(0, i), ds(1, i), ds(2, i), ds(3, i)};
+        }
+    }
+}
+
+void libfive_evaluator_intervals(libfive_evaluator e,
+                                 const libfive_region3* rs,
+                                 uint32_t count, libfive_interval* out)
+{
+    for (uint32_t i=0; i < count; ++i)
+    {
+        const auto& r = rs[i];
+        auto v = e->interval.eval({r.X.lower, r.Y.lower, r.Z.lower},
+                                  {r.X.upper, r.Y.upper, r.Z.upper});
+        out[i] = {v.lower(), v.upper()};
+    }
+}
+
 bool libfive_tree_eq(libfive_tree a, libfive_tree b)
 {
     return *a == *b;
@@ -290,6 +382,44 @@ libfive_contours3* libfive_tree_render_slice3(libfive_tree tree,
     return out;
 }
 
+libfive_slices* libfive_tree_render_slices(libfive_tree tree,
+        libfive_region2 R, const float* zs, uint32_t count, float res)
+{
+    Region<2> region({R.X.lower, R.Y.lower}, {R.X.upper, R.Y.upper});
+    BRepSettings settings;
+    settings.min_feature = 1/res;
+    auto stack = Contours::renderStack(*tree, region,
+            std::vector<double>(zs, zs + count), settings);
+
+    auto out = new libfive_slices;
+    out->count = stack.size();
+    out->slices = new libfive_contours[out->count];
+
+    for (size_t k=0; k < stack.size(); ++k)
+    {
+        auto& cs = stack[k];
+        auto& slice = out->slices[k];
+        slice.count = cs->contours.size();
+        slice.cs = new libfive_contour[slice.count];
+
+        size_t i=0;
+        for (auto& c : cs->contours)
+        {
+            slice.cs[i].count = c.size();
+            slice.cs[i].pts = new libfive_vec2[c.size()];
+
+            size_t j=0;
+            for (auto& pt : c)
+            {
+                slice.cs[i].pts[j++] = {pt.x(), pt.y()};
+            }
+            i++;
+        }
+    }
+
+    return out;
+}
+
 void libfive_tree_save_slice(libfive_tree tree, libfive_region2 R, float z, float res,
                         const char* f)
 {
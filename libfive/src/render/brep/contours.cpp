@@ -7,7 +7,10 @@ This Source Code Form is subject to the terms of the Mozilla Public
 License, v. 2.0. If a copy of the MPL was not distributed with this file,
 You can obtain one at http://mozilla.org/MPL/2.0/.
 */
+#include <algorithm>
 #include <fstream>
+#include <future>
+#include <numeric>
 #include <boost/algorithm/string/predicate.hpp>
 
 #include "libfive/eval/eval_xtree.hpp"
@@ -26,11 +29,13 @@ std::unique_ptr<Contours> Contours::render(
         const Tree t, const Region<2>& r,
         const BRepSettings& settings)
 {
+    // Flatten the tree once, then fork the Deck for the other workers
+    auto deck = std::make_shared<Deck>(t);
     std::vector<XTreeEvaluator, Eigen::aligned_allocator<XTreeEvaluator>> es;
     es.reserve(settings.workers);
     for (unsigned i=0; i < settings.workers; ++i)
     {
-        es.emplace_back(XTreeEvaluator(t));
+        es.emplace_back(XTreeEvaluator(i ? deck->fork() : deck));
     }
 
     // Create the quadtree on the scaffold
@@ -47,6 +52,118 @@ std::unique_ptr<Contours> Contours::render(
     return cs;
 }
 
+std::vector<std::unique_ptr<Contours>> Contours::renderStack(
+        const Tree t, const Region<2>& r, const std::vector<double>& zs,
+        const BRepSettings& settings)
+{
+    auto deck = std::make_shared<Deck>(t);
+    std::vector<XTreeEvaluator, Eigen::aligned_allocator<XTreeEvaluator>> es;
+    es.reserve(settings.workers);
+    for (unsigned i=0; i < settings.workers; ++i)
+    {
+        es.emplace_back(XTreeEvaluator(i ? deck->fork() : deck));
+    }
+
+    // Each layer is built by a single thread, with layers running in
+    // parallel.  The progress handler is left out, since it tracks one build.
+    BRepSettings layer_settings;
+    layer_settings.copyFrom(settings);
+    layer_settings.workers = 1;
+
+    // Sort layers by height, so that neighboring layers share slabs
+    std::vector<size_t> order(zs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [&zs](size_t a, size_t b) { return zs[a] < zs[b]; });
+
+    // Split the stack into a few chunks per worker, which are handed
+    // out as workers become free (to balance out uneven layers)
+    const size_t chunks = std::min(zs.size(), (size_t)settings.workers * 4);
+    std::atomic<size_t> next(0);
+
+    std::vector<std::unique_ptr<Contours>> out(zs.size());
+    std::vector<std::future<void>> futures;
+    for (unsigned i=0; i < settings.workers; ++i)
+    {
+        futures.push_back(std::async(std::launch::async, [&, i]() {
+            for (size_t c = next++; c < chunks; c = next++)
+            {
+                // Pass cancellation through to the per-layer settings,
+                // which also stops any layers that are in progress
+                if (settings.cancel.load())
+                {
+                    layer_settings.cancel.store(true);
+                    break;
+                }
+                renderSlab(&es[i], r, zs,
+                           order.cbegin() + zs.size() * c / chunks,
+                           order.cbegin() + zs.size() * (c + 1) / chunks,
+                           deck->tape, layer_settings, out);
+            }
+        }));
+    }
+    for (auto& f : futures)
+    {
+        f.get();
+    }
+
+    if (settings.cancel.load())
+    {
+        out.clear();
+    }
+    return out;
+}
+
+void Contours::renderSlab(XTreeEvaluator* eval, const Region<2>& r,
+                          const std::vector<double>& zs,
+                          std::vector<size_t>::const_iterator begin,
+                          std::vector<size_t>::const_iterator end,
+                          std::shared_ptr<Tape> tape,
+                          const BRepSettings& settings,
+                          std::vector<std::unique_ptr<Contours>>& out)
+{
+    if (settings.cancel.load())
+    {
+        return;
+    }
+
+    // A single layer is built from the slab's tape, since the quadtree
+    // begins by pruning over the layer itself.
+    if (end - begin == 1)
+    {
+        const Region<2> layer(r.lower, r.upper, Region<2>::Perp(zs[*begin]));
+        auto xtree = DCPool<2>::build(eval, layer, settings, nullptr, tape);
+        if (xtree.get() != nullptr)
+        {
+            auto cs = Dual<2>::walk<DCContourer>(xtree, settings);
+            cs->bbox = layer;
+            out[*begin] = std::move(cs);
+        }
+        return;
+    }
+
+    const Eigen::Vector3f lower(r.lower.x(), r.lower.y(), zs[*begin]);
+    const Eigen::Vector3f upper(r.upper.x(), r.upper.y(), zs[*(end - 1)]);
+    auto o = eval->interval.evalAndPush(lower, upper, tape);
+
+    // If the whole slab is empty or filled, then none of its layers
+    // cross the surface, so they have no contours.
+    if (eval->interval.isSafe() &&
+        (o.first.lower() > 0 || o.first.upper() < 0))
+    {
+        for (auto itr = begin; itr != end; ++itr)
+        {
+            out[*itr].reset(new Contours(
+                    Region<2>(r.lower, r.upper, Region<2>::Perp(zs[*itr]))));
+        }
+        return;
+    }
+
+    const auto mid = begin + (end - begin) / 2;
+    renderSlab(eval, r, zs, begin, mid, o.second, settings, out);
+    renderSlab(eval, r, zs, mid, end, o.second, settings, out);
+}
+
 bool Contours::saveSVG(const std::string& filename)
 {
     if (!boost::algorithm::iends_with(filename, ".svg"))
@@ -0,0 +1,250 @@
+/*
+libfive: a CAD kernel for modeling with implicit functions
+
+Copyright (C) 2019  Matt Keeter
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+#include <algorithm>
+#include <chrono>
+#include <future>
+
+#include "libfive/render/brep/dc/dc_refiner.hpp"
+#include "libfive/render/brep/dc/dc_pool.hpp"
+#include "libfive/render/brep/dc/dc_mesher.hpp"
+#include "libfive/render/brep/dual.hpp"
+#include "libfive/render/brep/mesh.hpp"
+#include "libfive/render/brep/settings.hpp"
+
+#include "libfive/eval/eval_xtree.hpp"
+
+namespace Kernel {
+
+std::unique_ptr<Mesh> DCRefiner::render(
+        XTreeEvaluator* es, const Region<3>& r,
+        const BRepSettings& settings,
+        const std::map<Tree::Id, float>& vs)
+{
+    if (settings.progress_handler) {
+        // Pool::build (or refinement), Dual::walk
+        settings.progress_handler->start({1, 1});
+    }
+
+    // We can only reuse the stored tree if it covers the same region,
+    // was built with the same error threshold, and is no finer than
+    // the requested resolution.
+    const auto target = r.withResolution(settings.min_feature);
+    const bool reuse = tree.get() != nullptr &&
+        (target.lower == region.lower).all() &&
+        (target.upper == region.upper).all() &&
+        target.level >= region.level &&
+        settings.max_err == max_err;
+
+    if (!reuse)
+    {
+        reset();
+        tree = DCPool<3>::build(es, r, settings);
+        if (settings.cancel.load() || tree.get() == nullptr) {
+            reset();
+            if (settings.progress_handler) {
+                settings.progress_handler->finish();
+            }
+            return nullptr;
+        }
+        region = target;
+        max_err = settings.max_err;
+        vars = vs;
+    }
+    else
+    {
+        // Find the clause ids of every variable that has changed
+        changed.clear();
+        for (auto& v : vs) {
+            auto prev = vars.find(v.first);
+            if (prev == vars.end() || prev->second != v.second) {
+                auto c = es->deck->vars.right.find(v.first);
+                if (c != es->deck->vars.right.end()) {
+                    changed.insert(c->second);
+                }
+            }
+        }
+
+        // Walk the tree, finding cells to rebuild.  The stored tree was
+        // built with the old variable values, so we use a second interval
+        // evaluator to specialize tapes as they were at that time.
+        IntervalEvaluator old_interval(es->deck, vars);
+        std::vector<Target> targets;
+        findTargets(es, old_interval, tree.get(),
+                    target, es->deck->tape, es->deck->tape,
+                    target.level > region.level, targets);
+
+        if (settings.progress_handler) {
+            settings.progress_handler->nextPhase(targets.size());
+        }
+
+        // Rebuild each target with its own pool, splitting the
+        // evaluators evenly among the targets when there are only a few
+        // of them (e.g. when a variable change affects the whole model).
+        const unsigned per = std::max(1u, settings.workers /
+                std::max(1u, static_cast<unsigned>(targets.size())));
+        const unsigned slots = settings.workers / per;
+
+        // Sub-builds use their own settings, since each one has its own
+        // share of the workers.  The cancel flag is forwarded to them below,
+        // and progress is reported here, once per target.
+        std::vector<std::unique_ptr<BRepSettings>> subs;
+        for (unsigned i=0; i < slots; ++i) {
+            subs.emplace_back(new BRepSettings);
+            subs.back()->copyFrom(settings);
+            subs.back()->workers = per;
+        }
+
+        std::vector<Root<DCTree<3>>> built(targets.size());
+        std::vector<std::future<void>> futures(slots);
+        for (unsigned i=0; i < slots; ++i) {
+            futures[i] = std::async(std::launch::async,
+                [&targets, &built, &subs, &settings, es, per, slots, i]()
+                {
+                    auto& s = *subs[i];
+                    for (unsigned j=i; j < targets.size() && !s.cancel.load();
+                         j += slots)
+                    {
+                        // Each target region already has its level, so
+                        // the rebuild lines up with the rest of the tree
+                        built[j] = DCPool<3>::build(es + i * per,
+                                                    targets[j].region, s);
+                        if (settings.progress_handler) {
+                            settings.progress_handler->tick();
+                        }
+                    }
+                });
+        }
+
+        for (auto& f : futures) {
+            while (f.wait_for(std::chrono::milliseconds(5)) !=
+                   std::future_status::ready)
+            {
+                if (settings.cancel.load()) {
+                    for (auto& s : subs) {
+                        s->cancel.store(true);
+                    }
+                }
+            }
+            f.get();
+        }
+
+        // If we were cancelled, then the tree is left in an unknown state
+        // (some targets may have been rebuilt and others not), so we'll
+        // throw it away and start over next time.
+        if (settings.cancel.load() ||
+            std::any_of(built.begin(), built.end(),
+                        [](const Root<DCTree<3>>& b)
+                        { return b.get() == nullptr; }))
+        {
+            reset();
+            if (settings.progress_handler) {
+                settings.progress_handler->finish();
+            }
+            return nullptr;
+        }
+
+        for (unsigned i=0; i < targets.size(); ++i) {
+            tree.splice(targets[i].tree, std::move(built[i]));
+        }
+        tree->resetIndices();
+
+        region = target;
+        vars = vs;
+        rebuilt_count = targets.size();
+    }
+
+    auto out = Dual<3>::walk<DCMesher>(tree, settings);
+    if (settings.progress_handler) {
+        settings.progress_handler->finish();
+    }
+    if (settings.cancel.load()) {
+        return nullptr;
+    }
+    return out;
+}
+
+void DCRefiner::reset()
+{
+    tree = Root<DCTree<3>>();
+    region = Region<3>();
+    max_err = 0;
+    vars.clear();
+    changed.clear();
+    rebuilt_count = -1;
+}
+
+void DCRefiner::findTargets(XTreeEvaluator* eval,
+                            IntervalEvaluator& old_interval,
+                            DCTree<3>* t, const Region<3>& r,
+                            std::shared_ptr<Tape> old_tape,
+                            std::shared_ptr<Tape> new_tape,
+                            bool finer, std::vector<Target>& targets) const
+{
+    // If neither the old nor new tape for this cell uses a changed
+    // variable, then nothing in this subtree depends on them, and the
+    // subtree is already at the right resolution.
+    if (!finer && !dependsOnChanges(old_tape) && !dependsOnChanges(new_tape))
+    {
+        return;
+    }
+
+    // Levels shift when the resolution increases
+    t->region = r;
+
+    auto o = eval->interval.evalAndPush(
+            r.lower3().template cast<float>(),
+            r.upper3().template cast<float>(),
+            new_tape);
+    const auto state = eval->interval.isSafe() ? Interval::state(o.first)
+                                               : Interval::AMBIGUOUS;
+
+    if (t->isBranch() && state == Interval::AMBIGUOUS)
+    {
+        auto p = old_interval.evalAndPush(
+                r.lower3().template cast<float>(),
+                r.upper3().template cast<float>(),
+                old_tape);
+        auto rs = r.subdivide();
+        for (unsigned i=0; i < t->children.size(); ++i)
+        {
+            findTargets(eval, old_interval, t->children[i].load(), rs[i],
+                        p.second, o.second, finer, targets);
+        }
+    }
+    // Cells that are still proven filled or empty can be kept, but any
+    // other cell (including every leaf that contains the surface) must
+    // be rebuilt with the current settings and variables.
+    else if (t->isBranch() || state == Interval::AMBIGUOUS ||
+             t->type != state)
+    {
+        targets.push_back({t, r});
+    }
+}
+
+bool DCRefiner::dependsOnChanges(const std::shared_ptr<Tape>& tape) const
+{
+    if (changed.empty())
+    {
+        return false;
+    }
+
+    bool found = changed.count(tape->root());
+    auto fn = [&](Opcode::Opcode op, Clause::Id id,
+                  Clause::Id a, Clause::Id b)
+    {
+        (void)op;
+        (void)id;
+        found |= changed.count(a) || changed.count(b);
+    };
+    tape->rwalk(fn);
+    return found;
+}
+
+}   // namespace Kernel
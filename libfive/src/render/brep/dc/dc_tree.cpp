@@ -23,7 +23,9 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 #include "libfive/render/brep/dc/marching.hpp"
 #include "libfive/render/brep/dc/dc_tree.hpp"
 #include "libfive/render/brep/dc/dc_neighbors.hpp"
+#include "libfive/render/brep/edge_search.hpp"
 #include "libfive/render/brep/region.hpp"
+#include "libfive/render/brep/util.hpp"
 #include "libfive/render/axes.hpp"
 
 #include "../xtree.cpp"
@@ -118,12 +120,13 @@ void DCTree<N>::evalLeaf(XTreeEvaluator* eval,
                         Tape::Handle tape,
                         const Region<N>& region,
                         Pool& object_pool,
-                        const DCNeighbors<N>& neighbors)
+                        const DCNeighbors<N>& neighbors,
+                        double edge_tolerance)
 {
     // Track how many corners have to be evaluated here
     // (if they can be looked up from a neighbor, they don't have
     //  to be evaluated here, which can save time)
-    size_t count = 0;
+    unsigned count = 0;
 
     // Remap from a value in the range [0, count) to a corner index
     // in the range [0, 1 <<N).
@@ -140,7 +143,6 @@ void DCTree<N>::evalLeaf(XTreeEvaluator* eval,
         if (c == Interval::UNKNOWN)
         {
             pos.col(count) = region.corner3f(i);
-            eval->array.set(pos.col(count), count);
             corner_indices[count++] = i;
         }
         else
@@ -149,7 +151,241 @@ void DCTree<N>::evalLeaf(XTreeEvaluator* eval,
         }
     }
 
-    // Evaluate the region's corners and check their states
+    std::array<Interval::State, 1 << N> states;
+    evalCorners(eval, tape, pos, count, states.data());
+    for (unsigned i=0; i < count; ++i)
+    {
+        corners[corner_indices[i]] = states[i];
+    }
+
+    buildLeaf(eval, tape, region, object_pool, neighbors, corners,
+              edge_tolerance);
+}
+
+template <unsigned N>
+void DCTree<N>::evalLeaves(
+        XTreeEvaluator* eval,
+        Tape::Handle tape,
+        const Region<N>& region,
+        const std::array<Tape::Handle, 1 << N>& tapes,
+        const std::array<std::array<DCTree<N>*, 1 << N>, 1 << N>& leaves,
+        Pool& object_pool,
+        const DCNeighbors<N>& neighbors,
+        double edge_tolerance)
+{
+    // The leaves' corners lie on a 5^N lattice spanning this cell, where
+    // each lattice point is indexed by a base-5 number (with one digit
+    // per axis, selecting one of the five positions along that axis).
+    constexpr unsigned LATTICE_SIZE = ipow(5, N);
+    static_assert(LATTICE_SIZE <= ArrayEvaluator::N, "Potential overflow");
+
+    auto lattice = [](unsigned child, unsigned leaf, unsigned corner) {
+        unsigned out = 0;
+        for (unsigned axis=N; axis-- > 0;)
+        {
+            out = out * 5 + ((child >> axis) & 1) * 2 +
+                  ((leaf >> axis) & 1) + ((corner >> axis) & 1);
+        }
+        return out;
+    };
+
+    // Only ambiguous children have leaves to build
+    const auto rs = region.subdivide();
+    std::array<std::array<Region<N>, 1 << N>, 1 << N> leaf_regions;
+    std::array<DCNeighbors<N>, 1 << N> child_neighbors;
+    for (unsigned i=0; i < this->children.size(); ++i)
+    {
+        if (leaves[i][0] != nullptr)
+        {
+            leaf_regions[i] = rs[i].subdivide();
+            child_neighbors[i] = neighbors.push(i, this->children);
+        }
+    }
+
+    // Pull in any lattice points that are already known by neighbors
+    // outside of this cell, so that shared corners stay consistent.
+    std::array<Interval::State, LATTICE_SIZE> states;
+    std::fill(states.begin(), states.end(), Interval::UNKNOWN);
+    for (unsigned i=0; i < this->children.size(); ++i)
+    {
+        if (leaves[i][0] == nullptr)
+        {
+            continue;
+        }
+        for (unsigned j=0; j < this->children.size(); ++j)
+        {
+            const auto ns = child_neighbors[i].push(
+                    j, leaves[i][j]->parent->children);
+            for (unsigned k=0; k < this->children.size(); ++k)
+            {
+                auto& s = states[lattice(i, j, k)];
+                if (s == Interval::UNKNOWN)
+                {
+                    s = ns.check(k);
+                }
+            }
+        }
+    }
+
+    // Pack the rest of the lattice points that are used by some leaf
+    // into a single evaluator batch
+    unsigned count = 0;
+    std::array<unsigned, LATTICE_SIZE> lattice_indices;
+    Eigen::Matrix<float, 3, LATTICE_SIZE> pos;
+    for (unsigned i=0; i < this->children.size(); ++i)
+    {
+        if (leaves[i][0] == nullptr)
+        {
+            continue;
+        }
+        for (unsigned j=0; j < this->children.size(); ++j)
+        {
+            for (unsigned k=0; k < this->children.size(); ++k)
+            {
+                const auto index = lattice(i, j, k);
+                if (states[index] == Interval::UNKNOWN)
+                {
+                    // Mark the point as queued, so it's only packed once
+                    states[index] = Interval::AMBIGUOUS;
+                    pos.col(count) = leaf_regions[i][j].corner3f(k);
+                    lattice_indices[count++] = index;
+                }
+            }
+        }
+    }
+
+    std::array<Interval::State, LATTICE_SIZE> out;
+    evalCorners(eval, tape, pos, count, out.data());
+    for (unsigned i=0; i < count; ++i)
+    {
+        states[lattice_indices[i]] = out[i];
+    }
+
+    // Within a child, edges are indexed by their lower point on the
+    // child's 3^N lattice and their axis, so that an edge shared between
+    // leaves maps to a single slot.  There are at most N * 2 * 3^(N - 1)
+    // edges with a sign change, since each lattice line has two edges.
+    constexpr unsigned EDGE_SLOTS = ipow(3, N) * N;
+    constexpr unsigned MAX_EDGES = N * 2 * ipow(3, N - 1);
+    static_assert(MAX_EDGES <= ArrayEvaluator::N / 2, "Potential overflow");
+
+    for (unsigned i=0; i < this->children.size(); ++i)
+    {
+        if (leaves[i][0] == nullptr)
+        {
+            continue;
+        }
+
+        std::array<std::array<Interval::State, 1 << N>, 1 << N> corners;
+        for (unsigned j=0; j < this->children.size(); ++j)
+        {
+            for (unsigned k=0; k < this->children.size(); ++k)
+            {
+                corners[j][k] = states[lattice(i, j, k)];
+            }
+        }
+
+        // Calls fn(leaf, inside, outside, slot) for every edge of every
+        // leaf that has a sign change and can't be copied from a neighbor
+        // outside of this child.
+        auto forEachEdge = [&](std::function<void(unsigned, unsigned,
+                                                  unsigned, unsigned)> fn)
+        {
+            for (unsigned j=0; j < this->children.size(); ++j)
+            {
+                const auto ns = child_neighbors[i].push(
+                        j, leaves[i][j]->parent->children);
+                for (unsigned a=0; a < this->children.size(); ++a)
+                {
+                    for (unsigned axis=0; axis < N; ++axis)
+                    {
+                        const unsigned b = a | (1 << axis);
+                        if (a == b)
+                        {
+                            continue;
+                        }
+                        unsigned inside = a;
+                        unsigned outside = b;
+                        if (corners[j][a] == Interval::EMPTY)
+                        {
+                            std::swap(inside, outside);
+                        }
+                        if (corners[j][inside] != Interval::FILLED ||
+                            corners[j][outside] != Interval::EMPTY)
+                        {
+                            continue;
+                        }
+                        if (ns.check(inside, outside).get() != nullptr)
+                        {
+                            continue;
+                        }
+
+                        unsigned lower = 0;
+                        for (unsigned d=N; d-- > 0;)
+                        {
+                            lower = lower * 3 + ((j >> d) & 1) +
+                                                ((a >> d) & 1);
+                        }
+                        fn(j, inside, outside, lower * N + axis);
+                    }
+                }
+            }
+        };
+
+        // Collect each distinct edge once, then search them all together
+        std::array<int, EDGE_SLOTS> slots;
+        std::fill(slots.begin(), slots.end(), -1);
+        std::array<std::pair<Vec, Vec>, MAX_EDGES> targets;
+        unsigned target_count = 0;
+        forEachEdge([&](unsigned j, unsigned inside, unsigned outside,
+                        unsigned slot)
+        {
+            if (slots[slot] == -1)
+            {
+                assert(target_count < MAX_EDGES);
+                slots[slot] = target_count;
+                targets[target_count++] = {leaf_regions[i][j].corner(inside),
+                                           leaf_regions[i][j].corner(outside)};
+            }
+        });
+        searchEdges<N>(eval, tapes[i], region, targets.data(), target_count,
+                       edge_tolerance);
+
+        std::array<SearchedEdges, 1 << N> searched;
+        forEachEdge([&](unsigned j, unsigned inside, unsigned outside,
+                        unsigned slot)
+        {
+            const auto e = MarchingTable<N>::e(inside)[outside];
+            searched[j].targets[e] = targets[slots[slot]];
+            searched[j].mask |= (1 << e);
+        });
+
+        // Build each leaf in turn, finding neighbors at the last minute so
+        // that previously-built siblings can share their intersections.
+        for (unsigned j=0; j < this->children.size(); ++j)
+        {
+            leaves[i][j]->buildLeaf(
+                    eval, tapes[i], leaf_regions[i][j], object_pool,
+                    child_neighbors[i].push(j, leaves[i][j]->parent->children),
+                    corners[j], edge_tolerance, &searched[j]);
+        }
+    }
+}
+
+template <unsigned N>
+template <int C>
+void DCTree<N>::evalCorners(XTreeEvaluator* eval,
+                            Tape::Handle tape,
+                            const Eigen::Matrix<float, 3, C>& pos,
+                            unsigned count,
+                            Interval::State* corners)
+{
+    for (unsigned i=0; i < count; ++i)
+    {
+        eval->array.set(pos.col(i), i);
+    }
+
+    // Evaluate the corners and check their states
     // We handle evaluation in three phases:
     // 1)  Evaluate the distance field at corners, mark < 0 or > 0
     //     as filled or empty.
@@ -169,12 +405,12 @@ void DCTree<N>::evalLeaf(XTreeEvaluator* eval,
 
     // This is a count of how many points there are that == 0
     // but are unambiguous; unambig_remap[z] returns the index
-    // into the corner_indices array for a particular unambiguous zero.
-    uint8_t unambiguous_zeros = 0;
-    std::array<int, 1 << N> unambig_remap;
+    // into the pos array for a particular unambiguous zero.
+    unsigned unambiguous_zeros = 0;
+    std::array<int, C> unambig_remap;
 
     // This is phase 1, as described above
-    for (uint8_t i=0; i < count; ++i)
+    for (unsigned i=0; i < count; ++i)
     {
         // The Eigen evaluator occasionally disagrees with the
         // deriv (single-point) evaluator, because it has SSE
@@ -190,12 +426,12 @@ void DCTree<N>::evalLeaf(XTreeEvaluator* eval,
         // Handle inside, outside, and (non-ambiguous) on-boundary
         if (vs(i) > 0 || std::isnan(vs(i)))
         {
-            corners[corner_indices[i]] = Interval::EMPTY;
+            corners[i] = Interval::EMPTY;
             ambig(i) = false;
         }
         else if (vs(i) < 0)
         {
-            corners[corner_indices[i]] = Interval::FILLED;
+            corners[i] = Interval::FILLED;
             ambig(i) = false;
         }
         else if (!ambig(i))
@@ -221,29 +457,40 @@ void DCTree<N>::evalLeaf(XTreeEvaluator* eval,
             if ((ds.col(i).head<3>().abs() < 1e-6f).any())
             {
                 ds.col(i) = eval->deriv.deriv(pos.col(unambig_remap[i]));
-                corners[corner_indices[unambig_remap[i]]] =
+                corners[unambig_remap[i]] =
                     (ds.col(i).template head<3>() != 0).any()
                     ? Interval::FILLED : Interval::EMPTY;
             }
             else
             {
-                corners[corner_indices[unambig_remap[i]]] = Interval::FILLED;
+                corners[unambig_remap[i]] = Interval::FILLED;
             }
         }
     }
 
     // Phase 3: One last pass for handling ambiguous corners
-    for (uint8_t i=0; i < count; ++i)
+    for (unsigned i=0; i < count; ++i)
     {
         if (ambig(i))
         {
-            corners[corner_indices[i]] =
+            corners[i] =
                 eval->feature.isInside(pos.col(i), tape)
                     ? Interval::FILLED
                     : Interval::EMPTY;
         }
     }
+}
 
+template <unsigned N>
+void DCTree<N>::buildLeaf(XTreeEvaluator* eval,
+                          Tape::Handle tape,
+                          const Region<N>& region,
+                          Pool& object_pool,
+                          const DCNeighbors<N>& neighbors,
+                          const std::array<Interval::State, 1 << N>& corners,
+                          double edge_tolerance,
+                          const SearchedEdges* searched)
+{
     bool all_full = true;
     bool all_empty = true;
 
@@ -303,6 +550,12 @@ void DCTree<N>::evalLeaf(XTreeEvaluator* eval,
             // Inside-outside pairs, with eval_count valid pairs
             std::array<std::pair<Vec, Vec>, _edges(N)> targets;
 
+            // Pairs that weren't searched ahead of time, and their
+            // indices in the targets array
+            unsigned search_count = 0;
+            std::array<std::pair<Vec, Vec>, _edges(N)> search_targets;
+            std::array<unsigned, _edges(N)> search_indices;
+
             // Edge indices (as found with mt->e[a][b]) for edges under
             // evaluation, with eval_count valid values.
             std::array<size_t, _edges(N)> eval_edges;
@@ -334,11 +587,22 @@ void DCTree<N>::evalLeaf(XTreeEvaluator* eval,
                 }
                 else
                 {
-                    // Store inside / outside in targets array, and the edge
-                    // index in the eval_edges array.
-                    targets[eval_count] = {region.corner(c.first),
-                                           region.corner(c.second)};
-                    eval_edges[eval_count] = edges[edge_count];
+                    // Store inside / outside in targets array (narrowed
+                    // already, if it was searched ahead of time), and the
+                    // edge index in the eval_edges array.
+                    const auto e = edges[edge_count];
+                    if (searched && (searched->mask & (1 << e)))
+                    {
+                        targets[eval_count] = searched->targets[e];
+                    }
+                    else
+                    {
+                        targets[eval_count] = {region.corner(c.first),
+                                               region.corner(c.second)};
+                        search_targets[search_count] = targets[eval_count];
+                        search_indices[search_count++] = eval_count;
+                    }
+                    eval_edges[eval_count] = e;
 
                     assert(eval_edges[eval_count] < this->leaf->intersections.size());
                     eval_count++;
@@ -347,78 +611,13 @@ void DCTree<N>::evalLeaf(XTreeEvaluator* eval,
                 assert(edges[edge_count] < this->leaf->intersections.size());
             }
 
-            // Next, we search over the target edges, doing an
-            // N-fold reduction at each stage to home in on the
-            // exact intersection position
-            constexpr int SEARCH_COUNT = 4;
-            constexpr int POINTS_PER_SEARCH = 16;
-            static_assert(
-                    _edges(N) * POINTS_PER_SEARCH <= ArrayEvaluator::N,
-                    "Potential overflow");
-
-            // Multi-stage binary search for intersection
-            for (int s=0; s < SEARCH_COUNT; ++s)
+            // Next, we search along all of the remaining target edges at
+            // once, narrowing each one to a tight [inside, outside] pair
+            searchEdges<N>(eval, tape, region, search_targets.data(),
+                           search_count, edge_tolerance);
+            for (unsigned i=0; i < search_count; ++i)
             {
-                // Load search points into evaluator
-                Eigen::Array<double, N, POINTS_PER_SEARCH * _edges(N)> ps;
-                for (unsigned e=0; e < eval_count; ++e)
-                {
-                    for (int j=0; j < POINTS_PER_SEARCH; ++j)
-                    {
-                        const double frac = j / (POINTS_PER_SEARCH - 1.0);
-                        const unsigned i = j + e*POINTS_PER_SEARCH;
-                        ps.col(i) = (targets[e].first * (1 - frac)) +
-                                    (targets[e].second * frac);
-                        set(ps.col(i), i);
-                    }
-                }
-
-                // Evaluate, then search for the first outside point
-                // and adjust inside / outside to their new positions
-                if (eval_count)
-                {
-                    auto out = eval->array.values(
-                            POINTS_PER_SEARCH * eval_count, tape);
-
-                    for (unsigned e=0; e < eval_count; ++e)
-                    {
-                        // Skip one point, because the very first point is
-                        // already known to be inside the shape (but
-                        // sometimes, due to numerical issues, it registers
-                        // as outside!)
-                        for (unsigned j=1; j < POINTS_PER_SEARCH; ++j)
-                        {
-                            const unsigned i = j + e*POINTS_PER_SEARCH;
-                            if (out[i] > 0)
-                            {
-                                assert(i > 0);
-                                targets[e] = {ps.col(i - 1), ps.col(i)};
-                                break;
-                            }
-                            else if (out[i] == 0)
-                            {
-                                Eigen::Vector3d pos;
-                                pos << ps.col(i), region.perp;
-                                if (!eval->feature.isInside(
-                                            pos.template cast<float>(), tape))
-                                {
-                                    assert(i > 0);
-                                    targets[e] = {ps.col(i - 1), ps.col(i)};
-                                    break;
-                                }
-                            }
-                            // Special-case for final point in the search,
-                            // working around numerical issues where
-                            // different evaluators disagree with whether
-                            // points are inside or outside.
-                            else if (j == POINTS_PER_SEARCH - 1)
-                            {
-                                targets[e] = {ps.col(i - 1), ps.col(i)};
-                                break;
-                            }
-                        }
-                    }
-                }
+                targets[search_indices[i]] = search_targets[i];
             }
 
             // Now, we evaluate the distance field (value + derivatives) at
@@ -1013,4 +1212,58 @@ void DCTree<N>::releaseTo(Pool& object_pool) {
     object_pool.put(this);
 }
 
+template <unsigned N>
+void DCTree<N>::resetIndices() const
+{
+    if (this->isBranch()) {
+        for (auto& c : this->children) {
+            c.load()->resetIndices();
+        }
+    } else if (this->leaf != nullptr) {
+        std::fill(this->leaf->index.begin(), this->leaf->index.end(), 0);
+    }
+}
+
+template <unsigned N>
+DCTree<N>* DCTree<N>::copySurface(Pool& object_pool,
+                                  DCTree<N>* placeholder) const
+{
+    return copySurface(object_pool, placeholder, this->region, nullptr);
+}
+
+template <unsigned N>
+DCTree<N>* DCTree<N>::copySurface(Pool& object_pool,
+                                  DCTree<N>* placeholder,
+                                  const Region<N>& outer,
+                                  DCTree<N>* parent) const
+{
+    auto out = object_pool.get(parent, this->parent_index, this->region);
+    out->type = this->type;
+    out->pending.store(0);
+
+    if (this->leaf != nullptr)
+    {
+        out->leaf = object_pool.next().get();
+        out->leaf->level = this->leaf->level;
+        out->leaf->verts = this->leaf->verts;
+        out->leaf->rank = this->leaf->rank;
+        out->leaf->corner_mask = this->leaf->corner_mask;
+        out->leaf->vertex_count = this->leaf->vertex_count;
+        out->leaf->manifold = this->leaf->manifold;
+    }
+
+    if (this->isBranch())
+    {
+        for (unsigned i=0; i < this->children.size(); ++i)
+        {
+            auto c = this->childTouches(i, outer)
+                ? this->children[i].load(std::memory_order_relaxed)
+                      ->copySurface(object_pool, placeholder, outer, out)
+                : placeholder;
+            out->children[i].store(c, std::memory_order_relaxed);
+        }
+    }
+    return out;
+}
+
 }   // namespace Kernel
@@ -11,4 +11,8 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 
 namespace Kernel {
 template class XTree<3, DCTree<3>, DCLeaf<3>>;
+template void XTree<3, DCTree<3>, DCLeaf<3>>::releaseInterior(
+        DCTree<3>::Pool&, DCTree<3>*);
+template void XTree<3, DCTree<3>, DCLeaf<3>>::releaseSurface(
+        DCTree<3>::Pool&);
 }   // namespace Kernel
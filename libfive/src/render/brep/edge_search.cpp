@@ -0,0 +1,199 @@
+/*
+libfive: a CAD kernel for modeling with implicit functions
+Copyright (C) 2019  Matt Keeter
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+#include <array>
+#include <cmath>
+
+#include "libfive/render/brep/edge_search.hpp"
+#include "libfive/render/brep/region.hpp"
+#include "libfive/eval/eval_xtree.hpp"
+
+namespace Kernel {
+
+template <unsigned N>
+void searchEdges(XTreeEvaluator* eval, std::shared_ptr<Tape> tape,
+                 const Region<N>& region,
+                 std::pair<Eigen::Matrix<double, N, 1>,
+                           Eigen::Matrix<double, N, 1>>* targets,
+                 unsigned count, double tolerance)
+{
+    using Vec = Eigen::Matrix<double, N, 1>;
+
+    constexpr unsigned MAX_EDGES = ArrayEvaluator::N / 2;
+    assert(count <= MAX_EDGES);
+    assert(tape.get() != nullptr);
+
+    // Bisection needs about 17 steps to reach the default tolerance,
+    // and the Newton steps should need far fewer, so this is a backstop
+    // against pathological fields rather than a real limit.
+    constexpr unsigned MAX_STEPS = 64;
+
+    // Each edge is parameterized as inside + t * dir, with t in [0, 1].
+    // We track a bracket [lo, hi] (with lo inside and hi outside), the
+    // values at either end (used for false position), and the position,
+    // value, and directional derivative of the most recent point.
+    std::array<Vec, MAX_EDGES> dir;
+    std::array<double, MAX_EDGES> lo, hi, f_lo, f_hi;
+    std::array<double, MAX_EDGES> t_last, f_last, d_last;
+
+    // Bracket widths before the last two steps, used to force bisection
+    // when two steps in a row haven't halved the bracket.
+    std::array<double, MAX_EDGES> width_prev, width_prev2;
+
+    // +1 if the last step moved hi, -1 if it moved lo, 0 otherwise
+    // (used for the Illinois modification to false position)
+    std::array<int, MAX_EDGES> side;
+
+    // Edges still being searched, mapped from evaluator slots
+    std::array<unsigned, MAX_EDGES> active;
+    std::array<double, MAX_EDGES> t_next;
+
+    // Start by evaluating both ends of every edge
+    for (unsigned e=0; e < count; ++e)
+    {
+        dir[e] = targets[e].second - targets[e].first;
+        eval->array.set<N>(targets[e].first, region, 2 * e);
+        eval->array.set<N>(targets[e].second, region, 2 * e + 1);
+    }
+    if (count)
+    {
+        auto ds = eval->array.derivs(2 * count, tape);
+        for (unsigned e=0; e < count; ++e)
+        {
+            lo[e] = 0;
+            hi[e] = 1;
+
+            // The ends are known to be inside and outside, even if the
+            // evaluator disagrees (due to numerical issues), so clamp
+            // their values to be consistent with that.
+            const double a = ds(3, 2 * e);
+            const double b = ds(3, 2 * e + 1);
+            f_lo[e] = (a < 0) ? a : 0;
+            f_hi[e] = (b > 0) ? b : 0;
+
+            // Newton's method starts from whichever end is closer
+            const unsigned i = (fabs(a) < fabs(b)) ? 2 * e : 2 * e + 1;
+            t_last[e] = (i & 1) ? 1 : 0;
+            f_last[e] = ds(3, i);
+            d_last[e] = ds.col(i).template head<N>().matrix()
+                          .template cast<double>().dot(dir[e]);
+
+            width_prev[e] = width_prev2[e] = 2;
+            side[e] = 0;
+        }
+    }
+
+    for (unsigned step=0; step < MAX_STEPS; ++step)
+    {
+        unsigned active_count = 0;
+        for (unsigned e=0; e < count; ++e)
+        {
+            const double width = hi[e] - lo[e];
+            if (!(width > tolerance))
+            {
+                continue;
+            }
+
+            // Try a Newton step from the most recent point, then false
+            // position, then bisection if both of those leave the bracket.
+            double t = t_last[e] - f_last[e] / d_last[e];
+            if (!(t > lo[e] && t < hi[e]))
+            {
+                t = (lo[e] * f_hi[e] - hi[e] * f_lo[e]) /
+                    (f_hi[e] - f_lo[e]);
+            }
+            if (!(t > lo[e] && t < hi[e]) || width > width_prev2[e] / 2)
+            {
+                t = (lo[e] + hi[e]) / 2;
+            }
+
+            // Once we're close to the root, we step just past it, so that
+            // the bracket closes in from both sides rather than creeping
+            // towards the root from one side.
+            if (fabs(t - t_last[e]) < tolerance / 2)
+            {
+                t = t_last[e] + ((t_last[e] == lo[e]) ? tolerance / 2
+                                                      : -tolerance / 2);
+                if (!(t > lo[e] && t < hi[e]))
+                {
+                    t = (lo[e] + hi[e]) / 2;
+                }
+            }
+
+            t_next[e] = t;
+            eval->array.set<N>(targets[e].first + t * dir[e], region,
+                               active_count);
+            active[active_count++] = e;
+        }
+
+        if (active_count == 0)
+        {
+            break;
+        }
+
+        auto ds = eval->array.derivs(active_count, tape);
+        for (unsigned i=0; i < active_count; ++i)
+        {
+            const unsigned e = active[i];
+            const double t = t_next[e];
+            const double v = ds(3, i);
+
+            // Points exactly on the surface are checked more carefully,
+            // as in the sampled searches that this replaced.
+            const bool outside = (v > 0) ||
+                (v == 0 && !eval->feature.isInside<N>(
+                    targets[e].first + t * dir[e], region, tape));
+
+            width_prev2[e] = width_prev[e];
+            width_prev[e] = hi[e] - lo[e];
+            if (outside)
+            {
+                hi[e] = t;
+                f_hi[e] = (v > 0) ? v : 0;
+                if (side[e] == 1)
+                {
+                    f_lo[e] /= 2;
+                }
+                side[e] = 1;
+            }
+            else
+            {
+                lo[e] = t;
+                f_lo[e] = (v < 0) ? v : 0;
+                if (side[e] == -1)
+                {
+                    f_hi[e] /= 2;
+                }
+                side[e] = -1;
+            }
+
+            t_last[e] = t;
+            f_last[e] = v;
+            d_last[e] = ds.col(i).template head<N>().matrix()
+                          .template cast<double>().dot(dir[e]);
+        }
+    }
+
+    for (unsigned e=0; e < count; ++e)
+    {
+        const Vec start = targets[e].first;
+        targets[e] = {start + lo[e] * dir[e], start + hi[e] * dir[e]};
+    }
+}
+
+// Explicit template instantiation
+template void searchEdges<2>(
+        XTreeEvaluator*, std::shared_ptr<Tape>, const Region<2>&,
+        std::pair<Eigen::Matrix<double, 2, 1>,
+                  Eigen::Matrix<double, 2, 1>>*, unsigned, double);
+template void searchEdges<3>(
+        XTreeEvaluator*, std::shared_ptr<Tape>, const Region<3>&,
+        std::pair<Eigen::Matrix<double, 3, 1>,
+                  Eigen::Matrix<double, 3, 1>>*, unsigned, double);
+
+}   // namespace Kernel
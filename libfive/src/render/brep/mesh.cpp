@@ -7,8 +7,15 @@ This Source Code Form is subject to the terms of the Mozilla Public
 License, v. 2.0. If a copy of the MPL was not distributed with this file,
 You can obtain one at http://mozilla.org/MPL/2.0/.
 */
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <future>
 #include <numeric>
 #include <fstream>
+#include <map>
+#include <thread>
+#include <unordered_map>
 #include <boost/algorithm/string/predicate.hpp>
 
 #include "libfive/eval/eval_xtree.hpp"
@@ -38,10 +45,12 @@ namespace Kernel {
 std::unique_ptr<Mesh> Mesh::render(const Tree t, const Region<3>& r,
                                    const BRepSettings& settings)
 {
+    // Flatten the tree once, then fork the Deck for the other workers
+    auto deck = std::make_shared<Deck>(t);
     std::vector<XTreeEvaluator, Eigen::aligned_allocator<XTreeEvaluator>> es;
     es.reserve(settings.workers);
     for (unsigned i=0; i < settings.workers; ++i) {
-        es.emplace_back(XTreeEvaluator(t));
+        es.emplace_back(XTreeEvaluator(i ? deck->fork() : deck));
     }
 
     return render(es.data(), r, settings);
@@ -52,7 +61,50 @@ std::unique_ptr<Mesh> Mesh::render(
         const Region<3>& r, const BRepSettings& settings)
 {
     std::unique_ptr<Mesh> out;
-    if (settings.alg == DUAL_CONTOURING)
+    if (settings.alg == DUAL_CONTOURING && settings.pipelined &&
+        !LIBFIVE_TRIANGLE_FAN_MESHING)
+    {
+        if (settings.progress_handler) {
+            // Pool::build (with meshing), t.reset
+            settings.progress_handler->start({1, 1});
+        }
+
+        std::atomic<uint32_t> global_index(1);
+        std::vector<PerThreadBRep<3>> breps;
+        breps.reserve(settings.workers);
+        std::vector<DCMesher> ms;
+        ms.reserve(settings.workers);
+        for (unsigned i=0; i < settings.workers; ++i) {
+            breps.emplace_back(PerThreadBRep<3>(global_index));
+            ms.emplace_back(DCMesher(breps.back()));
+        }
+
+        // Mesh each branch as soon as it's finished, then release the
+        // cells that only it could see.  The root is freed all at once
+        // by t.reset below, so there's no point in releasing its cells.
+        auto placeholder = DCTree<3>::empty();
+        auto t = DCPool<3>::build(es, r, settings,
+            [&ms, &placeholder](DCTree<3>* tree, unsigned worker,
+                                DCTree<3>::Pool& pool)
+            {
+                Dual<3>::work(tree, ms[worker]);
+                if (tree->parent) {
+                    tree->releaseInterior(pool, placeholder.get());
+                }
+            });
+
+        if (settings.cancel.load() || t.get() == nullptr) {
+            if (settings.progress_handler) {
+                settings.progress_handler->finish();
+            }
+            return nullptr;
+        }
+
+        out.reset(new Mesh);
+        out->collect(breps);
+        t.reset(settings);
+    }
+    else if (settings.alg == DUAL_CONTOURING)
     {
         if (settings.progress_handler) {
             // Pool::build, Dual::walk, t.reset
@@ -98,7 +150,8 @@ std::unique_ptr<Mesh> Mesh::render(
 
         out = Dual<3>::walk_<SimplexMesher>(t, settings,
                 [&](PerThreadBRep<3>& brep, int i) {
-                    return SimplexMesher(brep, &es[i]);
+                    return SimplexMesher(brep, &es[i],
+                                         settings.edge_tolerance);
                 });
         t.reset(settings);
     }
@@ -121,7 +174,8 @@ std::unique_ptr<Mesh> Mesh::render(
 
         out = Dual<3>::walk_<HybridMesher>(t, settings,
                 [&](PerThreadBRep<3>& brep, int i) {
-                    return HybridMesher(brep, &es[i]);
+                    return HybridMesher(brep, &es[i],
+                                        settings.edge_tolerance);
                 });
         t.reset(settings);
     }
@@ -144,66 +198,427 @@ void Mesh::line(const Eigen::Vector3f& a, const Eigen::Vector3f& b)
 
 ////////////////////////////////////////////////////////////////////////////////
 
-bool Mesh::saveSTL(const std::string& filename,
-                   const std::list<const Mesh*>& meshes)
+/*  Number of triangles (or vertices) encoded by one thread at a time */
+static const size_t SAVE_BLOCK_SIZE = 1 << 16;
+
+/*
+ *  Encodes items [0, count) into blocks of SAVE_BLOCK_SIZE items, with
+ *  each item taking up stride bytes (written by encode(i, ptr)).
+ *
+ *  Blocks are encoded in parallel by up to workers threads, then written
+ *  to the file in order as single large writes.
+ */
+template <typename F>
+static void saveBlocks(std::ofstream& file, size_t count, size_t stride,
+                       unsigned workers, F encode)
 {
-    if (!boost::algorithm::iends_with(filename, ".stl"))
+    std::vector<std::vector<char>> buffers(workers);
+    for (size_t start=0; start < count; start += SAVE_BLOCK_SIZE * workers)
     {
-        std::cerr << "Mesh::saveSTL: filename \"" << filename
-                  << "\" does not end in .stl" << std::endl;
+        std::vector<std::future<void>> futures;
+        for (unsigned w=0; w < workers; ++w)
+        {
+            const size_t lo = start + w * SAVE_BLOCK_SIZE;
+            if (lo >= count)
+            {
+                break;
+            }
+            const size_t hi = std::min(count, lo + SAVE_BLOCK_SIZE);
+            futures.push_back(std::async(std::launch::async,
+                [&buffers, &encode, w, lo, hi, stride]() {
+                    auto& buf = buffers[w];
+                    buf.resize((hi - lo) * stride);
+                    for (size_t i=lo; i < hi; ++i)
+                    {
+                        encode(i, &buf[(i - lo) * stride]);
+                    }
+                }));
+        }
+
+        // Write blocks in order, while later blocks are still encoding
+        for (unsigned w=0; w < futures.size(); ++w)
+        {
+            futures[w].wait();
+            file.write(buffers[w].data(), buffers[w].size());
+        }
+    }
+}
+
+/*
+ *  Opens a file for binary writing, warning if the extension doesn't match
+ */
+static bool openFile(std::ofstream& file, const std::string& filename,
+                     const std::string& ext, const std::string& caller)
+{
+    if (!boost::algorithm::iends_with(filename, ext))
+    {
+        std::cerr << caller << ": filename \"" << filename
+                  << "\" does not end in " << ext << std::endl;
     }
-    std::ofstream file;
     file.open(filename, std::ios::out | std::ios::binary);
     if (!file.is_open())
     {
-        std::cout << "Mesh::saveSTL: could not open " << filename
+        std::cout << caller << ": could not open " << filename
                   << std::endl;
         return false;
     }
+    return true;
+}
 
-    // File header (giving human-readable info about file type)
+static unsigned saveWorkers(unsigned workers)
+{
+    return workers ? workers
+                   : std::max(1u, std::thread::hardware_concurrency());
+}
+
+/*  Each STL triangle is a normal, three vertices, and an attribute short */
+static const size_t STL_TRIANGLE_SIZE = 12 * sizeof(float) + sizeof(uint16_t);
+
+/*
+ *  Writes the 80-byte STL header and the triangle count
+ */
+static void writeSTLHeader(std::ofstream& file, uint32_t num)
+{
+    // File header (giving human-readable info about file type),
+    // padded out to 80 bytes
     std::string header = "This is a binary STL exported from libfive.";
+    header.resize(80, ' ');
     file.write(header.c_str(), header.length());
 
-    // Pad the rest of the header to 80 bytes
-    for (int i=header.length(); i < 80; ++i)
+    // Write the triangle count to the file
+    file.write(reinterpret_cast<char*>(&num), sizeof(num));
+}
+
+/*
+ *  Encodes a single triangle into STL_TRIANGLE_SIZE bytes at out
+ */
+static void encodeSTLTriangle(const Eigen::Vector3f& a,
+                              const Eigen::Vector3f& b,
+                              const Eigen::Vector3f& c, char* out)
+{
+    // Degenerate triangles get a zero normal
+    Eigen::Vector3f norm = (b - a).cross(c - a);
+    const float len = norm.norm();
+    if (len > 0)
     {
-        file.put(' ');
+        norm /= len;
     }
 
-    // Write the triangle count to the file
+    float fs[12];
+    for (unsigned j=0; j < 3; ++j)
+    {
+        fs[j] = norm[j];
+        fs[j + 3] = a[j];
+        fs[j + 6] = b[j];
+        fs[j + 9] = c[j];
+    }
+    memcpy(out, fs, sizeof(fs));
+
+    const uint16_t attrib = 0;
+    memcpy(out + sizeof(fs), &attrib, sizeof(attrib));
+}
+
+bool Mesh::saveSTL(const std::string& filename,
+                   const std::list<const Mesh*>& meshes,
+                   unsigned workers)
+{
+    std::ofstream file;
+    if (!openFile(file, filename, ".stl", "Mesh::saveSTL"))
+    {
+        return false;
+    }
+    workers = saveWorkers(workers);
+
     uint32_t num = std::accumulate(meshes.begin(), meshes.end(), (uint32_t)0,
             [](uint32_t i, const Mesh* m){ return i + m->branes.size(); });
-    file.write(reinterpret_cast<char*>(&num), sizeof(num));
+    writeSTLHeader(file, num);
 
     for (const auto& m : meshes)
     {
-        for (const auto& t : m->branes)
-        {
-            // Write out the normal vector for this face (all zeros)
-            float norm[3] = {0, 0, 0};
-            file.write(reinterpret_cast<char*>(&norm), sizeof(norm));
+        saveBlocks(file, m->branes.size(), STL_TRIANGLE_SIZE, workers,
+            [&m](size_t i, char* out) {
+                const auto& t = m->branes[i];
+                encodeSTLTriangle(m->verts[t[0]], m->verts[t[1]],
+                                  m->verts[t[2]], out);
+            });
+    }
 
-            // Iterate over vertices (which are indices into the verts list)
-            for (unsigned i=0; i < 3; ++i)
-            {
-                auto v = m->verts[t[i]];
-                float vert[3] = {v.x(), v.y(), v.z()};
-                file.write(reinterpret_cast<char*>(&vert), sizeof(vert));
-            }
+    return file.good();
+}
 
-            // Write out this face's attribute short
-            uint16_t attrib = 0;
-            file.write(reinterpret_cast<char*>(&attrib), sizeof(attrib));
+bool Mesh::saveSTL(const std::string& filename, unsigned workers) const
+{
+    return saveSTL(filename, {this}, workers);
+}
+
+bool Mesh::savePLY(const std::string& filename,
+                   const std::list<const Mesh*>& meshes,
+                   unsigned workers)
+{
+    std::ofstream file;
+    if (!openFile(file, filename, ".ply", "Mesh::savePLY"))
+    {
+        return false;
+    }
+    workers = saveWorkers(workers);
+
+    // The 0th vertex of each mesh is a marker, so it's skipped
+    size_t num_verts = 0;
+    size_t num_tris = 0;
+    for (const auto& m : meshes)
+    {
+        num_verts += m->verts.size() - 1;
+        num_tris += m->branes.size();
+    }
+
+    // PLY supports either endianness, so we write in native order
+    const uint16_t endian = 1;
+    const bool little = *reinterpret_cast<const uint8_t*>(&endian) == 1;
+
+    file << "ply\n"
+         << "format binary_" << (little ? "little" : "big")
+         << "_endian 1.0\n"
+         << "comment This is a binary PLY exported from libfive.\n"
+         << "element vertex " << num_verts << "\n"
+         << "property float x\n"
+         << "property float y\n"
+         << "property float z\n"
+         << "element face " << num_tris << "\n"
+         << "property list uchar uint vertex_indices\n"
+         << "end_header\n";
+
+    for (const auto& m : meshes)
+    {
+        saveBlocks(file, m->verts.size() - 1, 3 * sizeof(float), workers,
+            [&m](size_t i, char* out) {
+                const auto& v = m->verts[i + 1];
+                const float fs[3] = {v.x(), v.y(), v.z()};
+                memcpy(out, fs, sizeof(fs));
+            });
+    }
+
+    // Indices are shifted to skip each mesh's marker vertex, then
+    // offset by the number of vertices in preceding meshes
+    const size_t stride = sizeof(uint8_t) + 3 * sizeof(uint32_t);
+    uint32_t offset = 0;
+    for (const auto& m : meshes)
+    {
+        saveBlocks(file, m->branes.size(), stride, workers,
+            [&m, offset](size_t i, char* out) {
+                const auto& t = m->branes[i];
+                const uint8_t n = 3;
+                const uint32_t is[3] = {t[0] - 1 + offset,
+                                        t[1] - 1 + offset,
+                                        t[2] - 1 + offset};
+                memcpy(out, &n, sizeof(n));
+                memcpy(out + sizeof(n), is, sizeof(is));
+            });
+        offset += m->verts.size() - 1;
+    }
+
+    return file.good();
+}
+
+bool Mesh::savePLY(const std::string& filename, unsigned workers) const
+{
+    return savePLY(filename, {this}, workers);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*  Bricks are indexed by their (x, y, z) position in the grid of bricks */
+typedef std::array<int, 3> BrickIndex;
+
+/*
+ *  Meshes the dual cells that cross brick p's lower face on axis A and
+ *  its lower edge running along axis A, given the surface copies of p
+ *  and of the bricks below it.  Missing bricks (at the edge of the
+ *  region) are skipped, as the top-level boundary isn't meshed by
+ *  Mesh::render either.
+ */
+template <Axis::Axis A>
+static void meshSeams(const std::map<BrickIndex, DCTree<3>*>& shells,
+                      const BrickIndex& p, DCMesher& m)
+{
+    constexpr auto Q = Axis::Q(A);
+    constexpr auto R = Axis::R(A);
+
+    // Looks up the brick that is one step below p on each axis in mask
+    auto at = [&](uint8_t mask) -> const DCTree<3>* {
+        auto q = p;
+        for (unsigned i=0; i < 3; ++i) {
+            if (mask & (1 << i)) {
+                q[i]--;
+            }
         }
+        auto itr = shells.find(q);
+        return (itr == shells.end()) ? nullptr : itr->second;
+    };
+
+    if (auto t = at(A)) {
+        face3<DCTree<3>, DCMesher, A>({{t, at(0)}}, m);
     }
 
-    return true;
+    auto a = at(Q | R);
+    auto b = at(R);
+    auto c = at(Q);
+    if (a && b && c) {
+        edge3<DCTree<3>, DCMesher, A>({{a, b, c, at(0)}}, m);
+    }
+}
+
+/*
+ *  Removes the seam vertices belonging to a surface copy, which can no
+ *  longer be used by any later seams.
+ */
+static void forgetSeamVerts(
+        const DCTree<3>* t, const DCTree<3>* placeholder,
+        std::unordered_map<uint32_t, Eigen::Vector3f>& verts)
+{
+    if (t == placeholder) {
+        return;
+    }
+    else if (t->isBranch()) {
+        for (unsigned i=0; i < t->children.size(); ++i) {
+            forgetSeamVerts(t->child(i), placeholder, verts);
+        }
+    }
+    else if (t->leaf != nullptr) {
+        for (auto& i : t->leaf->index) {
+            if (i) {
+                verts.erase(i);
+            }
+        }
+    }
 }
 
-bool Mesh::saveSTL(const std::string& filename) const
+bool Mesh::renderTiled(const Tree t, const Region<3>& r,
+                       const BRepSettings& settings,
+                       const std::string& filename,
+                       unsigned brick_level)
 {
-    return saveSTL(filename, {this});
+    std::ofstream file;
+    if (!openFile(file, filename, ".stl", "Mesh::renderTiled"))
+    {
+        return false;
+    }
+    const auto workers = saveWorkers(settings.workers);
+
+    // The triangle count isn't known until the end, so it's patched in then
+    writeSTLHeader(file, 0);
+    uint32_t num = 0;
+
+    // If we stop early, remove the partial file, rather than leaving a
+    // truncated STL whose header claims it has no triangles.
+    auto fail = [&]() {
+        file.close();
+        std::remove(filename.c_str());
+        return false;
+    };
+
+    auto deck = std::make_shared<Deck>(t);
+    std::vector<XTreeEvaluator, Eigen::aligned_allocator<XTreeEvaluator>> es;
+    es.reserve(settings.workers);
+    for (unsigned i=0; i < settings.workers; ++i) {
+        es.emplace_back(XTreeEvaluator(i ? deck->fork() : deck));
+    }
+
+    // Bricks line up with the cells of the octree that render() would
+    // build, with brick_level of its levels in each brick.
+    const int level = r.withResolution(settings.min_feature).level;
+    const int depth = std::max(0, level - (int)brick_level);
+    const int n = 1 << depth;
+    const Region<3>::Pt size = (r.upper - r.lower) / n;
+
+    // Bricks share the caller's settings, apart from the cancel flag
+    // (which is checked between bricks) and the progress handler.
+    BRepSettings brick_settings;
+    brick_settings.copyFrom(settings);
+
+    // Surface copies of finished bricks, which are kept until every
+    // seam that they take part in has been meshed.
+    DCTree<3>::Pool shell_pool;
+    auto placeholder = DCTree<3>::empty();
+    std::map<BrickIndex, DCTree<3>*> shells;
+
+    // Seam vertices are numbered across the whole render, so that a
+    // vertex stays consistent as its cell takes part in several seams
+    std::atomic<uint32_t> seam_index(1);
+    PerThreadBRep<3> seam_brep(seam_index);
+    DCMesher seam_mesher(seam_brep);
+    std::unordered_map<uint32_t, Eigen::Vector3f> seam_verts;
+
+    for (int i=0; i < n; ++i) {
+        for (int j=0; j < n; ++j) {
+            for (int k=0; k < n; ++k) {
+                if (settings.cancel.load()) {
+                    return fail();
+                }
+
+                const BrickIndex p = {{i, j, k}};
+                const Region<3>::Pt lower =
+                    r.lower + size * Region<3>::Pt(i, j, k);
+                const Region<3>::Pt upper =
+                    r.lower + size * Region<3>::Pt(i + 1, j + 1, k + 1);
+
+                auto tree = DCPool<3>::build(
+                        es.data(),
+                        Region<3>(lower, upper).withLevel(level - depth),
+                        brick_settings);
+                if (tree.get() == nullptr) {
+                    return fail();
+                }
+
+                // Mesh the inside of the brick and stream it out
+                auto m = Dual<3>::walk<DCMesher>(tree, brick_settings);
+                saveBlocks(file, m->branes.size(), STL_TRIANGLE_SIZE, workers,
+                    [&m](size_t a, char* out) {
+                        const auto& b = m->branes[a];
+                        encodeSTLTriangle(m->verts[b[0]], m->verts[b[1]],
+                                          m->verts[b[2]], out);
+                    });
+                num += m->branes.size();
+                m.reset();
+
+                shells[p] = tree->copySurface(shell_pool, placeholder.get());
+                tree.reset(brick_settings);
+
+                // Mesh the seams between this brick and the ones below it
+                meshSeams<Axis::X>(shells, p, seam_mesher);
+                meshSeams<Axis::Y>(shells, p, seam_mesher);
+                meshSeams<Axis::Z>(shells, p, seam_mesher);
+
+                for (unsigned v=0; v < seam_brep.verts.size(); ++v) {
+                    seam_verts[seam_brep.indices[v]] = seam_brep.verts[v];
+                }
+                saveBlocks(file, seam_brep.branes.size(), STL_TRIANGLE_SIZE,
+                    workers, [&](size_t a, char* out) {
+                        const auto& b = seam_brep.branes[a];
+                        encodeSTLTriangle(seam_verts.at(b[0]),
+                                          seam_verts.at(b[1]),
+                                          seam_verts.at(b[2]), out);
+                    });
+                num += seam_brep.branes.size();
+                seam_brep.verts.clear();
+                seam_brep.indices.clear();
+                seam_brep.branes.clear();
+
+                // Later seams only look one brick down on each axis, so
+                // bricks before (i - 1, j - 1, 0) will never be used again
+                auto end = shells.lower_bound({{i - 1, j - 1, 0}});
+                for (auto itr = shells.begin(); itr != end; ++itr) {
+                    forgetSeamVerts(itr->second, placeholder.get(),
+                                    seam_verts);
+                    itr->second->releaseSurface(shell_pool);
+                }
+                shells.erase(shells.begin(), end);
+            }
+        }
+    }
+
+    file.seekp(80);
+    file.write(reinterpret_cast<char*>(&num), sizeof(num));
+    return file.good() || fail();
 }
 
 }   // namespace Kernel
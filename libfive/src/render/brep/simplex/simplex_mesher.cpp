@@ -14,19 +14,23 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include "libfive/render/brep/simplex/simplex_mesher.hpp"
 #include "libfive/render/brep/simplex/simplex_tree.hpp"
+#include "libfive/render/brep/edge_search.hpp"
 #include "libfive/render/brep/indexes.hpp"
 #include "libfive/render/brep/per_thread_brep.hpp"
 
 namespace Kernel {
 
-SimplexMesher::SimplexMesher(PerThreadBRep<3>& m, Tree t)
-    : m(m), eval(new XTreeEvaluator(t)), owned(true)
+SimplexMesher::SimplexMesher(PerThreadBRep<3>& m, Tree t,
+                             double edge_tolerance)
+    : m(m), eval(new XTreeEvaluator(t)), owned(true),
+      edge_tolerance(edge_tolerance)
 {
     // Nothing to do here
 }
 
-SimplexMesher::SimplexMesher(PerThreadBRep<3>& m, XTreeEvaluator* es)
-    : m(m), eval(es), owned(false)
+SimplexMesher::SimplexMesher(PerThreadBRep<3>& m, XTreeEvaluator* es,
+                             double edge_tolerance)
+    : m(m), eval(es), owned(false), edge_tolerance(edge_tolerance)
 {
     // Nothing to do here
 }
@@ -438,56 +442,11 @@ uint64_t SimplexMesher::searchEdge(Eigen::Vector3d inside,
                                    Eigen::Vector3d outside,
                                    std::shared_ptr<Tape> tape)
 {
-    // This code is based on xtree.cpp, but flattened to a single pass
-    assert(tape.get() != nullptr);
-
-    // There's an interesting question of precision + speed tradeoffs,
-    // which mostly depend on how well evaluation scales in the
-    // ArrayEaluator.  for now, we'll use the same value as XTree.
-    constexpr int SEARCH_COUNT = 4;
-    constexpr int POINTS_PER_SEARCH = 16;
-    static_assert(POINTS_PER_SEARCH <= ArrayEvaluator::N,
-                  "Overflowing ArrayEvaluator data array");
-
-    // Multi-stage binary search for intersection
-    for (int s=0; s < SEARCH_COUNT; ++s)
-    {
-        // Load search points into the evaluator
-        Eigen::Array<double, 3, POINTS_PER_SEARCH> ps;
-        for (int j=0; j < POINTS_PER_SEARCH; ++j)
-        {
-                const double frac = j / (POINTS_PER_SEARCH - 1.0);
-                ps.col(j) = (inside * (1 - frac)) +
-                            (outside * frac);
-                eval->array.set(ps.col(j).template cast<float>(), j);
-        }
-
-        auto out = eval->array.values(POINTS_PER_SEARCH, tape);
-
-        // Skip one point, because the very first point is
-        // already known to be inside the shape (but
-        // sometimes, due to numerical issues, it registers
-        // as outside!)
-        for (unsigned j=1; j < POINTS_PER_SEARCH; ++j)
-        {
-            // We're searching for the first point that's outside of the
-            // surface.  There's a special case for the final point in the
-            // search, working around  numerical issues where different
-            // evaluators disagree with whether points are inside or outside.
-            if (out[j] > 0 || j == POINTS_PER_SEARCH - 1 ||
-                (out[j] == 0 && !eval->feature.isInside(
-                            ps.col(j).template cast<float>(), tape)))
-
-            {
-                inside = ps.col(j - 1);
-                outside = ps.col(j);
-                break;
-            }
-        }
-    }
+    std::pair<Eigen::Vector3d, Eigen::Vector3d> target = {inside, outside};
+    searchEdges<3>(eval, tape, Region<3>(), &target, 1, edge_tolerance);
 
     // TODO: we should weight the exact position based on values
-    Eigen::Vector3d vert = (inside + outside) / 2;
+    Eigen::Vector3d vert = (target.first + target.second) / 2;
 
     return m.pushVertex(vert);
 }
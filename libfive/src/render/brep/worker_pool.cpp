@@ -8,6 +8,8 @@ License, v. 2.0. If a copy of the MPL was not distributed with this file,
 You can obtain one at http://mozilla.org/MPL/2.0/.
 */
 
+#include <chrono>
+
 #include "libfive/render/brep/free_thread_handler.hpp"
 #include "libfive/render/brep/settings.hpp"
 #include "libfive/render/brep/worker_pool.hpp"
@@ -20,11 +22,13 @@ Root<T> WorkerPool<T, Neighbors, N>::build(
         Tree t, const Region<N>& region_,
         const BRepSettings& settings)
 {
-    // Build evaluators for the pool
+    // Build evaluators for the pool, flattening the tree once and
+    // then forking the Deck for the other workers
+    auto deck = std::make_shared<Deck>(t);
     std::vector<XTreeEvaluator, Eigen::aligned_allocator<XTreeEvaluator>> es;
     es.reserve(settings.workers);
     for (unsigned i=0; i < settings.workers; ++i) {
-        es.emplace_back(XTreeEvaluator(t));
+        es.emplace_back(XTreeEvaluator(i ? deck->fork() : deck));
     }
     return build(es.data(), region_, settings);
 }
@@ -32,13 +36,17 @@ Root<T> WorkerPool<T, Neighbors, N>::build(
 template <typename T, typename Neighbors, unsigned N>
 Root<T> WorkerPool<T, Neighbors, N>::build(
         XTreeEvaluator* eval, const Region<N>& region_,
-        const BRepSettings& settings)
+        const BRepSettings& settings, BranchCallback on_branch,
+        std::shared_ptr<Tape> tape)
 {
-    const auto region = region_.withResolution(settings.min_feature);
+    const auto region = (region_.level == -1)
+        ? region_.withResolution(settings.min_feature)
+        : region_;
     auto root(new T(nullptr, 0, region));
 
-    LockFreeStack tasks(settings.workers);
-    tasks.push({root, eval->deck->tape, region, Neighbors()});
+    TaskQueues tasks(settings.workers);
+    tasks.push(0, {root, tape ? tape : eval->deck->tape, region,
+                   Neighbors()});
 
     std::vector<std::future<void>> futures;
     futures.resize(settings.workers);
@@ -60,8 +68,10 @@ Root<T> WorkerPool<T, Neighbors, N>::build(
     for (unsigned i=0; i < settings.workers; ++i)
     {
         futures[i] = std::async(std::launch::async,
-                [&eval, &tasks, &out, &root_lock, &settings, &done, i](){
-                    run(eval + i, tasks, out, root_lock, settings, done);
+                [&eval, &tasks, &out, &root_lock, &settings,
+                 &on_branch, &done, i](){
+                    run(eval + i, tasks, i, out, root_lock, settings,
+                        on_branch, done);
                 });
     }
 
@@ -85,40 +95,84 @@ Root<T> WorkerPool<T, Neighbors, N>::build(
 
 template <typename T, typename Neighbors, unsigned N>
 void WorkerPool<T, Neighbors, N>::run(
-        XTreeEvaluator* eval, LockFreeStack& tasks,
+        XTreeEvaluator* eval, TaskQueues& tasks, unsigned worker,
         Root<T>& root, std::mutex& root_lock,
         const BRepSettings& settings,
+        const BranchCallback& on_branch,
         std::atomic_bool& done)
 {
-    // Tasks to be evaluated by this thread (populated when the
-    // MPMC stack is completely full).
-    std::stack<Task, std::vector<Task>> local;
-
     typename T::Pool object_pool;
 
-    while (!done.load() && !settings.cancel.load())
+    // Reports a completed cell to the progress tracker, then walks up the
+    // tree collecting children.  Returns true when the root is complete.
+    auto finish = [&](T* t, Region<N> region, Tape::Handle tape,
+                      bool can_subdivide)
     {
-        // Prioritize picking up a local task before going to
-        // the MPMC queue, to keep things in this thread for
-        // as long as possible.
-        Task task;
-        if (local.size())
+        if (settings.progress_handler)
         {
-            task = local.top();
-            local.pop();
+            if (can_subdivide)
+            {
+                // Accumulate all of the child XTree cells that would have been
+                // included if we continued to subdivide this tree, then pass
+                // all of them to the progress tracker
+                uint64_t ticks = 0;
+                for (int i=0; i <= region.level; ++i) {
+                    ticks = (ticks + 1) * (1 << N);
+                }
+                settings.progress_handler->tick(ticks);
+            }
+            else
+            {
+                settings.progress_handler->tick(1);
+            }
         }
-        else if (!tasks.pop(task))
+
+        // If all of the children are done, then ask the parent to collect them
+        // (recursively, merging the trees on the way up, and reporting
+        // completed tree cells to the progress tracker if present).
+        auto up = [&]{
+            region = region.parent(t->parent_index);
+            tape = Tape::getBase(tape, region.region3());
+            t = t->parent;
+        };
+        up();
+        while (t != nullptr && t->collectChildren(eval, tape, region,
+                                                  object_pool,
+                                                  settings.max_err))
         {
-            task.target = nullptr;
+            // Hand finished branches to the callback while they're
+            // still warm, before the parent can be collected.
+            if (on_branch && t->isBranch()) {
+                on_branch(t, worker, object_pool);
+            }
+
+            // Report the volume of completed trees as we walk back
+            // up towards the root of the tree.
+            if (settings.progress_handler) {
+                settings.progress_handler->tick();
+            }
+            up();
         }
 
-        // If we failed to get a task, keep looping
-        // (so that we terminate when either of the flags are set).
-        if (task.target == nullptr)
+        // Termination condition:  if we've ended up pointing at the parent
+        // of the tree's root (which is nullptr), then we're done
+        return t == nullptr;
+    };
+
+    while (!done.load() && !settings.cancel.load())
+    {
+        // Pick up a task from this thread's own deque, or steal one
+        // from another worker if that deque is empty.
+        Task task;
+        if (!tasks.pop(worker, task))
         {
+            // If we failed to get a task, then park until more work shows
+            // up and keep looping (so that we terminate when either of the
+            // flags are set).
             if (settings.free_thread_handler != nullptr) {
                 settings.free_thread_handler->offerWait();
             }
+            tasks.park();
             continue;
         }
 
@@ -142,24 +196,76 @@ void WorkerPool<T, Neighbors, N>::run(
         {
             tape = t->evalInterval(eval, task.tape, region, object_pool);
 
-            // If this Tree is ambiguous, then push the children to the stack
+            // If this Tree is ambiguous, then push the children to the deque
             // and keep going (because all the useful work will be done
             // by collectChildren eventually).
             assert(t->type != Interval::UNKNOWN);
             if (t->type == Interval::AMBIGUOUS)
             {
                 auto rs = region.subdivide();
+                std::array<T*, 1 << N> next_trees;
                 for (unsigned i=0; i < t->children.size(); ++i)
                 {
-                    // If there are available slots, then pass this work
-                    // to the queue; otherwise, undo the decrement and
-                    // assign it to be evaluated locally.
-                    auto next_tree = object_pool.get(t, i, rs[i]);
-                    Task next{next_tree, tape, rs[i], neighbors};
-                    if (!tasks.bounded_push(next))
+                    next_trees[i] = object_pool.get(t, i, rs[i]);
+                }
+
+                // If the grandchildren are at the lowest level and the tree
+                // supports it, then evaluate the children here and build all
+                // of the leaves below them as a group, so that the tree can
+                // batch evaluator work across the whole cell.
+                if (region.level == 2 && LeafEval<T>::batch)
+                {
+                    std::array<Tape::Handle, 1 << N> tapes;
+                    std::array<std::array<T*, 1 << N>, 1 << N> leaves;
+                    std::array<std::array<Region<N>, 1 << N>, 1 << N> lrs;
+                    for (unsigned i=0; i < next_trees.size(); ++i)
                     {
-                        local.push(next);
+                        tapes[i] = next_trees[i]->evalInterval(
+                                eval, tape, rs[i], object_pool);
+                        leaves[i].fill(nullptr);
+                        if (next_trees[i]->type == Interval::AMBIGUOUS)
+                        {
+                            lrs[i] = rs[i].subdivide();
+                            for (unsigned j=0; j < leaves[i].size(); ++j)
+                            {
+                                leaves[i][j] = object_pool.get(
+                                        next_trees[i], j, lrs[i][j]);
+                            }
+                        }
                     }
+                    LeafEval<T>::leaves(t, settings, eval, tape, region,
+                                        tapes, leaves, object_pool,
+                                        neighbors);
+
+                    // Only the last finish call can complete this cell,
+                    // so only it can finish the root.
+                    bool finished = false;
+                    for (unsigned i=0; i < next_trees.size(); ++i)
+                    {
+                        if (leaves[i][0] == nullptr)
+                        {
+                            finished = finish(next_trees[i], rs[i], tapes[i],
+                                              true);
+                            continue;
+                        }
+                        for (unsigned j=0; j < leaves[i].size(); ++j)
+                        {
+                            finished = finish(leaves[i][j], lrs[i][j],
+                                              tapes[i], false);
+                        }
+                    }
+                    if (finished)
+                    {
+                        break;
+                    }
+                    continue;
+                }
+
+                // Push children to this thread's deque, where they'll
+                // be picked up next (unless another worker steals them).
+                for (unsigned i=0; i < t->children.size(); ++i)
+                {
+                    tasks.push(worker, {next_trees[i], tape, rs[i], neighbors});
                 }
 
                 // If we did an interval evaluation, then we either
@@ -173,52 +279,11 @@ void WorkerPool<T, Neighbors, N>::run(
         }
         else
         {
-            t->evalLeaf(eval, tape, region, object_pool, neighbors);
+            LeafEval<T>::leaf(t, settings, eval, tape, region, object_pool,
+                              neighbors);
         }
 
-        if (settings.progress_handler)
-        {
-            if (can_subdivide)
-            {
-                // Accumulate all of the child XTree cells that would have been
-                // included if we continued to subdivide this tree, then pass
-                // all of them to the progress tracker
-                uint64_t ticks = 0;
-                for (int i=0; i <= region.level; ++i) {
-                    ticks = (ticks + 1) * (1 << N);
-                }
-                settings.progress_handler->tick(ticks);
-            }
-            else
-            {
-                settings.progress_handler->tick(1);
-            }
-        }
-
-        // If all of the children are done, then ask the parent to collect them
-        // (recursively, merging the trees on the way up, and reporting
-        // completed tree cells to the progress tracker if present).
-        auto up = [&]{
-            region = region.parent(t->parent_index);
-            tape = Tape::getBase(tape, region.region3());
-            t = t->parent;
-        };
-        up();
-        while (t != nullptr && t->collectChildren(eval, tape, region,
-                                                  object_pool,
-                                                  settings.max_err))
-        {
-            // Report the volume of completed trees as we walk back
-            // up towards the root of the tree.
-            if (settings.progress_handler) {
-                settings.progress_handler->tick();
-            }
-            up();
-        }
-
-        // Termination condition:  if we've ended up pointing at the parent
-        // of the tree's root (which is nullptr), then we're done and break
-        if (t == nullptr)
+        if (finish(t, region, tape, can_subdivide))
         {
             break;
         }
@@ -227,6 +292,7 @@ void WorkerPool<T, Neighbors, N>::run(
     // If we've broken out of the loop, then we should set the done flag
     // so that other worker threads also terminate.
     done.store(true);
+    tasks.stop();
 
     {   // Release the pooled objects to the root
         std::lock_guard<std::mutex> lock(root_lock);
@@ -234,4 +300,108 @@ void WorkerPool<T, Neighbors, N>::run(
     }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename T, typename Neighbors, unsigned N>
+WorkerPool<T, Neighbors, N>::TaskQueues::TaskQueues(unsigned workers)
+    : queues(workers), queued(0), parked(0), stopped(false)
+{
+    for (unsigned i=0; i < workers; ++i)
+    {
+        queues[i].rng.seed(i + 1);
+    }
+}
+
+template <typename T, typename Neighbors, unsigned N>
+void WorkerPool<T, Neighbors, N>::TaskQueues::push(unsigned worker,
+                                                   const Task& task)
+{
+    queued++;
+    {
+        std::lock_guard<std::mutex> lock(queues[worker].mut);
+        queues[worker].tasks.push_back(task);
+    }
+
+    // Only touch the parking lock if someone may be waiting on it.  This
+    // pairs with park(), which increments parked before checking queued,
+    // so one of the two threads is guaranteed to see the other's update.
+    if (parked.load())
+    {
+        {   // Acquire the lock so that we can't notify between a parking
+            // thread's check and its wait
+            std::lock_guard<std::mutex> lock(park_mut);
+        }
+        park_cv.notify_one();
+    }
+}
+
+template <typename T, typename Neighbors, unsigned N>
+bool WorkerPool<T, Neighbors, N>::TaskQueues::pop(unsigned worker,
+                                                  Task& task)
+{
+    if (!queued.load())
+    {
+        return false;
+    }
+
+    {   // Prefer the most recent task from our own deque
+        auto& q = queues[worker];
+        std::lock_guard<std::mutex> lock(q.mut);
+        if (!q.tasks.empty())
+        {
+            task = q.tasks.back();
+            q.tasks.pop_back();
+            queued--;
+            return true;
+        }
+    }
+
+    // Otherwise, steal the oldest task from another worker's deque,
+    // starting from a random victim to spread out contention.
+    const unsigned n = queues.size();
+    const unsigned start = queues[worker].rng() % n;
+    for (unsigned i=0; i < n; ++i)
+    {
+        const unsigned v = (start + i) % n;
+        if (v == worker)
+        {
+            continue;
+        }
+        auto& q = queues[v];
+        std::lock_guard<std::mutex> lock(q.mut);
+        if (!q.tasks.empty())
+        {
+            task = q.tasks.front();
+            q.tasks.pop_front();
+            queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename T, typename Neighbors, unsigned N>
+void WorkerPool<T, Neighbors, N>::TaskQueues::park()
+{
+    std::unique_lock<std::mutex> lock(park_mut);
+    parked++;
+    if (!queued.load() && !stopped.load())
+    {
+        // The timeout lets parked workers notice settings.cancel,
+        // which is set from outside of the pool without notification.
+        park_cv.wait_for(lock, std::chrono::milliseconds(10));
+    }
+    parked--;
+}
+
+template <typename T, typename Neighbors, unsigned N>
+void WorkerPool<T, Neighbors, N>::TaskQueues::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(park_mut);
+        stopped.store(true);
+    }
+    park_cv.notify_all();
+}
+
 }   // namespace Kernel
@@ -88,6 +88,92 @@ void XTree<N, T, L>::releaseChildren(Pool& object_pool)
     }
 }
 
+template <unsigned N, typename T, typename L>
+bool XTree<N, T, L>::childTouches(unsigned i, const Region<N>& bounds) const
+{
+    for (unsigned a=0; a < N; ++a)
+    {
+        if ((i & (1 << a)) ? (region.upper(a) == bounds.upper(a))
+                           : (region.lower(a) == bounds.lower(a)))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+template <unsigned N, typename T, typename L>
+template <typename Pool>
+void XTree<N, T, L>::releaseInterior(Pool& object_pool, T* placeholder)
+{
+    assert(isBranch());
+
+    // Every child touches this tree's boundary, but their own surviving
+    // descendants were only chosen against the child's boundary.
+    for (auto& c : children)
+    {
+        auto ptr = c.load(std::memory_order_relaxed);
+        if (ptr->isBranch())
+        {
+            ptr->pruneInterior(object_pool, ptr->region, region,
+                               placeholder);
+        }
+    }
+}
+
+template <unsigned N, typename T, typename L>
+template <typename Pool>
+void XTree<N, T, L>::releaseSurface(Pool& object_pool)
+{
+    releaseSurviving(object_pool, region);
+}
+
+template <unsigned N, typename T, typename L>
+template <typename Pool>
+void XTree<N, T, L>::pruneInterior(Pool& object_pool,
+                                   const Region<N>& outer,
+                                   const Region<N>& inner,
+                                   T* placeholder)
+{
+    for (unsigned i=0; i < children.size(); ++i)
+    {
+        // Skip children that were released by an earlier call
+        if (!childTouches(i, outer))
+        {
+            continue;
+        }
+
+        auto ptr = children[i].load(std::memory_order_relaxed);
+        if (!childTouches(i, inner))
+        {
+            ptr->releaseSurviving(object_pool, outer);
+            children[i].store(placeholder, std::memory_order_relaxed);
+        }
+        else if (ptr->isBranch())
+        {
+            ptr->pruneInterior(object_pool, outer, inner, placeholder);
+        }
+    }
+}
+
+template <unsigned N, typename T, typename L>
+template <typename Pool>
+void XTree<N, T, L>::releaseSurviving(Pool& object_pool,
+                                      const Region<N>& outer)
+{
+    // Clear every child pointer (including placeholders), since
+    // released trees must have no children when they're reused.
+    for (unsigned i=0; i < children.size(); ++i)
+    {
+        auto ptr = children[i].exchange(nullptr);
+        if (ptr && childTouches(i, outer))
+        {
+            ptr->releaseSurviving(object_pool, outer);
+        }
+    }
+    static_cast<T*>(this)->releaseTo(object_pool);
+}
+
 template <unsigned N, typename T, typename L>
 void XTree<N, T, L>::done()
 {
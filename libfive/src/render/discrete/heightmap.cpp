@@ -239,7 +239,15 @@ bool Heightmap::recurse(HeightmapEvaluator* e, Tape::Handle tape,
         ret &= recurse(e, result.second, rs.second, abort) &&
                recurse(e, result.second, rs.first, abort);
     }
-    e->deck->claim(result.second);
+
+    // Only reuse the tape if it was freshly pushed here:  evalAndPush
+    // returns the input tape unchanged when nothing can be pruned, and
+    // that tape is still in use by the caller (or, for the base tape,
+    // shared with other workers' Decks).
+    if (result.second != tape)
+    {
+        e->deck->claim(result.second);
+    }
     return ret;
 }
 
@@ -255,10 +263,12 @@ std::unique_ptr<Heightmap> Heightmap::render(
     const Tree t, Voxels r, const std::atomic_bool& abort,
     size_t workers)
 {
+    // Flatten the tree once, then fork the Deck for the other workers
+    auto deck = std::make_shared<Deck>(t);
     std::vector<HeightmapEvaluator*> es;
     for (size_t i=0; i < workers; ++i)
     {
-        es.push_back(new HeightmapEvaluator(t));
+        es.push_back(new HeightmapEvaluator(i ? deck->fork() : deck));
     }
 
     auto out = render(es, r, abort);
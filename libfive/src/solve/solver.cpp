@@ -6,6 +6,8 @@ This Source Code Form is subject to the terms of the Mozilla Public
 License, v. 2.0. If a copy of the MPL was not distributed with this file,
 You can obtain one at http://mozilla.org/MPL/2.0/.
 */
+#include <algorithm>
+#include <limits>
 #include <numeric>
 
 #include "libfive/solve/solver.hpp"
@@ -13,14 +15,16 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 #include "libfive/eval/deck.hpp"
 #include "libfive/eval/tape.hpp"
 #include "libfive/eval/eval_jacobian.hpp"
+#include "libfive/eval/eval_adjoint.hpp"
 
 namespace Kernel {
 
 namespace Solver
 {
 
+template <typename E>
 static std::pair<float, Solution> findRoot(
-        JacobianEvaluator& e, Tape::Handle tape,
+        E& e, Tape::Handle tape,
         const Eigen::Vector3f pos, Solution vars, unsigned gas)
 {
     const float EPSILON = 1e-6f;
@@ -101,12 +105,17 @@ std::pair<float, Solution> findRoot(
         const Eigen::Vector3f pos, const Mask& mask, unsigned gas)
 {
     auto deck = std::make_shared<Deck>(t);
-    JacobianEvaluator e(deck, vars);
+    AdjointEvaluator e(deck, vars);
     return findRoot(e, deck->tape, vars, pos, mask, gas);
 }
 
-std::pair<float, Solution> findRoot(
-        JacobianEvaluator& e, Tape::Handle tape,
+/*
+ *  Shared between the JacobianEvaluator and AdjointEvaluator overloads,
+ *  which only differ in how the gradient is found
+ */
+template <typename E>
+static std::pair<float, Solution> findRoot(
+        E& e, Tape::Handle tape,
         std::map<Tree::Id, float> vars, const Eigen::Vector3f pos,
         const Mask& mask, unsigned gas)
 {
@@ -125,6 +134,217 @@ std::pair<float, Solution> findRoot(
     return findRoot(e, tape, pos, vars, gas);
 }
 
+std::pair<float, Solution> findRoot(
+        JacobianEvaluator& e, Tape::Handle tape,
+        std::map<Tree::Id, float> vars, const Eigen::Vector3f pos,
+        const Mask& mask, unsigned gas)
+{
+    return findRoot<JacobianEvaluator>(e, tape, vars, pos, mask, gas);
+}
+
+std::pair<float, Solution> findRoot(
+        AdjointEvaluator& e, Tape::Handle tape,
+        std::map<Tree::Id, float> vars, const Eigen::Vector3f pos,
+        const Mask& mask, unsigned gas)
+{
+    return findRoot<AdjointEvaluator>(e, tape, vars, pos, mask, gas);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ *  Evaluates the sum of squared residuals over every point, and also
+ *  accumulates the normal equations JtJ and Jtr for the variables whose
+ *  indices (into e.varIds()) are listed in active.
+ *
+ *  J is used as scratch storage, with N rows and one column per variable.
+ */
+static double evalNormal(AdjointArrayEvaluator& e, Tape::Handle tape,
+        const std::vector<Eigen::Vector3f>& pts,
+        const std::vector<size_t>& active,
+        Eigen::MatrixXd& J, Eigen::MatrixXd& JtJ, Eigen::VectorXd& Jtr)
+{
+    const size_t N = AdjointArrayEvaluator::N;
+
+    double err = 0;
+    JtJ.setZero();
+    Jtr.setZero();
+
+    Eigen::VectorXd r(N);
+    for (size_t i=0; i < pts.size(); i += N)
+    {
+        const size_t count = std::min(N, pts.size() - i);
+        for (size_t j=0; j < count; ++j)
+        {
+            e.set(pts[i + j], j);
+        }
+
+        r.head(count) = e.values(count, tape).transpose().cast<double>();
+        auto g = e.gradients(count, tape);
+        for (size_t k=0; k < active.size(); ++k)
+        {
+            J.col(k).head(count) =
+                g.row(active[k]).transpose().cast<double>();
+        }
+
+        err += r.head(count).squaredNorm();
+        JtJ.noalias() += J.topRows(count).transpose() * J.topRows(count);
+        Jtr.noalias() += J.topRows(count).transpose() * r.head(count);
+    }
+    return err;
+}
+
+static float findRoots(AdjointArrayEvaluator& e, Tape::Handle tape,
+        const std::vector<Eigen::Vector3f>& pts,
+        const std::vector<size_t>& active, Eigen::VectorXd& x,
+        unsigned gas)
+{
+    const double EPSILON = 1e-12;
+    const size_t n = active.size();
+
+    Eigen::MatrixXd J(AdjointArrayEvaluator::N, n);
+    Eigen::MatrixXd JtJ(n, n), JtJ_(n, n);
+    Eigen::VectorXd Jtr(n), Jtr_(n);
+
+    for (size_t k=0; k < n; ++k)
+    {
+        e.setVarAt(active[k], x(k));
+    }
+    double err = evalNormal(e, tape, pts, active, J, JtJ, Jtr);
+
+    double lambda = 1e-3;
+    while (err >= EPSILON && gas--)
+    {
+        // Break if the gradient has vanished
+        if (Jtr.lpNorm<Eigen::Infinity>() < EPSILON)
+        {
+            break;
+        }
+
+        // Solve the damped normal equations for a step, scaling the
+        // damping by the diagonal (so that it's invariant to the units
+        // of each variable).
+        Eigen::MatrixXd A = JtJ;
+        A.diagonal().array() += lambda * (JtJ.diagonal().array() + EPSILON);
+        const Eigen::VectorXd dx = A.ldlt().solve(-Jtr);
+        if (!dx.allFinite())
+        {
+            break;
+        }
+
+        for (size_t k=0; k < n; ++k)
+        {
+            e.setVarAt(active[k], x(k) + dx(k));
+        }
+        const double err_ = evalNormal(e, tape, pts, active, J, JtJ_, Jtr_);
+
+        if (err_ < err)
+        {
+            // Accept the step and move towards Gauss-Newton
+            const bool converged = err - err_ < err * EPSILON;
+            x += dx;
+            err = err_;
+            JtJ.swap(JtJ_);
+            Jtr.swap(Jtr_);
+            lambda = std::max(lambda / 10, 1e-12);
+            if (converged)
+            {
+                break;
+            }
+        }
+        else
+        {
+            // Reject the step and move towards gradient descent
+            lambda *= 10;
+            if (lambda > 1e12 || dx.norm() < EPSILON * (1 + x.norm()))
+            {
+                break;
+            }
+        }
+    }
+
+    // Leave the evaluator at the solution, rather than the last trial
+    for (size_t k=0; k < n; ++k)
+    {
+        e.setVarAt(active[k], x(k));
+    }
+    return err;
+}
+
+std::pair<float, Solution> findRoots(
+        const Tree& t, const std::map<Tree::Id, float>& vars,
+        const std::vector<Eigen::Vector3f>& pts,
+        const Mask& mask, unsigned gas)
+{
+    auto deck = std::make_shared<Deck>(t);
+    AdjointArrayEvaluator e(deck, vars);
+    return findRoots(e, deck->tape, vars, pts, mask, gas);
+}
+
+std::pair<float, Solution> findRoots(
+        AdjointArrayEvaluator& e, Tape::Handle tape,
+        const std::map<Tree::Id, float>& vars,
+        const std::vector<Eigen::Vector3f>& pts,
+        const Mask& mask, unsigned gas)
+{
+    Solution out;
+    for (auto& v : vars)
+    {
+        if (!mask.count(v.first))
+        {
+            out.insert(v);
+        }
+        e.setVar(v.first, v.second);
+    }
+
+    // Map the unmasked variables to dense indices, so that the solver
+    // works on plain vectors rather than maps.
+    std::vector<size_t> active;
+    const auto& ids = e.varIds();
+    for (size_t i=0; i < ids.size(); ++i)
+    {
+        if (out.count(ids[i]))
+        {
+            active.push_back(i);
+        }
+    }
+
+    Eigen::VectorXd x(active.size());
+    for (size_t k=0; k < active.size(); ++k)
+    {
+        x(k) = out.at(ids[active[k]]);
+    }
+
+    const float err = findRoots(e, tape, pts, active, x, gas);
+    for (size_t k=0; k < active.size(); ++k)
+    {
+        out[ids[active[k]]] = x(k);
+    }
+    return {err, out};
+}
+
+std::pair<float, Solution> findRootsMultiStart(
+        const Tree& t, const std::vector<Solution>& starts,
+        const std::vector<Eigen::Vector3f>& pts,
+        const Mask& mask, unsigned gas)
+{
+    auto deck = std::make_shared<Deck>(t);
+    AdjointArrayEvaluator e(deck, starts.empty() ? Solution()
+                                                 : starts.front());
+
+    std::pair<float, Solution> best = {
+        std::numeric_limits<float>::infinity(), Solution()};
+    for (const auto& s : starts)
+    {
+        auto out = findRoots(e, deck->tape, s, pts, mask, gas);
+        if (out.first < best.first)
+        {
+            best = out;
+        }
+    }
+    return best;
+}
+
 } // namespace Solver
 
 }   // namespace Kernel
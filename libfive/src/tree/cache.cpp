@@ -6,8 +6,10 @@ This Source Code Form is subject to the terms of the Mozilla Public
 License, v. 2.0. If a copy of the MPL was not distributed with this file,
 You can obtain one at http://mozilla.org/MPL/2.0/.
 */
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <iterator>
 
 #include "libfive/tree/cache.hpp"
 #include "libfive/eval/eval_point.hpp"
@@ -15,14 +17,64 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 namespace Kernel {
 
 // Static class variables
-std::recursive_mutex Cache::mut;
 Cache Cache::_instance;
+const unsigned Cache::SHARD_BITS;
+
+size_t Cache::KeyHash::operator()(const Key& k) const
+{
+    size_t h = std::hash<int>()(std::get<0>(k));
+    for (auto id : {std::get<1>(k), std::get<2>(k)})
+    {
+        h ^= std::hash<Tree::Id>()(id) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    }
+    return h;
+}
+
+template <typename T>
+T& Cache::shard(std::array<T, 1 << SHARD_BITS>& shards, size_t hash)
+{
+    // Fibonacci hashing, so that every bit of the hash affects the shard
+    return shards[(uint64_t(hash) * 0x9e3779b97f4a7c15) >> (64 - SHARD_BITS)];
+}
+
+template <typename K, typename H>
+void Cache::erase(std::array<Shard<K, H>, 1 << SHARD_BITS>& shards,
+                  const std::vector<K>& keys)
+{
+    // Sort keys by shard, then take each shard's lock once
+    std::vector<std::pair<Shard<K, H>*, const K*>> sorted;
+    sorted.reserve(keys.size());
+    for (const auto& k : keys)
+    {
+        sorted.push_back({&shard(shards, H()(k)), &k});
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              [](const std::pair<Shard<K, H>*, const K*>& a,
+                 const std::pair<Shard<K, H>*, const K*>& b)
+              { return a.first < b.first; });
+
+    auto itr = sorted.begin();
+    while (itr != sorted.end())
+    {
+        auto s = itr->first;
+        std::lock_guard<std::mutex> lock(s->mut);
+        for (; itr != sorted.end() && itr->first == s; ++itr)
+        {
+            auto found = s->map.find(*itr->second);
+            if (found != s->map.end() && found->second.expired())
+            {
+                s->map.erase(found);
+            }
+        }
+    }
+}
 
 Cache::Node Cache::constant(float v)
 {
     // Special-case for NaN, which can't be stored in the usual map
     if (std::isnan(v))
     {
+        std::lock_guard<std::mutex> lock(nan_mut);
         auto out = nan_constant.lock();
         if (out.get() == nullptr)
         {
@@ -39,10 +91,16 @@ Cache::Node Cache::constant(float v)
         return out;
     }
 
-    auto f = constants.find(v);
-    if (f == constants.end())
+    auto& s = shard(constants, std::hash<float>()(v));
+    std::lock_guard<std::mutex> lock(s.mut);
+
+    // The entry may be present but expired, if the previous constant
+    // is in the middle of being destroyed by another thread.
+    auto& f = s.map[v];
+    auto out = f.lock();
+    if (out.get() == nullptr)
     {
-        Node out(new Tree::Tree_ {
+        out.reset(new Tree::Tree_ {
             Opcode::CONSTANT,
             Tree::FLAG_LOCATION_AGNOSTIC,
             0, // rank
@@ -50,14 +108,9 @@ Cache::Node Cache::constant(float v)
             nullptr, // oracle
             nullptr,
             nullptr });
-        constants.insert({v, out});
-        return out;
-    }
-    else
-    {
-        assert(!f->second.expired());
-        return f->second.lock();
+        f = out;
     }
+    return out;
 }
 
 Cache::Node Cache::operation(Opcode::Opcode op, Cache::Node lhs,
@@ -79,13 +132,31 @@ Cache::Node Cache::operation(Opcode::Opcode op, Cache::Node lhs,
         CHECK_RETURN(checkAffine);
     }
 
+    // If both sides of the operation are constant, then fold it into a
+    // single constant without ever constructing the operation node.
+    // This happens after the identity checks, so that (for example)
+    // 0 * NaN is still simplified to 0.
+    if ((lhs.get() || rhs.get()) &&
+        (!lhs.get() || lhs->op == Opcode::CONSTANT) &&
+        (!rhs.get() || rhs->op == Opcode::CONSTANT))
+    {
+        return constant(PointEvaluator::evalOp(
+                    op, lhs.get() ? lhs->value : 0,
+                        rhs.get() ? rhs->value : 0));
+    }
+
     Key k(op, lhs.get(), rhs.get());
 
-    auto found = ops.find(k);
-    if (found == ops.end())
+    auto& s = shard(ops, KeyHash()(k));
+    std::lock_guard<std::mutex> lock(s.mut);
+
+    // As in constant(), an existing entry may have expired
+    auto& found = s.map[k];
+    auto out = found.lock();
+    if (out.get() == nullptr)
     {
         // Construct a new operation node
-        Node out(new Tree::Tree_ {
+        out.reset(new Tree::Tree_ {
             op,
 
             // Flags
@@ -112,29 +183,9 @@ Cache::Node Cache::operation(Opcode::Opcode op, Cache::Node lhs,
             lhs,
             rhs });
 
-        // Store a weak pointer to this new Node
-        ops.insert({k, out});
-
-        // If both sides of the operation are constant, then build up a
-        // temporary Evaluator in order to get a constant value out
-        // (out will be GC'd immediately when it goes out of scope)
-        if ((lhs.get() || rhs.get()) &&
-            (!lhs.get() || lhs->op == Opcode::CONSTANT) &&
-            (!rhs.get() || rhs->op == Opcode::CONSTANT))
-        {
-            // Here, we construct a Tree manually to avoid a recursive loop,
-            // then pass it immediately into a dummy Evaluator
-            auto e = PointEvaluator(Tree(out));
-            auto result = e.eval({0,0,0});
-            return constant(result);
-        }
-        return out;
-    }
-    else
-    {
-        assert(!found->second.expired());
-        return found->second.lock();
+        found = out;
     }
+    return out;
 }
 
 
@@ -154,24 +205,68 @@ void Cache::del(float v)
 {
     if (std::isnan(v))
     {
-        assert(nan_constant.expired());
-        nan_constant.reset();
+        std::lock_guard<std::mutex> lock(nan_mut);
+        if (nan_constant.expired())
+        {
+            nan_constant.reset();
+        }
     }
     else
     {
-        auto c = constants.find(v);
-        assert(c != constants.end());
-        assert(c->second.expired());
-        constants.erase(c);
+        auto& s = shard(constants, std::hash<float>()(v));
+        std::lock_guard<std::mutex> lock(s.mut);
+        auto c = s.map.find(v);
+        if (c != s.map.end() && c->second.expired())
+        {
+            s.map.erase(c);
+        }
     }
 }
 
 void Cache::del(Opcode::Opcode op, Node lhs, Node rhs)
 {
-    auto o = ops.find(Key(op, lhs.get(), rhs.get()));
-    assert(o != ops.end());
-    assert(o->second.expired());
-    ops.erase(o);
+    Key k(op, lhs.get(), rhs.get());
+    auto& s = shard(ops, KeyHash()(k));
+    std::lock_guard<std::mutex> lock(s.mut);
+    auto o = s.map.find(k);
+    if (o != s.map.end() && o->second.expired())
+    {
+        s.map.erase(o);
+    }
+}
+
+void Cache::del(const std::vector<float>& vs, const std::vector<Key>& ks)
+{
+    // NaN can't be stored in the usual map, so it's handled separately
+    if (std::any_of(vs.begin(), vs.end(), [](float v) { return std::isnan(v); }))
+    {
+        del(std::nanf(""));
+        std::vector<float> rest;
+        std::copy_if(vs.begin(), vs.end(), std::back_inserter(rest),
+                     [](float v) { return !std::isnan(v); });
+        erase(constants, rest);
+    }
+    else
+    {
+        erase(constants, vs);
+    }
+    erase(ops, ks);
+}
+
+size_t Cache::size()
+{
+    size_t out = 0;
+    for (auto& s : constants)
+    {
+        std::lock_guard<std::mutex> lock(s.mut);
+        out += s.map.size();
+    }
+    for (auto& s : ops)
+    {
+        std::lock_guard<std::mutex> lock(s.mut);
+        out += s.map.size();
+    }
+    return out;
 }
 
 std::map<Cache::Node, float> Cache::asAffine(Node n)
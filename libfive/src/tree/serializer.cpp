@@ -28,10 +28,12 @@ void Serializer::run(Archive& a)
 
 void Serializer::serializeTree(Tree t)
 {
-    for (auto& n : t.ordered())
+    for (auto p : t.flat())
     {
+        const auto& n = *p;
+
         // Skip this id, as it has already been stored
-        if (ids.find(n.id()) != ids.end())
+        if (ids.find(n.get()) != ids.end())
         {
             continue;
         }
@@ -44,7 +46,7 @@ void Serializer::serializeTree(Tree t)
             }
         }
         out.put(n->op);
-        ids.insert({ n.id(), (uint32_t)ids.size() });
+        ids.insert({ n.get(), (uint32_t)ids.size() });
 
         // Write constants as raw bytes
         if (n->op == Opcode::CONSTANT)
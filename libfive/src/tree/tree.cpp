@@ -9,11 +9,12 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 #include <algorithm>
 #include <fstream>
 #include <iostream>
-#include <set>
-#include <list>
 #include <cmath>
+#include <cstdint>
 #include <cassert>
 #include <array>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "libfive/tree/cache.hpp"
 #include "libfive/tree/archive.hpp"
@@ -75,52 +76,197 @@ Tree Tree::var()
     return Tree(Cache::instance()->var());
 }
 
-Tree::~Tree()
+namespace {
+
+/*
+ *  When a Tree_ is destroyed, its arguments may die as well, and so on
+ *  down the tree.  Rather than letting the shared_ptr destructors recurse
+ *  (which can overflow the stack on deep trees), the outermost destructor
+ *  on each thread installs a Reaper.  Nested destructors hand their
+ *  arguments and cache entries to it, and it releases them in a loop.
+ */
+struct Reaper
 {
-    auto lock = Cache::instance();
-    ptr.reset();
-}
+    /*  Arguments of dead nodes, which haven't been released yet  */
+    std::vector<std::shared_ptr<Tree::Tree_>> pending;
+
+    /*  Cache entries of dead nodes, which are removed in one batch  */
+    std::vector<float> constants;
+    std::vector<Cache::Key> ops;
+};
+thread_local Reaper* reaper = nullptr;
+
+}   // anonymous namespace
 
 Tree::Tree_::~Tree_()
 {
-    if (op == Opcode::CONSTANT)
+    // const semantics don't apply to an object under destruction,
+    // so we can move our arguments out before they're destroyed
+    auto& a = const_cast<std::shared_ptr<Tree_>&>(lhs);
+    auto& b = const_cast<std::shared_ptr<Tree_>&>(rhs);
+
+    // Hands this node's cache entry and arguments to a Reaper
+    auto retire = [&](Reaper& r) {
+        if (op == Opcode::CONSTANT)
+        {
+            r.constants.push_back(value);
+        }
+        else if (op != Opcode::VAR_FREE && op != Opcode::ORACLE)
+        {
+            r.ops.emplace_back(op, lhs.get(), rhs.get());
+        }
+        for (auto c : {&a, &b})
+        {
+            if (c->get())
+            {
+                r.pending.push_back(std::move(*c));
+            }
+        }
+    };
+
+    if (reaper != nullptr)
     {
-        Cache::instance()->del(value);
+        retire(*reaper);
     }
-    else if (op != Opcode::VAR_FREE && op != Opcode::ORACLE)
+    // If neither argument will die along with this node, then we can
+    // skip the Reaper and just remove this node from the Cache.
+    else if ((!a.get() || a.use_count() > 1) &&
+             (!b.get() || b.use_count() > 1))
     {
-        Cache::instance()->del(op, lhs, rhs);
+        if (op == Opcode::CONSTANT)
+        {
+            Cache::instance()->del(value);
+        }
+        else if (op != Opcode::VAR_FREE && op != Opcode::ORACLE)
+        {
+            Cache::instance()->del(op, lhs, rhs);
+        }
+    }
+    else
+    {
+        Reaper local;
+        reaper = &local;
+        retire(local);
+
+        // Releasing a node may destroy it, which pushes its own
+        // arguments onto the list (rather than recursing).
+        while (local.pending.size())
+        {
+            auto t = std::move(local.pending.back());
+            local.pending.pop_back();
+            t.reset();
+        }
+        reaper = nullptr;
+        Cache::instance()->del(local.constants, local.ops);
     }
 }
 
-std::list<Tree> Tree::ordered() const
+namespace {
+
+/*
+ *  Open-addressed hash set of node pointers, used to mark nodes as
+ *  visited while flattening.  It uses linear probing in a power-of-two
+ *  table that is kept at most half full, so lookups stay short without
+ *  allocating anything per node.
+ */
+class VisitedSet
 {
-    std::set<Id> found = {nullptr};
-    std::list<std::shared_ptr<Tree_>> todo = { ptr };
-    std::map<unsigned, std::list<std::shared_ptr<Tree_>>> ranks;
+public:
+    VisitedSet() : table(64, nullptr), count(0) {}
 
-    while (todo.size())
+    /*  Inserts the given pointer, returning false if it was already here */
+    bool insert(Tree::Id t)
     {
-        auto t = todo.front();
-        todo.pop_front();
+        if ((count + 1) * 2 > table.size())
+        {
+            grow();
+        }
+        auto i = find(t);
+        if (table[i] == t)
+        {
+            return false;
+        }
+        table[i] = t;
+        count++;
+        return true;
+    }
 
-        if (found.find(t.get()) == found.end())
+protected:
+    /*  Returns the slot that holds t, or the empty slot where it belongs */
+    size_t find(Tree::Id t) const
+    {
+        const size_t mask = table.size() - 1;
+        // Fibonacci hashing, dropping the always-zero alignment bits
+        size_t i = ((reinterpret_cast<uintptr_t>(t) >> 4) *
+                    11400714819323198485ull) & mask;
+        while (table[i] != nullptr && table[i] != t)
         {
-            todo.push_back(t->lhs);
-            todo.push_back(t->rhs);
-            found.insert(t.get());
-            ranks[t->rank].push_back(t);
+            i = (i + 1) & mask;
         }
+        return i;
+    }
+
+    void grow()
+    {
+        std::vector<Tree::Id> old(table.size() * 2, nullptr);
+        std::swap(old, table);
+        for (auto t : old)
+        {
+            if (t != nullptr)
+            {
+                table[find(t)] = t;
+            }
+        }
+    }
+
+    std::vector<Tree::Id> table;
+    size_t count;
+};
+
+}   // anonymous namespace
+
+std::vector<const std::shared_ptr<Tree::Tree_>*> Tree::flat() const
+{
+    std::vector<const std::shared_ptr<Tree_>*> found;
+    if (ptr.get() == nullptr)
+    {
+        return found;
     }
 
-    std::list<Tree> out;
-    for (auto& r : ranks)
+    // Breadth-first search, using the output array as the queue and
+    // marking nodes as visited when they're first queued.
+    VisitedSet visited;
+    visited.insert(ptr.get());
+    found.push_back(&ptr);
+    for (size_t i=0; i < found.size(); ++i)
     {
-        for (auto& t : r.second)
+        const auto& t = *found[i];
+        for (const auto* c : {&t->lhs, &t->rhs})
         {
-            out.push_back(Tree(t));
+            if (c->get() != nullptr && visited.insert(c->get()))
+            {
+                found.push_back(c);
+            }
         }
     }
+
+    // Then, do a stable counting sort by rank.  Every node has a higher
+    // rank than its arguments, so this puts them in topological order,
+    // with the root (which has the unique highest rank) at the end.
+    std::vector<size_t> start(ptr->rank + 2, 0);
+    for (auto t : found)
+    {
+        start[(*t)->rank + 1]++;
+    }
+    for (size_t r=1; r < start.size(); ++r)
+    {
+        start[r] += start[r - 1];
+    }
+    std::vector<const std::shared_ptr<Tree_>*> out(found.size());
+    for (auto t : found)
+    {
+        out[start[(*t)->rank]++] = t;
+    }
     return out;
 }
 
@@ -161,19 +307,20 @@ Tree Tree::remap(std::map<Id, Tree> m) const
     auto Y_ = get_remapped(Tree::Y());
     auto Z_ = get_remapped(Tree::Z());
 
-    for (const auto& t : ordered())
+    for (auto p : flat())
     {
+        const auto& t = *p;
         if (Opcode::args(t->op) >= 1)
         {
             auto lhs = m.find(t->lhs.get());
             auto rhs = m.find(t->rhs.get());
-            m.insert({t.id(), Tree(Cache::instance()->operation(t->op,
+            m.insert({t.get(), Tree(Cache::instance()->operation(t->op,
                         lhs == m.end() ? t->lhs : lhs->second.ptr,
                         rhs == m.end() ? t->rhs : rhs->second.ptr))});
         }
         else if (t->op == Opcode::ORACLE)
         {
-            m.insert({ t.id(), t->oracle->remap(t, X_, Y_, Z_) });
+            m.insert({ t.get(), t->oracle->remap(Tree(t), X_, Y_, Z_) });
         }
     }
 
@@ -195,17 +342,179 @@ Tree Tree::rhs() const
 Tree Tree::makeVarsConstant() const
 {
     std::map<Id, Tree> vars;
-    for (auto& o : ordered())
+    for (auto p : flat())
     {
+        const auto& o = *p;
         if (o->op == Opcode::VAR_FREE)
         {
-            vars.insert({o.id(),
-                    Tree(Cache::instance()->operation(Opcode::CONST_VAR, o.ptr))});
+            vars.insert({o.get(),
+                    Tree(Cache::instance()->operation(Opcode::CONST_VAR, o))});
         }
     }
     return remap(vars);
 }
 
+Tree Tree::optimized() const
+{
+    auto cache = Cache::instance();
+    const auto nodes = flat();
+
+    // Count each node's parents, and find MIN / MAX nodes which are used
+    // by a single parent with the same opcode.  These are inner links of
+    // a chain, and are rebuilt along with the outermost node of the chain.
+    std::unordered_map<Id, unsigned> uses;
+    std::unordered_set<Id> linked;
+    for (auto p : nodes)
+    {
+        const auto& t = *p;
+        for (auto a : {t->lhs.get(), t->rhs.get()})
+        {
+            if (a)
+            {
+                uses[a]++;
+                if ((t->op == Opcode::OP_MIN || t->op == Opcode::OP_MAX) &&
+                    a->op == t->op)
+                {
+                    linked.insert(a);
+                }
+            }
+        }
+    }
+    auto inner = [&](Id t) {
+        return linked.count(t) && uses.at(t) == 1;
+    };
+
+    // Every node gets a deterministic sort key:  its position in the
+    // flattened tree (i.e. rank, then order within the rank), or for
+    // nodes that we build or find along the way, the order in which
+    // they were first seen.  Heap addresses would change between runs.
+    std::unordered_map<Id, size_t> order;
+    for (auto p : nodes)
+    {
+        order.insert({p->get(), order.size()});
+    }
+    auto key = [&](Id t) {
+        return order.insert({t, order.size()}).first->second;
+    };
+
+    // Builds an operation, sorting the arguments of commutative operations
+    // so that the Cache deduplicates them regardless of order.
+    auto make = [&](Opcode::Opcode op, std::shared_ptr<Tree_> a,
+                    std::shared_ptr<Tree_> b) {
+        if (Opcode::isCommutative(op) && key(b.get()) < key(a.get()))
+        {
+            std::swap(a, b);
+        }
+        auto out = cache->operation(op, a, b, false);
+        key(out.get());
+        return out;
+    };
+
+    std::unordered_map<Id, std::shared_ptr<Tree_>> m;
+    std::vector<const Tree_*> stack;
+    std::vector<std::shared_ptr<Tree_>> chain;
+    for (auto p : nodes)
+    {
+        const auto& t = *p;
+        if (Opcode::args(t->op) == 0)
+        {
+            m.insert({t.get(), t});
+            continue;
+        }
+        else if (inner(t.get()))
+        {
+            continue;
+        }
+
+        // The arguments of a chain's outermost node may be inner links,
+        // which haven't been built, so these are looked up lazily.
+        std::shared_ptr<Tree_> out;
+        auto arg = [&](const std::shared_ptr<Tree_>& n) {
+            return n ? m.at(n.get()) : nullptr;
+        };
+        switch (t->op)
+        {
+            case Opcode::OP_POW:
+            {
+                auto b = arg(t->rhs);
+                if (b->op == Opcode::CONSTANT && b->value == 2)
+                {
+                    out = make(Opcode::OP_SQUARE, arg(t->lhs), nullptr);
+                }
+                else if (b->op == Opcode::CONSTANT && b->value == 1)
+                {
+                    out = arg(t->lhs);
+                }
+                break;
+            }
+            case Opcode::OP_MUL:
+                if (arg(t->lhs) == arg(t->rhs))
+                {
+                    out = make(Opcode::OP_SQUARE, arg(t->lhs), nullptr);
+                }
+                break;
+
+            case Opcode::OP_DIV:
+            {
+                auto b = arg(t->rhs);
+                if (b->op == Opcode::CONSTANT && b->value != 0 &&
+                    std::isfinite(1 / b->value))
+                {
+                    out = make(Opcode::OP_MUL, arg(t->lhs),
+                               cache->constant(1 / b->value));
+                }
+                break;
+            }
+
+            case Opcode::OP_MIN:
+            case Opcode::OP_MAX:
+            {
+                // Collect the chain's arguments from left to right
+                chain.clear();
+                stack = {t->rhs.get(), t->lhs.get()};
+                while (stack.size())
+                {
+                    auto n = stack.back();
+                    stack.pop_back();
+                    if (inner(n))
+                    {
+                        stack.push_back(n->rhs.get());
+                        stack.push_back(n->lhs.get());
+                    }
+                    else
+                    {
+                        chain.push_back(m.at(n));
+                    }
+                }
+
+                // Then combine neighbouring pairs until one node is left
+                while (chain.size() > 1)
+                {
+                    size_t i;
+                    for (i=0; i + 1 < chain.size(); i += 2)
+                    {
+                        chain[i / 2] = make(t->op, chain[i], chain[i + 1]);
+                    }
+                    if (i < chain.size())
+                    {
+                        chain[i / 2] = chain[i];
+                    }
+                    chain.resize((chain.size() + 1) / 2);
+                }
+                out = chain.front();
+                break;
+            }
+
+            default:
+                break;
+        }
+        m.insert({t.get(), out ? out
+                                : make(t->op, arg(t->lhs), arg(t->rhs))});
+    }
+
+    return Tree(m.at(id()));
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 const std::shared_ptr<Tree::Tree_> Tree::Tree_::branch(Direction d)
@@ -72,6 +72,92 @@ TEST_CASE("libfive_tree_eval_r")
     libfive_tree_delete(c);
 }
 
+TEST_CASE("libfive_evaluator")
+{
+    auto a = libfive_tree_x();
+    auto v = libfive_tree_var();
+    auto c = libfive_tree_binary(Opcode::OP_MUL, a, v);
+    auto d = libfive_tree_binary(Opcode::OP_ADD, c, libfive_tree_y());
+
+    auto e = libfive_evaluator_new(d);
+
+    // Use more points than fit into a single array evaluator pass
+    std::vector<libfive_vec3> ps;
+    for (unsigned i=0; i < 600; ++i)
+    {
+        ps.push_back({float(i), 2.0f * i, 0.0f});
+    }
+
+    SECTION("values")
+    {
+        std::vector<float> out(ps.size());
+        libfive_evaluator_values(e, ps.data(), ps.size(), out.data());
+        for (unsigned i=0; i < ps.size(); ++i)
+        {
+            REQUIRE(out[i] == 2.0f * i);
+        }
+
+        void* ids[] = {const_cast<void*>(libfive_tree_id(v))};
+        float values[] = {3.0f};
+        libfive_vars vars = {ids, values, 1};
+        REQUIRE(libfive_evaluator_update_vars(e, vars));
+
+        libfive_evaluator_values(e, ps.data(), ps.size(), out.data());
+        for (unsigned i=0; i < ps.size(); ++i)
+        {
+            REQUIRE(out[i] == 5.0f * i);
+        }
+    }
+
+    SECTION("derivs")
+    {
+        void* ids[] = {const_cast<void*>(libfive_tree_id(v))};
+        float values[] = {3.0f};
+        libfive_vars vars = {ids, values, 1};
+        libfive_evaluator_update_vars(e, vars);
+
+        std::vector<libfive_vec4> out(ps.size());
+        libfive_evaluator_derivs(e, ps.data(), ps.size(), out.data());
+        for (unsigned i=0; i < ps.size(); ++i)
+        {
+            REQUIRE(out[i].x == 3.0f);
+            REQUIRE(out[i].y == 1.0f);
+            REQUIRE(out[i].z == 0.0f);
+            REQUIRE(out[i].w == 5.0f * i);
+        }
+    }
+
+    SECTION("intervals")
+    {
+        libfive_region3 rs[] = {{{1, 2}, {2, 3}, {0, 0}},
+                                {{-1, 1}, {0, 0}, {0, 0}}};
+        libfive_interval out[2];
+        libfive_evaluator_intervals(e, rs, 2, out);
+        REQUIRE(out[0].lower == 2);
+        REQUIRE(out[0].upper == 3);
+        REQUIRE(out[1].lower == 0);
+        REQUIRE(out[1].upper == 0);
+    }
+
+    SECTION("fork")
+    {
+        auto f = libfive_evaluator_fork(e);
+        std::vector<float> out(ps.size());
+        libfive_evaluator_values(f, ps.data(), ps.size(), out.data());
+        for (unsigned i=0; i < ps.size(); ++i)
+        {
+            REQUIRE(out[i] == 2.0f * i);
+        }
+        libfive_evaluator_delete(f);
+    }
+
+    libfive_evaluator_delete(e);
+    libfive_tree_delete(a);
+    libfive_tree_delete(v);
+    libfive_tree_delete(c);
+    libfive_tree_delete(d);
+}
+
 TEST_CASE("libfive_tree_render_slice")
 {
     auto x = libfive_tree_x();
@@ -104,6 +190,51 @@ TEST_CASE("libfive_tree_render_slice")
     libfive_contours_delete(cs);
 }
 
+TEST_CASE("libfive_tree_render_slices")
+{
+    auto x = libfive_tree_x();
+    auto y = libfive_tree_y();
+    auto z = libfive_tree_z();
+    auto x2 = libfive_tree_unary(Opcode::OP_SQUARE, x);
+    auto y2 = libfive_tree_unary(Opcode::OP_SQUARE, y);
+    auto z2 = libfive_tree_unary(Opcode::OP_SQUARE, z);
+    auto r_ = libfive_tree_binary(Opcode::OP_ADD, x2, y2);
+    auto r = libfive_tree_binary(Opcode::OP_ADD, r_, z2);
+    auto one = libfive_tree_const(1.0f);
+    auto d = libfive_tree_binary(Opcode::OP_SUB, r, one);
+
+    const float zs[] = {0.6, 0, 1.5};
+    auto s = libfive_tree_render_slices(d, {{-2, 2}, {-2, 2}}, zs, 3, 10);
+    REQUIRE(s->count == 3);
+    REQUIRE(s->slices[2].count == 0);
+    for (unsigned k=0; k < 2; ++k)
+    {
+        CAPTURE(zs[k]);
+        auto& cs = s->slices[k];
+        REQUIRE(cs.count == 1);
+        REQUIRE(cs.cs[0].count > 0);
+
+        // Each slice is a circle with r^2 = 1 - z^2
+        float rmin = 2;
+        float rmax = 0;
+        for (unsigned i=0; i < cs.cs[0].count; ++i)
+        {
+            auto& v = cs.cs[0].pts[i];
+            auto r = pow(v.x, 2) + pow(v.y, 2) + pow(zs[k], 2);
+            rmin = fmin(rmin, r);
+            rmax = fmax(rmax, r);
+        }
+        REQUIRE(rmin > 0.99);
+        REQUIRE(rmax < 1.01);
+    }
+
+    for (auto t : {x, y, z, x2, y2, z2, r_, r, one, d})
+    {
+        libfive_tree_delete(t);
+    }
+    libfive_slices_delete(s);
+}
+
 TEST_CASE("libfive_tree_render_mesh")
 {
     auto x = libfive_tree_x();
@@ -8,10 +8,14 @@ License, v. 2.0. If a copy of the MPL was not distributed with this file,
 You can obtain one at http://mozilla.org/MPL/2.0/.
 */
 #include <sstream>
+#include <future>
+#include <array>
+#include <cmath>
 
 #include "catch.hpp"
 
 #include "libfive/tree/cache.hpp"
+#include "libfive/eval/eval_point.hpp"
 
 using namespace Kernel;
 
@@ -65,6 +69,42 @@ TEST_CASE("Deduplication of operations")
     REQUIRE(oa != oc);
 }
 
+TEST_CASE("Deduplication across threads")
+{
+    // Build the same set of expressions from several threads at once,
+    // while churning through short-lived trees to exercise deletion.
+    auto build = []() {
+        std::vector<std::shared_ptr<Tree::Tree_>> out;
+        auto t = Cache::instance();
+        for (unsigned i=0; i < 1000; ++i)
+        {
+            auto c = t->constant(i);
+            out.push_back(t->operation(Opcode::OP_MUL, t->X(), c, false));
+            t->operation(Opcode::OP_ADD, t->Y(), t->constant(-1.0f - i), false);
+        }
+        return out;
+    };
+
+    std::array<std::future<std::vector<std::shared_ptr<Tree::Tree_>>>, 4> fs;
+    for (auto& f : fs)
+    {
+        f = std::async(std::launch::async, build);
+    }
+    std::array<std::vector<std::shared_ptr<Tree::Tree_>>, 4> rs;
+    for (unsigned i=0; i < fs.size(); ++i)
+    {
+        rs[i] = fs[i].get();
+    }
+
+    // All of the threads' results are alive at this point, so they
+    // must have been deduplicated into the same nodes.
+    for (unsigned i=1; i < rs.size(); ++i)
+    {
+        REQUIRE(rs[i] == rs[0]);
+    }
+    REQUIRE(rs[0].back() == build().back());
+}
+
 TEST_CASE("Cache::checkIdentity")
 {
     auto t = Cache::instance();
@@ -176,6 +216,57 @@ TEST_CASE("Collapsing constants")
     auto b = t->operation(Opcode::OP_NEG, t->constant(4));
     REQUIRE(b->op == Opcode::CONSTANT);
     REQUIRE(b->value == -4);
+
+    SECTION("Without building an operation node")
+    {
+        auto c = t->constant(5);
+        auto d = t->constant(3);
+        const auto before = t->size();
+        auto e = t->operation(Opcode::OP_MOD, c, d);
+        REQUIRE(e->op == Opcode::CONSTANT);
+        REQUIRE(e->value == 2);
+        REQUIRE(t->size() == before + 1);
+    }
+
+    SECTION("Matching PointEvaluator")
+    {
+        // Builds the same expression with folding and with a variable,
+        // which is then evaluated by a PointEvaluator
+        auto v = Tree::var();
+        auto check = [&](Tree (*f)(const Tree&, const Tree&))
+        {
+            auto c = f(-8, 3);
+            REQUIRE(c->op == Opcode::CONSTANT);
+
+            PointEvaluator e(f(v, 3), {{v.id(), -8}});
+            REQUIRE(c->value == e.eval({0, 0, 0}));
+        };
+        check(mod);
+        check(nth_root);
+        check(compare);
+        check(atan2);
+        check(nanfill);
+    }
+
+    SECTION("After identity checks")
+    {
+        // The MUL identity returns the zero, so NaN and inf don't leak in
+        auto c = t->operation(Opcode::OP_MUL, t->constant(0),
+                              t->constant(std::nanf("")));
+        REQUIRE(c->op == Opcode::CONSTANT);
+        REQUIRE(c->value == 0);
+
+        auto d = t->operation(Opcode::OP_MUL, t->constant(0),
+                              t->constant(INFINITY));
+        REQUIRE(d->op == Opcode::CONSTANT);
+        REQUIRE(d->value == 0);
+
+        // Without simplification, these are evaluated directly
+        auto e = t->operation(Opcode::OP_MUL, t->constant(0),
+                              t->constant(INFINITY), false);
+        REQUIRE(e->op == Opcode::CONSTANT);
+        REQUIRE(std::isnan(e->value));
+    }
 }
 
 TEST_CASE("Cache::var")
@@ -10,6 +10,7 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 #include "catch.hpp"
 
 #include "libfive/tree/tree.hpp"
+#include "libfive/eval/eval_point.hpp"
 
 #include "libfive/render/brep/contours.hpp"
 #include "libfive/render/brep/region.hpp"
@@ -83,3 +84,42 @@ TEST_CASE("Contours::render (menger, perp offset)")
     auto cs = Contours::render(m, r, BRepSettings());
     REQUIRE(cs->contours.size() == 74);
 }
+
+TEST_CASE("Contours::renderStack")
+{
+    auto t = min(sphere(1), box({-0.5, -0.5, 1.5}, {0.5, 0.5, 3}));
+    Region<2> r({-2, -2}, {2, 2});
+
+    // Out of order, with some layers that miss the model entirely
+    std::vector<double> zs = {0.5, -3, 2, 0, 1.2, 4, -0.25, 2.5};
+    BRepSettings settings;
+    settings.workers = 2;
+    auto stack = Contours::renderStack(t, r, zs, settings);
+    REQUIRE(stack.size() == zs.size());
+
+    PointEvaluator eval(t);
+    for (unsigned i=0; i < zs.size(); ++i)
+    {
+        CAPTURE(zs[i]);
+        REQUIRE(stack[i].get() != nullptr);
+        REQUIRE(stack[i]->bbox.perp(0) == zs[i]);
+
+        // Layers match what we'd get by rendering them one at a time
+        Region<2> layer(r.lower, r.upper, Region<2>::Perp(zs[i]));
+        auto cs = Contours::render(t, layer, BRepSettings());
+        REQUIRE(stack[i]->contours.size() == cs->contours.size());
+
+        for (auto& c : stack[i]->contours)
+        {
+            for (auto& pt : c)
+            {
+                auto v = eval.eval({pt.x(), pt.y(), (float)zs[i]});
+                REQUIRE(fabs(v) < 1e-3);
+            }
+        }
+    }
+    REQUIRE(stack[0]->contours.size() == 1);
+    REQUIRE(stack[1]->contours.size() == 0);
+    REQUIRE(stack[2]->contours.size() == 1);
+    REQUIRE(stack[4]->contours.size() == 0);
+}
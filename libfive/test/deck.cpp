@@ -13,6 +13,10 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include "libfive/tree/tree.hpp"
 #include "libfive/eval/deck.hpp"
+#include "libfive/eval/tape.hpp"
+#include "libfive/eval/eval_point.hpp"
+
+#include "util/oracles.hpp"
 
 using namespace Kernel;
 
@@ -39,3 +43,151 @@ TEST_CASE("Deck::constants")
     CAPTURE(t.constants.begin()->second);
     REQUIRE(t.constants.at(2) == 5.0f);
 }
+
+TEST_CASE("Deck::slots")
+{
+    auto t = Tree::X();
+    for (unsigned i=0; i < 100; ++i)
+    {
+        t = sin(t);
+    }
+    Deck d(t);
+    REQUIRE(d.num_clauses == 103);
+
+    // X, Y, Z are pinned, and the chain only needs two live values
+    REQUIRE(d.tape->slots() == 6);
+}
+
+TEST_CASE("Deck::downstream")
+{
+    auto a = Tree::var();
+    auto b = Tree::var();
+    Deck d(max(min(sin(Tree::X()), a * Tree::Y()), b));
+
+    auto ca = d.vars.right.at(a.id());
+    auto cb = d.vars.right.at(b.id());
+
+    // a feeds a * Y, the min, and the root
+    const auto& da = d.downstream(ca);
+    REQUIRE(da.size() == 3);
+    REQUIRE(d.tape->clause(da[0]).op == Opcode::OP_MUL);
+    REQUIRE(d.tape->clause(da[2]).id == d.tape->root());
+    for (unsigned i=1; i < da.size(); ++i)
+    {
+        REQUIRE(da[i - 1] > da[i]);
+    }
+
+    // b only feeds the root
+    const auto& db = d.downstream(cb);
+    REQUIRE(db.size() == 1);
+    REQUIRE(d.tape->clause(db[0]).id == d.tape->root());
+
+    // Forked decks share the same lists
+    auto f = d.fork();
+    REQUIRE(&f->downstream(ca) == &da);
+}
+
+TEST_CASE("Deck::deps")
+{
+    auto a = Tree::var();
+    auto b = Tree::var();
+    Deck d(max(min(sin(Tree::X()), a * Tree::Y()), b));
+
+    // Variables are numbered in vars.left order
+    std::map<Tree::Id, uint32_t> index;
+    for (auto& v : d.vars.left)
+    {
+        index.insert({v.second, index.size()});
+    }
+    auto deps = [&](Clause::Id c) {
+        return std::vector<uint32_t>(d.deps.begin() + d.depsBegin(c),
+                                     d.deps.begin() + d.depsEnd(c));
+    };
+
+    // Each variable depends on itself
+    auto ca = d.vars.right.at(a.id());
+    auto cb = d.vars.right.at(b.id());
+    REQUIRE(deps(ca) == std::vector<uint32_t>{index.at(a.id())});
+    REQUIRE(deps(cb) == std::vector<uint32_t>{index.at(b.id())});
+
+    // The root depends on both, in sorted order
+    auto root = deps(d.tape->root());
+    REQUIRE(root.size() == 2);
+    REQUIRE(root[0] < root[1]);
+
+    // Other clauses only store what they depend on
+    auto check = [&](Opcode::Opcode op, Clause::Id id,
+                     Clause::Id, Clause::Id)
+    {
+        if (op == Opcode::OP_SIN)
+        {
+            REQUIRE(deps(id).size() == 0);
+        }
+        else if (op == Opcode::OP_MUL || op == Opcode::OP_MIN)
+        {
+            REQUIRE(deps(id) == std::vector<uint32_t>{index.at(a.id())});
+        }
+    };
+    d.tape->walk(check);
+    REQUIRE(deps(d.X).size() == 0);
+    REQUIRE(d.deps.size() == 6);
+}
+
+TEST_CASE("Deck::fork")
+{
+    auto v = Tree::var();
+    Deck d(min(Tree::X() + 5, v * Tree::Y()));
+    auto f = d.fork();
+
+    // Flattened data is shared, rather than being rebuilt
+    REQUIRE(f->tape == d.tape);
+    REQUIRE(&f->constants == &d.constants);
+    REQUIRE(&f->vars == &d.vars);
+    REQUIRE(f->num_clauses == d.num_clauses);
+    REQUIRE(f->X == d.X);
+    REQUIRE(f->Y == d.Y);
+    REQUIRE(f->Z == d.Z);
+    REQUIRE(f->vars.right.at(v.id()) == d.vars.right.at(v.id()));
+}
+
+TEST_CASE("Deck::fork (with oracles)")
+{
+    auto t = convertToOracleAxes(Tree::X() * 2 + Tree::Y());
+    auto d = std::make_shared<Deck>(t);
+    auto f = d->fork();
+
+    // Each Deck gets its own oracle instances
+    REQUIRE(f->oracles.size() == d->oracles.size());
+    REQUIRE(f->oracles.size() == 2);
+    for (unsigned i=0; i < f->oracles.size(); ++i)
+    {
+        REQUIRE(f->oracles[i] != d->oracles[i]);
+    }
+
+    PointEvaluator a(d);
+    PointEvaluator b(f);
+    REQUIRE(a.eval({1, 2, 3}) == 4);
+    REQUIRE(b.eval({1, 2, 3}) == 4);
+}
+
+TEST_CASE("Deck: optimization")
+{
+    auto a = sin(Tree::X());
+    auto b = cos(Tree::Y());
+    auto t = min(a, b) * max(Tree::Z() / 2, a) + min(b, a);
+
+    auto plain = std::make_shared<Deck>(t);
+    auto opt = std::make_shared<Deck>(t, true);
+    REQUIRE(plain->saved == 0);
+    REQUIRE(opt->saved == 1);
+    REQUIRE(opt->tape->size() == plain->tape->size() - 1);
+    REQUIRE(opt->fork()->saved == 1);
+
+    PointEvaluator p(plain);
+    PointEvaluator o(opt);
+    for (auto pt : {Eigen::Vector3f(0, 0, 0), Eigen::Vector3f(1, 2, 3),
+                    Eigen::Vector3f(-1.5, 0.25, -4)})
+    {
+        REQUIRE(o.eval(pt) == p.eval(pt));
+    }
+}
@@ -0,0 +1,131 @@
+/*
+libfive: a CAD kernel for modeling with implicit functions
+
+Copyright (C) 2019  Matt Keeter
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+#include "catch.hpp"
+
+#include "libfive/tree/tree.hpp"
+#include "libfive/eval/eval_adjoint.hpp"
+#include "libfive/eval/eval_jacobian.hpp"
+#include "libfive/eval/deck.hpp"
+
+#include "util/shapes.hpp"
+
+using namespace Kernel;
+
+TEST_CASE("AdjointEvaluator::gradient")
+{
+    SECTION("constant + variable")
+    {
+        auto v = Tree::var();
+        AdjointEvaluator e(v + 1.0, {{v.id(), 3.14}});
+
+        REQUIRE(e.eval({1.0, 2.0, 3.0}) == Approx(4.14));
+        auto g = e.gradient({1, 2, 3});
+        REQUIRE(g.size() == 1);
+        REQUIRE(g.count(v.id()) == 1);
+        REQUIRE(g.at(v.id()) == Approx(1));
+    }
+
+    SECTION("Variable used more than once")
+    {
+        auto v = Tree::var();
+        AdjointEvaluator e(v * v + Tree::X() * v, {{v.id(), 3}});
+
+        auto g = e.gradient({2, 0, 0});
+        REQUIRE(g.at(v.id()) == Approx(8));
+    }
+
+    SECTION("Variable as the root")
+    {
+        auto v = Tree::var();
+        AdjointEvaluator e(v, {{v.id(), 3}});
+
+        auto g = e.gradient({2, 0, 0});
+        REQUIRE(g.at(v.id()) == Approx(1));
+    }
+
+    SECTION("Matches JacobianEvaluator")
+    {
+        auto a = Tree::var();
+        auto b = Tree::var();
+        auto x = Tree::X();
+        std::map<Tree::Id, float> vars = {{a.id(), 0.3}, {b.id(), 1.7}};
+
+        for (unsigned i=7; i < Kernel::Opcode::ORACLE; ++i)
+        {
+            auto op = (Kernel::Opcode::Opcode)i;
+            CAPTURE(Opcode::toString(op));
+            if (op == Opcode::CONST_VAR || op == Opcode::OP_COMPARE)
+            {
+                continue;
+            }
+            Tree t = (Opcode::args(op) == 2)
+                ? Tree(op, a * x + b, b - x * 0.5)
+                : Tree(op, a * x - b * 0.25);
+
+            auto deck = std::make_shared<Deck>(t);
+            AdjointEvaluator adj(deck, vars);
+            JacobianEvaluator jac(deck, vars);
+
+            auto ga = adj.gradient({0.5, 0, 0});
+            auto gj = jac.gradient({0.5, 0, 0});
+            REQUIRE(ga.size() == gj.size());
+            for (auto& g : gj)
+            {
+                CAPTURE(g.second);
+                CAPTURE(ga.at(g.first));
+                if (std::isnan(g.second))
+                {
+                    REQUIRE(std::isnan(ga.at(g.first)));
+                }
+                else
+                {
+                    REQUIRE(ga.at(g.first) == Approx(g.second));
+                }
+            }
+        }
+    }
+
+    SECTION("Many variables")
+    {
+        // sum(v_i * (i + 1)) has gradient i + 1 with respect to v_i
+        std::vector<Tree> vs;
+        std::vector<Tree> terms;
+        std::map<Tree::Id, float> vars;
+        for (unsigned i=0; i < 2000; ++i)
+        {
+            vs.push_back(Tree::var());
+            vars[vs.back().id()] = 1;
+            terms.push_back(vs.back() * (i + 1));
+        }
+
+        // Sum pairwise, since building a long chain of additions is slow
+        while (terms.size() > 1)
+        {
+            std::vector<Tree> next;
+            for (unsigned i=0; i + 1 < terms.size(); i += 2)
+            {
+                next.push_back(terms[i] + terms[i + 1]);
+            }
+            if (terms.size() % 2)
+            {
+                next.push_back(terms.back());
+            }
+            terms = next;
+        }
+
+        AdjointEvaluator e(terms.front(), vars);
+        auto g = e.gradient({0, 0, 0});
+        REQUIRE(g.size() == vs.size());
+        for (unsigned i=0; i < vs.size(); ++i)
+        {
+            REQUIRE(g.at(vs[i].id()) == i + 1);
+        }
+    }
+}
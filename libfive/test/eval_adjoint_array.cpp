@@ -0,0 +1,114 @@
+/*
+libfive: a CAD kernel for modeling with implicit functions
+
+Copyright (C) 2019  Matt Keeter
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+#include "catch.hpp"
+
+#include "libfive/tree/tree.hpp"
+#include "libfive/eval/eval_adjoint.hpp"
+#include "libfive/eval/eval_adjoint_array.hpp"
+#include "libfive/eval/deck.hpp"
+
+using namespace Kernel;
+
+TEST_CASE("AdjointArrayEvaluator::values")
+{
+    auto v = Tree::var();
+    AdjointArrayEvaluator e(Tree::X() * v + Tree::Y(), {{v.id(), 2}});
+
+    for (unsigned i=0; i < AdjointArrayEvaluator::N; ++i)
+    {
+        e.set({float(i), 1, 0}, i);
+    }
+    auto out = e.values(AdjointArrayEvaluator::N);
+    for (unsigned i=0; i < AdjointArrayEvaluator::N; ++i)
+    {
+        REQUIRE(out(i) == Approx(i * 2 + 1));
+    }
+
+    REQUIRE(e.setVar(v.id(), 3));
+    REQUIRE(!e.setVar(v.id(), 3));
+    REQUIRE(e.values(3)(2) == Approx(7));
+}
+
+TEST_CASE("AdjointArrayEvaluator::gradients")
+{
+    SECTION("Variable used more than once")
+    {
+        auto v = Tree::var();
+        AdjointArrayEvaluator e(v * v + Tree::X() * v, {{v.id(), 3}});
+
+        for (unsigned i=0; i < 5; ++i)
+        {
+            e.set({float(i), 0, 0}, i);
+        }
+        e.values(5);
+        auto g = e.gradients(5);
+        REQUIRE(g.rows() == 1);
+        REQUIRE(g.cols() == 5);
+        REQUIRE(e.varIds().size() == 1);
+        REQUIRE(e.varIds()[0] == v.id());
+        for (unsigned i=0; i < 5; ++i)
+        {
+            REQUIRE(g(0, i) == Approx(6 + i));
+        }
+    }
+
+    SECTION("Matches AdjointEvaluator")
+    {
+        auto a = Tree::var();
+        auto b = Tree::var();
+        auto x = Tree::X();
+        std::map<Tree::Id, float> vars = {{a.id(), 0.3}, {b.id(), 1.7}};
+
+        for (unsigned i=7; i < Kernel::Opcode::ORACLE; ++i)
+        {
+            auto op = (Kernel::Opcode::Opcode)i;
+            CAPTURE(Opcode::toString(op));
+            if (op == Opcode::CONST_VAR || op == Opcode::OP_COMPARE)
+            {
+                continue;
+            }
+            Tree t = (Opcode::args(op) == 2)
+                ? Tree(op, a * x + b, b - x * 0.5)
+                : Tree(op, a * x - b * 0.25);
+
+            auto deck = std::make_shared<Deck>(t);
+            AdjointEvaluator point(deck, vars);
+            AdjointArrayEvaluator array(deck, vars);
+
+            const unsigned count = 20;
+            for (unsigned j=0; j < count; ++j)
+            {
+                array.set({j / 10.0f - 1, 0, 0}, j);
+            }
+            array.values(count);
+            auto ga = array.gradients(count);
+
+            for (unsigned j=0; j < count; ++j)
+            {
+                auto gp = point.gradient({j / 10.0f - 1, 0, 0});
+                for (unsigned k=0; k < array.varIds().size(); ++k)
+                {
+                    const float expected = gp.at(array.varIds()[k]);
+                    CAPTURE(j);
+                    CAPTURE(expected);
+                    CAPTURE(ga(k, j));
+                    if (std::isnan(expected))
+                    {
+                        REQUIRE(std::isnan(ga(k, j)));
+                    }
+                    else
+                    {
+                        REQUIRE(ga(k, j) == Approx(expected).margin(1e-6));
+                    }
+                }
+            }
+        }
+    }
+}
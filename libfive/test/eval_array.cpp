@@ -13,6 +13,9 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include "libfive/tree/tree.hpp"
 #include "libfive/eval/eval_array.hpp"
+#include "libfive/eval/eval_interval.hpp"
+#include "libfive/eval/eval_point.hpp"
+#include "libfive/eval/tape.hpp"
 
 using namespace Kernel;
 
@@ -81,6 +84,58 @@ TEST_CASE("ArrayEvaluator::eval")
     }
 }
 
+TEST_CASE("ArrayEvaluator: every opcode")
+{
+    // Compare each kernel against the PointEvaluator, using a count that
+    // isn't a multiple of the SIMD width.  Y is kept positive, since
+    // mod is only defined for positive divisors.
+    const std::vector<Eigen::Vector3f> pts = {
+        {0.5, 0.25, 0}, {-1.5, 2, 0}, {3, 0.75, 0}, {0, 1, 0}, {-2, 3, 0}};
+
+    for (unsigned i=0; i < Opcode::LAST_OP; ++i)
+    {
+        auto op = static_cast<Opcode::Opcode>(i);
+        Tree t = Tree::X();
+        if (Opcode::args(op) == 1)
+        {
+            t = Tree(op, Tree::X());
+        }
+        else if (Opcode::args(op) == 2)
+        {
+            t = (op == Opcode::OP_POW || op == Opcode::OP_NTH_ROOT)
+                ? Tree(op, Tree::X(), 3)
+                : Tree(op, Tree::X(), Tree::Y());
+        }
+        else
+        {
+            continue;
+        }
+        CAPTURE(Opcode::toString(op));
+
+        auto deck = std::make_shared<Deck>(t);
+        ArrayEvaluator a(deck);
+        PointEvaluator p(deck);
+        for (unsigned j=0; j < pts.size(); ++j)
+        {
+            a.set(pts[j], j);
+        }
+        auto out = a.values(pts.size()).eval();
+        for (unsigned j=0; j < pts.size(); ++j)
+        {
+            CAPTURE(pts[j].transpose());
+            const float expected = p.eval(pts[j]);
+            if (std::isnan(expected))
+            {
+                REQUIRE(std::isnan(out(j)));
+            }
+            else
+            {
+                REQUIRE(out(j) == Approx(expected));
+            }
+        }
+    }
+}
+
 TEST_CASE("ArrayEvaluator::setVar")
 {
     // Deliberately construct out of order
@@ -99,6 +154,113 @@ TEST_CASE("ArrayEvaluator::setVar")
     REQUIRE(eval(e, {0, 0, 0}) == Approx(35));
 }
 
+TEST_CASE("ArrayEvaluator::valuesCached")
+{
+    auto a = Tree::var();
+    auto b = Tree::var();
+    auto c = Tree::var();
+    auto t = min(sqrt(square(Tree::X()) + square(Tree::Y())) - a,
+                 max(Tree::Z() * b, Tree::X() - c)) + a * Tree::Y();
+    std::map<Tree::Id, float> vars = {{a.id(), 1}, {b.id(), 2}, {c.id(), 3}};
+
+    auto deck = std::make_shared<Deck>(t);
+    ArrayEvaluator e(deck, vars);
+    ArrayEvaluator ref(deck, vars);
+
+    const std::vector<Eigen::Vector3f> pts = {
+        {0.5, 0.5, 0}, {-1, 2, 0.25}, {3, -1, -2}, {0.1, 0.9, 1.5},
+        {2, 2, 2}};
+    auto setAll = [&](ArrayEvaluator& x) {
+        for (unsigned i=0; i < pts.size(); ++i)
+        {
+            x.set(pts[i], i);
+        }
+    };
+    auto check = [&]() {
+        auto out = e.valuesCached(pts.size()).eval();
+        setAll(ref);
+        auto expected = ref.values(pts.size());
+        for (unsigned i=0; i < pts.size(); ++i)
+        {
+            CAPTURE(i);
+            REQUIRE(out(i) == Approx(expected(i)));
+        }
+    };
+
+    setAll(e);
+    check();
+
+    SECTION("One variable")
+    {
+        for (float v : {0.5f, 2.0f, -1.0f})
+        {
+            e.setVar(a.id(), v);
+            ref.setVar(a.id(), v);
+            check();
+        }
+    }
+
+    SECTION("Several variables")
+    {
+        e.setVar(b.id(), -3);
+        ref.setVar(b.id(), -3);
+        e.setVar(c.id(), 0.5);
+        ref.setVar(c.id(), 0.5);
+        check();
+
+        e.setVar(a.id(), 4);
+        ref.setVar(a.id(), 4);
+        e.setVar(c.id(), -0.5);
+        ref.setVar(c.id(), -0.5);
+        check();
+    }
+
+    SECTION("New points")
+    {
+        e.setVar(b.id(), 5);
+        ref.setVar(b.id(), 5);
+        setAll(e);
+        check();
+
+        // Regular evaluation invalidates the cache
+        e.values(pts.size());
+        e.setVar(a.id(), 0.25);
+        ref.setVar(a.id(), 0.25);
+        check();
+    }
+}
+
+TEST_CASE("ArrayEvaluator::valuesCached: shared downstream clauses")
+{
+    // Exposes the set of clauses re-evaluated by the last call
+    struct ConeEvaluator : public ArrayEvaluator
+    {
+        using ArrayEvaluator::ArrayEvaluator;
+        size_t coneSize() const { return cone.size(); }
+    };
+
+    auto b = Tree::var();
+    auto c = Tree::var();
+    auto t = max(Tree::Z() * b, Tree::X() - c) + Tree::Y();
+    auto deck = std::make_shared<Deck>(t);
+    ConeEvaluator e(deck, {{b.id(), 2}, {c.id(), 3}});
+
+    e.set({1, 2, 3}, 0);
+    e.valuesCached(1);
+
+    e.setVar(b.id(), -1);
+    e.setVar(c.id(), 5);
+    auto out = e.valuesCached(1);
+    REQUIRE(out(0) == Approx(std::max(3 * -1, 1 - 5) + 2));
+
+    // Z * b, X - c, max, and + are each evaluated once
+    const auto& db = deck->downstream(deck->vars.right.at(b.id()));
+    const auto& dc = deck->downstream(deck->vars.right.at(c.id()));
+    REQUIRE(db.size() == 3);
+    REQUIRE(dc.size() == 3);
+    REQUIRE(e.coneSize() == 4);
+}
+
 TEST_CASE("ArrayEvaluator::getAmbiguous")
 {
     ArrayEvaluator e(min(Tree::X(), -Tree::X()));
@@ -118,3 +280,44 @@ TEST_CASE("ArrayEvaluator::getAmbiguous")
     REQUIRE(b(0) == true);
     REQUIRE(b(3) == true);
 }
+
+TEST_CASE("ArrayEvaluator: slot reuse")
+{
+    // Shared subexpressions with long lifetimes, mixed with
+    // short-lived temporaries and min / max clauses that can be pushed
+    auto x = Tree::X();
+    auto y = Tree::Y();
+    auto r = sqrt(square(x) + square(y));
+    Tree t = r - 1;
+    for (unsigned i=0; i < 8; ++i)
+    {
+        t = min(t, max(r - (i + 2), -(x + float(i)) * y));
+    }
+
+    auto deck = std::make_shared<Deck>(t);
+    ArrayEvaluator a(deck);
+    PointEvaluator p(deck);
+    IntervalEvaluator e(deck);
+
+    auto pushed = e.evalAndPush({0.5, 0.5, 0}, {1, 1, 0}).second;
+    REQUIRE(pushed->size() < deck->tape->size());
+
+    const std::vector<Eigen::Vector3f> pts = {
+        {0.5, 0.5, 0}, {0.75, 0.6, 0}, {1, 1, 0}, {0.9, 0.55, 0}};
+    for (unsigned i=0; i < pts.size(); ++i)
+    {
+        a.set(pts[i], i);
+    }
+
+    auto full = a.values(pts.size()).eval();
+    for (unsigned i=0; i < pts.size(); ++i)
+    {
+        REQUIRE(full(i) == Approx(p.eval(pts[i])));
+    }
+
+    auto short_ = a.values(pts.size(), pushed).eval();
+    for (unsigned i=0; i < pts.size(); ++i)
+    {
+        REQUIRE(short_(i) == Approx(p.eval(pts[i])));
+    }
+}
@@ -13,6 +13,8 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include "libfive/tree/tree.hpp"
 #include "libfive/eval/eval_deriv_array.hpp"
+#include "libfive/eval/eval_deriv.hpp"
+#include "libfive/eval/deck.hpp"
 
 using namespace Kernel;
 
@@ -91,6 +93,63 @@ TEST_CASE("DerivArrayEvaluator::derivs")
     }
 }
 
+TEST_CASE("DerivArrayEvaluator: every opcode")
+{
+    // Compare each kernel against the DerivEvaluator, using a count that
+    // isn't a multiple of the SIMD width.  Y is kept positive, since
+    // mod is only defined for positive divisors, and X is kept away from
+    // zero, where some derivatives are singular.
+    const std::vector<Eigen::Vector3f> pts = {
+        {0.5, 0.25, 0}, {-1.5, 2, 0}, {3, 0.75, 0}, {0.25, 1, 0}, {-2, 3, 0}};
+
+    for (unsigned i=0; i < Opcode::LAST_OP; ++i)
+    {
+        auto op = static_cast<Opcode::Opcode>(i);
+        Tree t = Tree::X();
+        if (Opcode::args(op) == 1)
+        {
+            t = Tree(op, Tree::X() * Tree::Y());
+        }
+        else if (Opcode::args(op) == 2)
+        {
+            t = (op == Opcode::OP_POW || op == Opcode::OP_NTH_ROOT)
+                ? Tree(op, Tree::X(), 3)
+                : Tree(op, Tree::X(), Tree::Y());
+        }
+        else
+        {
+            continue;
+        }
+        CAPTURE(Opcode::toString(op));
+
+        auto deck = std::make_shared<Deck>(t);
+        DerivArrayEvaluator a(deck);
+        DerivEvaluator p(deck);
+        for (unsigned j=0; j < pts.size(); ++j)
+        {
+            a.set(pts[j], j);
+        }
+        auto out = a.derivs(pts.size()).eval();
+        for (unsigned j=0; j < pts.size(); ++j)
+        {
+            CAPTURE(pts[j].transpose());
+            const Eigen::Vector4f expected = p.deriv(pts[j]);
+            for (unsigned k=0; k < 4; ++k)
+            {
+                CAPTURE(k);
+                if (std::isnan(expected(k)))
+                {
+                    REQUIRE(std::isnan(out(k, j)));
+                }
+                else
+                {
+                    REQUIRE(out(k, j) == Approx(expected(k)));
+                }
+            }
+        }
+    }
+}
+
 TEST_CASE("DerivArrayEvaluator::getAmbiguousDerivs")
 {
     DerivArrayEvaluator e(min(min(Tree::X(), Tree::Y()),
@@ -140,6 +140,33 @@ TEST_CASE("IntervalEvaluator::evalAndPush")
 
         REQUIRE(ea == eb);
     }
+
+    SECTION("Repeated pushes")
+    {
+        auto t = min(min(Tree::X(), Tree::Y() + 1), Tree::Z() + 2);
+        auto d = std::make_shared<Deck>(t);
+        IntervalEvaluator e(d);
+        PointEvaluator p(d);
+
+        // X wins everywhere in this region
+        auto a = e.evalAndPush({-5, 0, 0}, {-4, 1, 1});
+        REQUIRE(a.second->size() == 0);
+        REQUIRE(p.eval({-4.5, 0.5, 0.5}, a.second) == -4.5);
+
+        // Then push from the base tape into a region where Y + 1 wins,
+        // which must not be affected by the previous push
+        auto b = e.evalAndPush({5, -10, 5}, {6, -9, 6});
+        REQUIRE(b.second->size() == 1);
+        REQUIRE(p.eval({5.5, -9.5, 5.5}, b.second) == -8.5);
+
+        // Nothing can be pruned here, so we get the original tape back
+        auto c = e.evalAndPush({0, -1, -2}, {1, 0, -1});
+        REQUIRE(c.second == d->tape);
+
+        // Pushing the shortened tape again should be a no-op
+        auto b2 = e.evalAndPush({5, -10, 5}, {6, -9, 6}, b.second);
+        REQUIRE(b2.second == b.second);
+    }
 }
 
 TEST_CASE("IntervalEvaluator::isSafe")
@@ -199,3 +226,111 @@ TEST_CASE("IntervalEvaluator::isSafe")
         REQUIRE(!e.isSafe());
     }
 }
+
+TEST_CASE("Interval::Rounding")
+{
+    SECTION("Exact results stay exact")
+    {
+        auto a = Interval::I(1, 2) * Interval::I(3, 4) - Interval::I(1, 1);
+        REQUIRE(a.lower() == 2);
+        REQUIRE(a.upper() == 7);
+
+        auto b = boost::numeric::sqrt(Interval::I(4, 9)) / Interval::I(2, 2);
+        REQUIRE(b.lower() == 1);
+        REQUIRE(b.upper() == 1.5);
+    }
+
+    SECTION("Inexact results are rounded outwards")
+    {
+        const float vs[] = {0.1f, 1/3.0f, 7.0f, 1e-3f, 123.456f, -2.7f};
+        for (float x : vs)
+        {
+            for (float y : vs)
+            {
+                CAPTURE(x);
+                CAPTURE(y);
+                const Interval::I a(x, x), b(y, y);
+
+                auto s = a + b;
+                REQUIRE(s.lower() <= double(x) + double(y));
+                REQUIRE(s.upper() >= double(x) + double(y));
+
+                auto d = a - b;
+                REQUIRE(d.lower() <= double(x) - double(y));
+                REQUIRE(d.upper() >= double(x) - double(y));
+
+                auto m = a * b;
+                REQUIRE(m.lower() <= double(x) * double(y));
+                REQUIRE(m.upper() >= double(x) * double(y));
+
+                // The exact quotient may not be representable as a double,
+                // so check the equivalent products instead.
+                auto q = a / b;
+                if (y > 0)
+                {
+                    REQUIRE(double(q.lower()) * y <= x);
+                    REQUIRE(double(q.upper()) * y >= x);
+                }
+                else
+                {
+                    REQUIRE(double(q.lower()) * y >= x);
+                    REQUIRE(double(q.upper()) * y <= x);
+                }
+            }
+        }
+    }
+
+    SECTION("Overflow")
+    {
+        const float m = std::numeric_limits<float>::max();
+        auto a = Interval::I(m, m) + Interval::I(m, m);
+        REQUIRE(a.lower() == m);
+        REQUIRE(a.upper() == std::numeric_limits<float>::infinity());
+    }
+
+    SECTION("Underflow")
+    {
+        // The exact product is 1e-60, which underflows to zero
+        auto a = Interval::I(1e-30f, 1e-30f) * Interval::I(1e-30f, 1e-30f);
+        REQUIRE(a.lower() <= 0);
+        REQUIRE(a.upper() > 0);
+
+        auto b = Interval::I(-1e-30f, -1e-30f) * Interval::I(1e-30f, 1e-30f);
+        REQUIRE(b.lower() < 0);
+        REQUIRE(b.upper() >= 0);
+
+        auto c = Interval::I(1e-30f, 1e-30f) / Interval::I(1e30f, 1e30f);
+        REQUIRE(c.lower() <= 0);
+        REQUIRE(c.upper() > 0);
+    }
+
+    SECTION("Subnormal results")
+    {
+        const float vs[] = {1e-20f, -3e-20f, 7e-21f, 1e-19f};
+        for (float x : vs)
+        {
+            for (float y : vs)
+            {
+                CAPTURE(x);
+                CAPTURE(y);
+                auto m = Interval::I(x, x) * Interval::I(y, y);
+                REQUIRE(std::abs(double(x) * double(y)) <
+                        std::numeric_limits<float>::min());
+                REQUIRE(m.lower() <= double(x) * double(y));
+                REQUIRE(m.upper() >= double(x) * double(y));
+                REQUIRE(m.lower() < m.upper());
+            }
+        }
+    }
+
+    SECTION("Transcendental functions")
+    {
+        auto e = boost::numeric::exp(Interval::I(1, 1));
+        REQUIRE(e.lower() <= std::exp(1.0));
+        REQUIRE(e.upper() >= std::exp(1.0));
+
+        auto s = boost::numeric::sin(Interval::I(0, 10));
+        REQUIRE(s.lower() == -1);
+        REQUIRE(s.upper() == 1);
+    }
+}
@@ -62,4 +62,40 @@ TEST_CASE("JacobianEvaluator::gradient")
         REQUIRE(g.at(b.id()) == Approx(2.0f));
         REQUIRE(g.at(c.id()) == Approx(3.0f));
     }
+
+    SECTION("Sparse dependencies")
+    {
+        // Each branch depends on a different variable, and c is
+        // disabled by makeVarsConstant
+        auto a = Tree::var();
+        auto b = Tree::var();
+        auto c = Tree::var();
+        auto t = min(Tree::X() * a, Tree::Y() * b) +
+                 (c * Tree::Z()).makeVarsConstant();
+
+        JacobianEvaluator e(t, {{a.id(), 2}, {b.id(), 3}, {c.id(), 4}});
+        {
+            auto g = e.gradient({1, 5, 2});
+            REQUIRE(g.size() == 3);
+            REQUIRE(g.at(a.id()) == Approx(1));
+            REQUIRE(g.at(b.id()) == Approx(0));
+            REQUIRE(g.at(c.id()) == Approx(0));
+        }
+        {
+            auto g = e.gradient({5, 1, 2});
+            REQUIRE(g.at(a.id()) == Approx(0));
+            REQUIRE(g.at(b.id()) == Approx(1));
+            REQUIRE(g.at(c.id()) == Approx(0));
+        }
+
+        // A pushed tape drops the unused branch (and its variable)
+        auto p = e.evalAndPush({5, 1, 2});
+        {
+            auto g = e.gradient({6, 2, 2}, p.second);
+            REQUIRE(g.size() == 3);
+            REQUIRE(g.at(a.id()) == Approx(0));
+            REQUIRE(g.at(b.id()) == Approx(2));
+            REQUIRE(g.at(c.id()) == Approx(0));
+        }
+    }
 }
@@ -7,12 +7,21 @@ This Source Code Form is subject to the terms of the Mozilla Public
 License, v. 2.0. If a copy of the MPL was not distributed with this file,
 You can obtain one at http://mozilla.org/MPL/2.0/.
 */
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
 
 #include "catch.hpp"
 
+#include "libfive/eval/eval_xtree.hpp"
 #include "libfive/render/brep/dc/dc_mesher.hpp"
 #include "libfive/render/brep/dc/dc_pool.hpp"
+#include "libfive/render/brep/dc/dc_refiner.hpp"
 #include "libfive/render/brep/dual.hpp"
 #include "libfive/render/brep/region.hpp"
 #include "libfive/render/brep/mesh.hpp"
@@ -121,6 +130,91 @@ TEST_CASE("Mesh::render (different algorithms)")
     REQUIRE(b->verts.size() >  a->verts.size());
 }
 
+TEST_CASE("Mesh::render (pipelined)")
+{
+    Region<3> r({-2.5, -2.5, -2.5}, {2.5, 2.5, 2.5});
+    for (auto shape : {sphere(1),
+                       max(menger(2), -sphere(1, {1.5, 1.5, 1.5}))})
+    {
+        BRepSettings settings;
+        settings.min_feature = 0.05;
+        settings.max_err = 1e-3;
+        auto a = Mesh::render(shape, r, settings);
+
+        settings.pipelined = true;
+        auto b = Mesh::render(shape, r, settings);
+
+        // Triangles may be produced in a different order,
+        // but the same ones should exist.
+        REQUIRE(b->branes.size() == a->branes.size());
+        REQUIRE(b->verts.size() == a->verts.size());
+        CHECK_EDGE_PAIRS(*b);
+    }
+}
+
+TEST_CASE("DCTree::releaseInterior")
+{
+    Region<3> r({-2.5, -2.5, -2.5}, {2.5, 2.5, 2.5});
+    BRepSettings settings;
+    settings.min_feature = 0.05;
+    settings.workers = 1;
+    XTreeEvaluator eval(sphere(1));
+
+    auto a = DCPool<3>::build(&eval, r, settings);
+
+    // Mesh and release each branch as it's finished, as in a pipelined
+    // Mesh::render, watching the worker's pool as we go
+    auto placeholder = DCTree<3>::empty();
+    std::atomic<uint32_t> index(1);
+    PerThreadBRep<3> brep(index);
+    DCMesher m(brep);
+    int64_t peak = 0;
+    auto b = DCPool<3>::build(&eval, r, settings,
+        [&](DCTree<3>* tree, unsigned, DCTree<3>::Pool& pool)
+        {
+            Dual<3>::work(tree, m);
+            if (tree->parent)
+            {
+                tree->releaseInterior(pool, placeholder.get());
+            }
+            peak = std::max(peak, pool.size());
+        });
+
+    // Released cells are reused, so fewer trees are allocated
+    CAPTURE(a.size());
+    CAPTURE(b.size());
+    REQUIRE(peak < a.size() / 2);
+    REQUIRE(b.size() < a.size() / 2);
+
+    // Released slots point at the placeholder, rather than at cells that
+    // have been reused elsewhere in the tree
+    unsigned placeholders = 0;
+    std::vector<const DCTree<3>*> todo = {b.get()};
+    while (todo.size())
+    {
+        auto t = todo.back();
+        todo.pop_back();
+        if (t->isBranch())
+        {
+            for (unsigned i=0; i < t->children.size(); ++i)
+            {
+                auto c = t->children[i].load();
+                if (c == placeholder.get())
+                {
+                    placeholders++;
+                }
+                else
+                {
+                    REQUIRE(c->parent == t);
+                    REQUIRE(c->parent_index == i);
+                    todo.push_back(c);
+                }
+            }
+        }
+    }
+    REQUIRE(placeholders > 0);
+}
+
 TEST_CASE("Mesh::render (cone)")
 {
     auto z = Tree::Z();
@@ -324,3 +418,226 @@ TEST_CASE("Mesh::render (edge pairing)")
     auto m = Mesh::render(c, r, settings);
     CHECK_EDGE_PAIRS(*m);
 }
+
+/*  Builds a mesh that's large enough to be saved in several blocks */
+static Mesh stripMesh(unsigned count)
+{
+    Mesh m;
+    for (unsigned i=0; i < count; ++i)
+    {
+        auto a = m.pushVertex({float(i), 0, 0});
+        auto b = m.pushVertex({float(i) + 1, 0, 0});
+        auto c = m.pushVertex({float(i), 1, 0});
+        m.branes.push_back({a, b, c});
+    }
+    return m;
+}
+
+static std::vector<char> readFile(const std::string& filename)
+{
+    std::ifstream in(filename, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(in),
+                             std::istreambuf_iterator<char>());
+}
+
+TEST_CASE("Mesh::saveSTL")
+{
+    const unsigned count = 100000;
+    auto m = stripMesh(count);
+    REQUIRE(m.saveSTL(".libfive_mesh.stl", 4));
+
+    auto data = readFile(".libfive_mesh.stl");
+    std::remove(".libfive_mesh.stl");
+    REQUIRE(data.size() == 84 + 50 * count);
+
+    uint32_t num;
+    memcpy(&num, &data[80], sizeof(num));
+    REQUIRE(num == count);
+
+    for (unsigned i : {0u, count / 2, count - 1})
+    {
+        CAPTURE(i);
+        float fs[12];
+        memcpy(fs, &data[84 + 50 * i], sizeof(fs));
+
+        // Normal
+        REQUIRE(fs[0] == 0);
+        REQUIRE(fs[1] == 0);
+        REQUIRE(fs[2] == 1);
+
+        // Vertices
+        REQUIRE(fs[3] == i);
+        REQUIRE(fs[6] == i + 1);
+        REQUIRE(fs[10] == 1);
+    }
+}
+
+TEST_CASE("Mesh::savePLY")
+{
+    const unsigned count = 100000;
+    auto a = stripMesh(count);
+    auto b = stripMesh(2);
+    REQUIRE(Mesh::savePLY(".libfive_mesh.ply", {&a, &b}, 4));
+
+    auto data = readFile(".libfive_mesh.ply");
+    std::remove(".libfive_mesh.ply");
+
+    const std::string end = "end_header\n";
+    auto e = std::search(data.begin(), data.end(), end.begin(), end.end());
+    REQUIRE(e != data.end());
+    const std::string header(data.begin(), e);
+    const size_t start = header.size() + end.size();
+
+    const unsigned num_verts = 3 * (count + 2);
+    const unsigned num_tris = count + 2;
+    REQUIRE(header.find("element vertex " + std::to_string(num_verts))
+            != std::string::npos);
+    REQUIRE(header.find("element face " + std::to_string(num_tris))
+            != std::string::npos);
+    REQUIRE(data.size() == start + 12 * num_verts + 13 * num_tris);
+
+    // The last vertex is the third corner of the last triangle in b
+    float v[3];
+    memcpy(v, &data[start + 12 * (num_verts - 1)], sizeof(v));
+    REQUIRE(v[0] == 1);
+    REQUIRE(v[1] == 1);
+
+    // Faces in b are offset by the vertices in a
+    const size_t faces = start + 12 * num_verts;
+    REQUIRE(data[faces + 13 * (num_tris - 1)] == 3);
+    uint32_t is[3];
+    memcpy(is, &data[faces + 13 * (num_tris - 1) + 1], sizeof(is));
+    REQUIRE(is[0] == num_verts - 3);
+    REQUIRE(is[1] == num_verts - 2);
+    REQUIRE(is[2] == num_verts - 1);
+
+    memcpy(is, &data[faces + 13 * (count - 1) + 1], sizeof(is));
+    REQUIRE(is[0] == 3 * (count - 1));
+}
+
+TEST_CASE("Mesh::renderTiled")
+{
+    Region<3> r({-2.5, -2.5, -2.5}, {2.5, 2.5, 2.5});
+    for (auto shape : {sphere(1),
+                       max(menger(2), -sphere(1, {1.5, 1.5, 1.5}))})
+    {
+        BRepSettings settings;
+        settings.min_feature = 0.05;
+        settings.max_err = 1e-3;
+        auto a = Mesh::render(shape, r, settings);
+
+        // 7 octree levels, split into 8 x 8 x 8 bricks of 4 levels each
+        REQUIRE(Mesh::renderTiled(shape, r, settings,
+                                  ".libfive_tiled.stl", 4));
+        auto data = readFile(".libfive_tiled.stl");
+        std::remove(".libfive_tiled.stl");
+
+        uint32_t num;
+        memcpy(&num, &data[80], sizeof(num));
+        REQUIRE(data.size() == 84 + 50 * num);
+
+        // Weld vertices by position, which should give a watertight mesh
+        Mesh b;
+        std::map<std::array<float, 3>, uint32_t> indices;
+        for (unsigned i=0; i < num; ++i)
+        {
+            float fs[12];
+            memcpy(fs, &data[84 + 50 * i], sizeof(fs));
+
+            Eigen::Matrix<uint32_t, 3, 1> t;
+            for (unsigned j=0; j < 3; ++j)
+            {
+                std::array<float, 3> v = {{fs[3 * j + 3], fs[3 * j + 4],
+                                           fs[3 * j + 5]}};
+                auto itr = indices.find(v);
+                if (itr == indices.end())
+                {
+                    itr = indices.insert({v, b.pushVertex(
+                                {v[0], v[1], v[2]})}).first;
+                }
+                t[j] = itr->second;
+            }
+            b.branes.push_back(t);
+        }
+        CHECK_EDGE_PAIRS(b);
+
+        // Cells can't collapse across bricks, but this should otherwise
+        // be close to the untiled mesh.
+        CAPTURE(a->branes.size());
+        CAPTURE(b.branes.size());
+        REQUIRE(b.branes.size() >= a->branes.size());
+        REQUIRE(b.branes.size() < a->branes.size() * 1.1);
+    }
+}
+
+TEST_CASE("Mesh::renderTiled (cancelled)")
+{
+    Region<3> r({-2.5, -2.5, -2.5}, {2.5, 2.5, 2.5});
+    BRepSettings settings;
+    settings.min_feature = 0.05;
+    settings.cancel.store(true);
+
+    // The partial file is removed, rather than left with a bad header
+    REQUIRE(!Mesh::renderTiled(sphere(1), r, settings,
+                               ".libfive_tiled.stl", 4));
+    REQUIRE(!std::ifstream(".libfive_tiled.stl").good());
+}
+
+TEST_CASE("DCRefiner")
+{
+    // Two spheres, one of which has a variable radius
+    auto v = Tree::var();
+    auto shape = min(sphere(0.5, {-1, 0, 0}),
+                     sqrt(square(Tree::X() - 1) + square(Tree::Y()) +
+                          square(Tree::Z())) - v);
+    Region<3> r({-2, -2, -2}, {2, 2, 2});
+    std::map<Tree::Id, float> vars = {{v.id(), 0.5}};
+
+    BRepSettings settings;
+    std::vector<XTreeEvaluator, Eigen::aligned_allocator<XTreeEvaluator>> es;
+    for (unsigned i=0; i < settings.workers; ++i)
+    {
+        es.emplace_back(XTreeEvaluator(shape, vars));
+    }
+
+    // Each refined mesh should match a mesh rendered from scratch
+    DCRefiner refiner;
+    auto check = [&]()
+    {
+        auto a = refiner.render(es.data(), r, settings, vars);
+        auto b = Mesh::render(es.data(), r, settings);
+        REQUIRE(a.get() != nullptr);
+        CHECK_EDGE_PAIRS(*a);
+        REQUIRE(a->branes.size() == b->branes.size());
+        REQUIRE(a->verts.size() == b->verts.size());
+    };
+
+    settings.min_feature = 0.2;
+    check();
+    REQUIRE(refiner.rebuilt() == -1);
+
+    // Increasing resolution only subdivides leaf cells
+    settings.min_feature = 0.1;
+    check();
+    const int refined = refiner.rebuilt();
+    REQUIRE(refined > 0);
+
+    // Nothing has changed, so nothing is rebuilt
+    check();
+    REQUIRE(refiner.rebuilt() == 0);
+
+    // Changing the variable only rebuilds cells near the second sphere
+    vars[v.id()] = 0.7;
+    for (auto& e : es)
+    {
+        e.updateVars(vars);
+    }
+    check();
+    REQUIRE(refiner.rebuilt() > 0);
+    REQUIRE(refiner.rebuilt() < refined);
+
+    // Reducing resolution starts from scratch
+    settings.min_feature = 0.2;
+    check();
+    REQUIRE(refiner.rebuilt() == -1);
+}
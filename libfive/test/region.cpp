@@ -187,6 +187,15 @@ TEST_CASE("Region<3>::withResolution")
     REQUIRE(r.withResolution(0.9).level == 2);
 }
 
+TEST_CASE("Region<3>::withLevel")
+{
+    Region<3> r({-1, -1, -1}, {1, 1, 1}, Region<3>::Perp(), 5);
+    auto out = r.withLevel(3);
+    REQUIRE(out.level == 3);
+    REQUIRE((out.lower == r.lower).all());
+    REQUIRE((out.upper == r.upper).all());
+}
+
 TEST_CASE("Region<2>::intersection")
 {
     Region<2> r({0, 0}, {1, 1});
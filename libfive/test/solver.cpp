@@ -11,6 +11,7 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include "libfive/tree/tree.hpp"
 #include "libfive/solve/solver.hpp"
+#include "libfive/eval/deck.hpp"
 
 using namespace Kernel;
 
@@ -82,6 +83,26 @@ TEST_CASE("Solver::findRoot")
         }
     }
 
+    SECTION("Evaluator overloads")
+    {
+        auto a = Tree::var();
+        auto b = Tree::var();
+        auto t = a*a + b*b - 1;
+        std::map<Tree::Id, float> vars = {{a.id(), 3}, {b.id(), 5}};
+        auto deck = std::make_shared<Deck>(t);
+
+        JacobianEvaluator j(deck, vars);
+        auto out_j = Solver::findRoot(j, deck->tape, vars);
+
+        AdjointEvaluator e(deck, vars);
+        auto out_e = Solver::findRoot(e, deck->tape, vars);
+
+        REQUIRE(out_j.first == Approx(0));
+        REQUIRE(out_e.first == Approx(0));
+        REQUIRE(out_j.second.at(a.id()) == Approx(out_e.second.at(a.id())));
+        REQUIRE(out_j.second.at(b.id()) == Approx(out_e.second.at(b.id())));
+    }
+
     SECTION("Sum-of-squares performance")
     {
         // Constraint solving as sum-of-squares optimization
@@ -117,3 +138,74 @@ TEST_CASE("Solver::findRoot")
         REQUIRE(vals.size() == 6);
     }
 }
+
+TEST_CASE("Solver::findRoots")
+{
+    auto x = Tree::X();
+    auto y = Tree::Y();
+
+    SECTION("Circle fit")
+    {
+        // Fit a circle to points sampled from one with center (1, -2)
+        // and radius 3, using enough points to need multiple batches.
+        auto cx = Tree::var();
+        auto cy = Tree::var();
+        auto r = Tree::var();
+        auto t = sqrt(square(x - cx) + square(y - cy)) - r;
+
+        std::vector<Eigen::Vector3f> pts;
+        for (unsigned i=0; i < 1000; ++i)
+        {
+            const float a = i * 2 * M_PI / 1000;
+            pts.push_back({1 + 3 * cosf(a), -2 + 3 * sinf(a), 0});
+        }
+
+        auto out = Solver::findRoots(t,
+                {{cx.id(), 0}, {cy.id(), 0}, {r.id(), 1}}, pts);
+        REQUIRE(out.first < 1e-6);
+        REQUIRE(out.second.size() == 3);
+        REQUIRE(out.second.at(cx.id()) == Approx(1).margin(1e-4));
+        REQUIRE(out.second.at(cy.id()) == Approx(-2).margin(1e-4));
+        REQUIRE(out.second.at(r.id()) == Approx(3).margin(1e-4));
+    }
+
+    SECTION("Least-squares residual")
+    {
+        // A single offset can't zero every point, so it should settle
+        // at the mean with a known residual.
+        auto v = Tree::var();
+        std::vector<Eigen::Vector3f> pts = {{0, 0, 0}, {1, 0, 0}, {2, 0, 0}};
+        auto out = Solver::findRoots(x - v, {{v.id(), 5}}, pts);
+        REQUIRE(out.second.at(v.id()) == Approx(1));
+        REQUIRE(out.first == Approx(2));
+    }
+
+    SECTION("Mask")
+    {
+        auto a = Tree::var();
+        auto b = Tree::var();
+        std::vector<Eigen::Vector3f> pts = {{0, 0, 0}, {1, 0, 0}};
+        auto out = Solver::findRoots(a * x + b - x * 2 - 1,
+                {{a.id(), 0}, {b.id(), 3}}, pts, {b.id()});
+        REQUIRE(out.second.size() == 1);
+        REQUIRE(out.second.count(b.id()) == 0);
+        REQUIRE(out.second.at(a.id()) == Approx(0).margin(1e-4));
+    }
+
+    SECTION("Multi-start")
+    {
+        // (v^2 - 4)^2 + (v - 2)^2 has a local minimum near v = -1.7,
+        // so only the start on the right side reaches the root at v = 2.
+        auto v = Tree::var();
+        std::vector<Eigen::Vector3f> pts = {{0, 0, 0}};
+        auto t = square(square(v) - 4) + square(v - 2);
+
+        auto local = Solver::findRoots(t, {{v.id(), -3}}, pts);
+        REQUIRE(local.first > 1);
+
+        auto out = Solver::findRootsMultiStart(t,
+                {{{v.id(), -3}}, {{v.id(), 3}}}, pts);
+        REQUIRE(out.first < 1e-6);
+        REQUIRE(out.second.at(v.id()) == Approx(2).margin(1e-3));
+    }
+}
@@ -0,0 +1,142 @@
+/*
+libfive: a CAD kernel for modeling with implicit functions
+Copyright (C) 2019  Matt Keeter
+
+This Source Code Form is subject to the terms of the Mozilla Public
+License, v. 2.0. If a copy of the MPL was not distributed with this file,
+You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+#include "catch.hpp"
+
+#include "libfive/tree/tree.hpp"
+#include "libfive/eval/deck.hpp"
+#include "libfive/eval/tape.hpp"
+#include "libfive/eval/tape_cache.hpp"
+#include "libfive/eval/eval_interval.hpp"
+
+using namespace Kernel;
+
+TEST_CASE("TapeCache: LRU eviction")
+{
+    Deck d(min(Tree::X(), Tree::Y()) + 1);
+    const auto n = d.tape->size();
+
+    // Room for exactly three copies of the tape
+    TapeCache c(n * 3);
+    auto key = [](float f) {
+        return TapeCache::Key{0, {{f, 0, 0, 1, 1, 1}}, {}};
+    };
+    for (unsigned i=0; i < 3; ++i)
+    {
+        c.insert(key(i), {Interval::I(i, i + 1), true, d.tape});
+    }
+    REQUIRE(c.size() == 3);
+
+    // Looking up the oldest entry marks it as recently used
+    TapeCache::Entry e;
+    REQUIRE(c.find(key(0), e));
+    REQUIRE(e.result.lower() == 0);
+    REQUIRE(e.tape == d.tape);
+
+    // So inserting a fourth entry evicts the second one
+    c.insert(key(3), {Interval::I(3, 4), true, d.tape});
+    REQUIRE(c.size() == 3);
+    REQUIRE(c.find(key(0), e));
+    REQUIRE(!c.find(key(1), e));
+    REQUIRE(c.find(key(2), e));
+    REQUIRE(c.find(key(3), e));
+
+    c.setCapacity(n);
+    REQUIRE(c.size() == 1);
+    REQUIRE(c.find(key(3), e));
+
+    c.setCapacity(0);
+    REQUIRE(c.size() == 0);
+    c.insert(key(0), {Interval::I(0, 1), true, d.tape});
+    REQUIRE(c.size() == 0);
+}
+
+TEST_CASE("TapeCache: sharing between forked Decks")
+{
+    auto a = Tree::var();
+    auto deck = std::make_shared<Deck>(min(Tree::X() - a, Tree::Y()));
+    auto fork = deck->fork();
+    REQUIRE(&fork->cache == &deck->cache);
+    deck->cache.setCapacity(TapeCache::TYPICAL_CAPACITY);
+
+    IntervalEvaluator e(deck, {{a.id(), 0}});
+    IntervalEvaluator f(fork, {{a.id(), 0}});
+
+    auto p = e.evalAndPush({-2, 1, 0}, {-1, 2, 0});
+    REQUIRE(p.second != deck->tape);
+    REQUIRE(p.second->size() < deck->tape->size());
+
+    // The other Deck finds the same tape for the same region
+    auto q = f.evalAndPush({-2, 1, 0}, {-1, 2, 0});
+    REQUIRE(q.second == p.second);
+    REQUIRE(q.first.lower() == p.first.lower());
+    REQUIRE(q.first.upper() == p.first.upper());
+
+    // Cached tapes aren't recycled, since others may be using them
+    fork->claim(q.second);
+    auto r = f.evalAndPush({-3, 1, 0}, {-2, 2, 0});
+    REQUIRE(r.second != q.second);
+
+    SECTION("Different variables")
+    {
+        f.setVar(a.id(), 10);
+        auto s = f.evalAndPush({-2, 1, 0}, {-1, 2, 0});
+        REQUIRE(s.second != p.second);
+        REQUIRE(s.first.upper() != p.first.upper());
+    }
+
+    SECTION("Disabled cache")
+    {
+        deck->cache.setCapacity(0);
+        auto s = f.evalAndPush({-2, 1, 0}, {-1, 2, 0});
+        REQUIRE(s.second != p.second);
+        REQUIRE(s.second->size() == p.second->size());
+    }
+}
+
+TEST_CASE("TapeCache: disabled by default")
+{
+    auto deck = std::make_shared<Deck>(min(Tree::X(), Tree::Y()));
+    REQUIRE(deck->cache.capacity() == 0);
+
+    IntervalEvaluator e(deck);
+    e.evalAndPush({-2, 1, 0}, {-1, 2, 0});
+    REQUIRE(deck->cache.size() == 0);
+}
+
+TEST_CASE("TapeCache: recycled parent tapes")
+{
+    auto deck = std::make_shared<Deck>(
+            min(min(Tree::X(), Tree::Y()), Tree::Z()));
+    deck->cache.setCapacity(TapeCache::TYPICAL_CAPACITY);
+    IntervalEvaluator e(deck);
+
+    // Push without the cache, leaving min(X, Y)
+    e.eval({0, 0, 5}, {1, 1, 6});
+    auto t1 = e.push();
+    REQUIRE(!t1->isTerminal());
+    const auto ptr = t1.get();
+    const auto serial = t1->serial();
+
+    // This region picks X from t1, and is stored in the cache
+    auto p = e.evalAndPush({0, 5, 2}, {1, 6, 3}, t1);
+    REQUIRE(p.first.lower() == 0);
+    REQUIRE(deck->cache.size() == 1);
+
+    // Recycle t1, then build min(Y, Z) at the same address
+    deck->claim(t1);
+    e.eval({5, 0, 0}, {6, 1, 1});
+    auto t2 = e.push();
+    REQUIRE(t2.get() == ptr);
+    REQUIRE(t2->serial() != serial);
+
+    // The stale entry for t1 must not be returned:  this should be Z
+    auto q = e.evalAndPush({0, 5, 2}, {1, 6, 3}, t2);
+    REQUIRE(q.first.lower() == 2);
+    REQUIRE(q.first.upper() == 3);
+}
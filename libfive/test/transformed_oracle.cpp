@@ -50,17 +50,18 @@ void compareUnderTransformation(Tree oracleTree, Tree controlTree,
             o.set(testPoints[i], i);
             c.set(testPoints[i], i);
         }
+        auto oResults = o.derivs(testPoints.size());
+        auto cResults = c.derivs(testPoints.size());
         /*  getAmbiguous is numerically unstable, so unfortunately it
          *  cannot be tested.  We still calculate it, though, since
          *  when either is ambiguous that means the derivatives cannot be
          *  tested either except via features, since there is more than one
-         *  possible correct answer.
+         *  possible correct answer.  (It must be called after evaluation,
+         *  since ambiguity is recorded during the tape walk.)
          */
         auto oAmbig = o.getAmbiguous(testPoints.size());
         auto cAmbig = c.getAmbiguous(testPoints.size());
         ambigPoints.head(testPoints.size()) = oAmbig && cAmbig;
-        auto oResults = o.derivs(testPoints.size());
-        auto cResults = c.derivs(testPoints.size());
         for (unsigned i = 0; i < testPoints.size(); ++i)
         {
             CAPTURE(i);
@@ -10,9 +10,11 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 #include "catch.hpp"
 
 #include <array>
+#include <set>
 #include <future>
 
 #include "libfive/tree/tree.hpp"
+#include "libfive/tree/cache.hpp"
 #include "util/oracles.hpp"
 
 using namespace Kernel;
@@ -112,6 +114,150 @@ TEST_CASE("Tree::deserialize")
     }
 }
 
+TEST_CASE("Tree::flat")
+{
+    SECTION("Shared subtrees")
+    {
+        auto a = Tree::X() * 2;
+        auto b = sin(a) + cos(a);
+        auto t = min(b, max(b, Tree::Y()));
+
+        auto f = t.flat();
+        REQUIRE(f.back()->get() == t.id());
+
+        // Each node appears once, after its arguments
+        std::map<Tree::Id, unsigned> index;
+        for (unsigned i=0; i < f.size(); ++i)
+        {
+            const auto& n = *f[i];
+            REQUIRE(index.insert({n.get(), i}).second);
+            for (auto c : {n->lhs.get(), n->rhs.get()})
+            {
+                if (c)
+                {
+                    REQUIRE(index.count(c) == 1);
+                }
+            }
+        }
+
+        // X, Y, 2, a, sin, cos, b, max, min
+        REQUIRE(f.size() == 9);
+        for (unsigned i=1; i < f.size(); ++i)
+        {
+            REQUIRE((*f[i - 1])->rank <= (*f[i])->rank);
+        }
+    }
+
+    SECTION("Large tree")
+    {
+        // A long chain with lots of shared leaves
+        auto t = Tree::X();
+        for (unsigned i=0; i < 10000; ++i)
+        {
+            t = t * (Tree::Y() + (i % 100));
+        }
+        auto f = t.flat();
+        REQUIRE(f.back()->get() == t.id());
+
+        std::set<Tree::Id> unique;
+        for (auto n : f)
+        {
+            unique.insert(n->get());
+        }
+        REQUIRE(unique.size() == f.size());
+    }
+
+    SECTION("Invalid tree")
+    {
+        REQUIRE(Tree::Invalid().flat().size() == 0);
+    }
+}
+
+TEST_CASE("Tree: destroying deep trees")
+{
+    const auto before = Cache::instance()->size();
+    {
+        // A chain this deep would overflow the stack if its nodes
+        // were destroyed recursively
+        auto t = Tree::X();
+        Tree mid = t;
+        for (unsigned i=0; i < 1000000; ++i)
+        {
+            t = sin(t);
+            if (i == 1000)
+            {
+                mid = t;
+            }
+        }
+        REQUIRE(Cache::instance()->size() >= before + 1000000);
+
+        // Dropping the top of the chain leaves the part that is still
+        // referenced intact
+        t = Tree::Y();
+        REQUIRE(mid->rank == 1001);
+        REQUIRE(Cache::instance()->size() < before + 1010);
+    }
+
+    // Every dead node is removed from the Cache
+    REQUIRE(Cache::instance()->size() == before);
+}
+
+TEST_CASE("Tree::optimized")
+{
+    SECTION("Strength reduction")
+    {
+        auto a = Tree(Opcode::OP_POW, Tree::X(), 2).optimized();
+        REQUIRE(a->op == Opcode::OP_SQUARE);
+        REQUIRE(a->lhs.get() == Tree::X().id());
+
+        auto b = Tree(Opcode::OP_POW, Tree::X(), 1).optimized();
+        REQUIRE(b == Tree::X());
+
+        auto c = (sin(Tree::X()) * sin(Tree::X())).optimized();
+        REQUIRE(c->op == Opcode::OP_SQUARE);
+
+        auto d = (Tree::X() / 4).optimized();
+        REQUIRE(d->op == Opcode::OP_MUL);
+        auto k = (d->lhs->op == Opcode::CONSTANT) ? d->lhs : d->rhs;
+        REQUIRE(k->op == Opcode::CONSTANT);
+        REQUIRE(k->value == 0.25);
+    }
+
+    SECTION("Commutative operations")
+    {
+        auto a = sin(Tree::X());
+        auto b = cos(Tree::Y());
+        auto t = (min(a, b) * min(b, a)).optimized();
+        REQUIRE(t->op == Opcode::OP_SQUARE);
+    }
+
+    SECTION("Balancing chains")
+    {
+        auto t = sin(Tree::X());
+        for (unsigned i=1; i < 16; ++i)
+        {
+            t = max(t, sin(Tree::X() + i));
+        }
+        REQUIRE(t->rank > 6);
+
+        auto o = t.optimized();
+        REQUIRE(o->op == Opcode::OP_MAX);
+        REQUIRE(o->rank == 6);
+        REQUIRE(o.flat().size() == t.flat().size());
+    }
+
+    SECTION("Shared links in a chain")
+    {
+        // a is used outside of the chain, so it must not be duplicated
+        // when the chain is rebuilt
+        auto a = min(sin(Tree::X()), cos(Tree::Y()));
+        auto t = min(min(a, Tree::Z()), Tree::X()) + a;
+        auto o = t.optimized();
+        REQUIRE(o.flat().size() <= t.flat().size());
+        REQUIRE(o->op == Opcode::OP_ADD);
+    }
+}
+
 TEST_CASE("Tree::remap")
 {
     SECTION("Simple")
@@ -176,8 +322,8 @@ TEST_CASE("Tree::makeVarsConstant")
 
 TEST_CASE("Tree thread safety")
 {
-    // This test is only valid in debug builds, because it checks an
-    // assertion in Cache::del.
+    // Constructing and destroying the same node from multiple threads
+    // races on the Cache entry, which must be left in a consistent state.
     std::array<std::future<void>, 2> futures;
     for (unsigned i=0; i < futures.size(); ++i)
     {
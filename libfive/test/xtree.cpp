@@ -13,8 +13,10 @@ You can obtain one at http://mozilla.org/MPL/2.0/.
 
 #include "libfive/eval/eval_xtree.hpp"
 #include "libfive/render/brep/settings.hpp"
+#include "libfive/render/brep/edge_search.hpp"
 #include "libfive/render/brep/dc/dc_tree.hpp"
 #include "libfive/render/brep/dc/dc_pool.hpp"
+#include "libfive/render/brep/dc/dc_neighbors.hpp"
 #include "libfive/render/axes.hpp"
 #include "util/shapes.hpp"
 
@@ -91,6 +93,22 @@ TEST_CASE("DCTree<2>::isBranch")
                                   BRepSettings());
         REQUIRE(t->isBranch());
     }
+
+    SECTION("With a fixed level")
+    {
+        // The region's level overrides min_feature, so the root is only
+        // subdivided once, even though min_feature would allow more.
+        BRepSettings settings;
+        settings.max_err = -1;
+        auto t = DCPool<2>::build(circle(0.5),
+                                  Region<2>({-1, -1}, {1, 1}).withLevel(1),
+                                  settings);
+        REQUIRE(t->isBranch());
+        for (auto& c : t->children)
+        {
+            REQUIRE(!c.load()->isBranch());
+        }
+    }
 }
 
 TEST_CASE("DCTree<2>::rank()")
@@ -237,6 +255,151 @@ TEST_CASE("DCTree<3>::vert")
     }
 }
 
+TEST_CASE("DCTree<3>::evalLeaves")
+{
+    // Batched evaluation of a level-2 cell's leaves should match evaluating
+    // each leaf on its own (in the same order, with the same neighbors).
+    // Some children are ambiguous, and the rest are empty.
+    auto s = min(max(sphere(0.45, {0.5, 0.5, 0.4}), -circle(0.2, {0.5, 0.5})),
+                 box({-0.9, -0.9, -0.9}, {-0.6, -0.6, -0.2}));
+    XTreeEvaluator eval(s);
+    Region<3> r({-1, -1, -1}, {1, 1, 1}, Region<3>::Perp(), 2);
+    auto rs = r.subdivide();
+
+    DCTree<3>::Pool pool;
+    DCTree<3> batched(nullptr, 0, r);
+    DCTree<3> single(nullptr, 0, r);
+
+    std::array<Tape::Handle, 8> tapes;
+    std::array<std::array<DCTree<3>*, 8>, 8> bs;
+    std::array<DCTree<3>*, 8> ss;
+    unsigned ambiguous = 0;
+    for (unsigned i=0; i < 8; ++i)
+    {
+        auto b = pool.get(&batched, i, rs[i]);
+        tapes[i] = b->evalInterval(&eval, eval.deck->tape, rs[i], pool);
+        ss[i] = pool.get(&single, i, rs[i]);
+        ss[i]->evalInterval(&eval, eval.deck->tape, rs[i], pool);
+        REQUIRE(b->type == ss[i]->type);
+
+        bs[i].fill(nullptr);
+        if (b->type == Interval::AMBIGUOUS)
+        {
+            ambiguous++;
+            auto cs = rs[i].subdivide();
+            for (unsigned j=0; j < 8; ++j)
+            {
+                bs[i][j] = pool.get(b, j, cs[j]);
+            }
+        }
+    }
+    REQUIRE(ambiguous > 0);
+    REQUIRE(ambiguous < 8);
+    batched.evalLeaves(&eval, eval.deck->tape, r, tapes, bs, pool,
+                       DCNeighbors<3>(), BRepSettings().edge_tolerance);
+
+    const auto ns = DCNeighbors<3>();
+    for (unsigned i=0; i < 8; ++i)
+    {
+        if (bs[i][0] == nullptr)
+        {
+            continue;
+        }
+        auto cs = rs[i].subdivide();
+        auto n = ns.push(i, single.children);
+        for (unsigned j=0; j < 8; ++j)
+        {
+            auto t = pool.get(ss[i], j, cs[j]);
+            t->evalLeaf(&eval, tapes[i], cs[j], pool,
+                        n.push(j, ss[i]->children),
+                        BRepSettings().edge_tolerance);
+
+            CAPTURE(i);
+            CAPTURE(j);
+            REQUIRE(bs[i][j]->type == t->type);
+            for (unsigned k=0; k < 8; ++k)
+            {
+                CAPTURE(k);
+                REQUIRE(bs[i][j]->cornerState(k) == t->cornerState(k));
+            }
+            if (t->type == Interval::AMBIGUOUS)
+            {
+                REQUIRE(bs[i][j]->leaf->vertex_count ==
+                        t->leaf->vertex_count);
+                for (unsigned k=0; k < t->leaf->vertex_count; ++k)
+                {
+                    REQUIRE((bs[i][j]->vert(k) - t->vert(k)).norm() < 1e-6);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("searchEdges")
+{
+    // Edges through a sphere (with a sharp corner from the box)
+    // should be narrowed to a tight pair straddling the surface.
+    auto s = max(sphere(0.7), -box({-1, -1, -1}, {0, 0, 0.3}));
+    XTreeEvaluator eval(s);
+    Region<3> r({-1, -1, -1}, {1, 1, 1});
+
+    const double tolerance = 1e-5;
+    std::array<std::pair<Eigen::Vector3d, Eigen::Vector3d>, 4> targets = {{
+        {{0, 0, 0.5}, {0, 0, 1}},
+        {{0.1, 0.1, 0.5}, {1, 1, 0.5}},
+        {{0.5, 0.1, 0}, {0.5, -1, 0}},
+        {{0.4, 0.2, 0.4}, {0.4, 0.2, -0.6}},
+    }};
+    auto start = targets;
+    searchEdges<3>(&eval, eval.deck->tape, r, targets.data(),
+                   targets.size(), tolerance);
+
+    for (unsigned i=0; i < targets.size(); ++i)
+    {
+        CAPTURE(i);
+        const double len = (start[i].second - start[i].first).norm();
+        REQUIRE((targets[i].second - targets[i].first).norm()
+                <= tolerance * len * 1.01);
+        REQUIRE(eval.feature.isInside<3>(targets[i].first, r,
+                                         eval.deck->tape));
+        REQUIRE(!eval.feature.isInside<3>(targets[i].second, r,
+                                          eval.deck->tape));
+    }
+}
+
+TEST_CASE("DCPool<3>::build (multiple workers)")
+{
+    // Work stealing changes which thread builds each cell, but the
+    // resulting tree should be the same as with a single worker.
+    auto s = max(sphere(1), -circle(0.5));
+    Region<3> r({-2, -2, -2}, {2, 2, 2});
+
+    BRepSettings settings;
+    settings.min_feature = 0.1;
+    settings.workers = 1;
+    auto a = DCPool<3>::build(s, r, settings);
+    settings.workers = 8;
+    auto b = DCPool<3>::build(s, r, settings);
+
+    std::list<std::pair<const DCTree<3>*, const DCTree<3>*>> todo =
+        {{a.get(), b.get()}};
+    while (todo.size())
+    {
+        auto t = todo.front();
+        todo.pop_front();
+        REQUIRE(t.first->type == t.second->type);
+        REQUIRE(t.first->isBranch() == t.second->isBranch());
+        if (t.first->isBranch())
+        {
+            for (unsigned i=0; i < 8; ++i)
+            {
+                todo.push_back({t.first->children[i].load(),
+                                t.second->children[i].load()});
+            }
+        }
+    }
+}
+
 TEST_CASE("DCTree<3> cancellation")
 {
     std::chrono::time_point<std::chrono::system_clock> start, end;
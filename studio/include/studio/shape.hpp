@@ -24,12 +24,13 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <QOpenGLBuffer>
 #include <QOpenGLFunctions>
 
-#include "libfive/eval/eval_jacobian.hpp"
+#include "libfive/eval/eval_adjoint.hpp"
 #include "libfive/tree/tree.hpp"
 
 #include "libfive/render/brep/mesh.hpp"
 #include "libfive/render/brep/region.hpp"
 #include "libfive/render/brep/settings.hpp"
+#include "libfive/render/brep/dc/dc_refiner.hpp"
 
 namespace Kernel { class Tape; /*  forward declaration */ }
 
@@ -104,7 +105,7 @@ public:
      *  Ownership is transfered, so the caller is responsible for deleting
      *  the evaluator (or storing it in an owned structure)
      */
-    std::pair<Kernel::JacobianEvaluator*, std::shared_ptr<Kernel::Tape>>
+    std::pair<Kernel::AdjointEvaluator*, std::shared_ptr<Kernel::Tape>>
     dragFrom(const QVector3D& pt);
 
     /*
@@ -170,6 +171,14 @@ protected:
     std::vector<Kernel::XTreeEvaluator,
                 Eigen::aligned_allocator<Kernel::XTreeEvaluator>> es;
 
+    /*  Keeps the dual contouring octree between renders, so that
+     *  refining and variable changes don't start from scratch.  */
+    Kernel::DCRefiner refiner;
+
+    /*  Variable values for the current render (a copy of vars taken in
+     *  startRender, since vars can change while the render is running) */
+    std::map<Kernel::Tree::Id, float> render_vars;
+
     QScopedPointer<Kernel::Mesh> mesh;
     Kernel::Region<3> render_bounds;
     Kernel::Region<3> mesh_bounds;
@@ -195,4 +204,8 @@ protected:
 
     int default_div=MESH_DIV_EMPTY;
     int target_div=MESH_DIV_EMPTY;
+
+    /*  div of the refiner's octree, or MESH_DIV_EMPTY if it has none.
+     *  This is only used in renderMesh (i.e. on the render thread).  */
+    int refined_div=MESH_DIV_EMPTY;
 };
@@ -30,7 +30,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "studio/shape.hpp"
 #include "studio/settings.hpp"
 
-#include "libfive/eval/eval_jacobian.hpp"
+#include "libfive/eval/eval_adjoint.hpp"
 
 class View : public QOpenGLWidget, QOpenGLFunctions
 {
@@ -172,7 +172,7 @@ protected:
     /*  Data to handle direct modification of shapes */
     QVector3D drag_start;
     QVector3D drag_dir;
-    std::pair<std::unique_ptr<Kernel::JacobianEvaluator>,
+    std::pair<std::unique_ptr<Kernel::AdjointEvaluator>,
               std::shared_ptr<Kernel::Tape>> drag_eval;
     Shape* drag_target=nullptr;
     bool drag_valid=false;
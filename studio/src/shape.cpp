@@ -20,6 +20,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "studio/shader.hpp"
 
 #include "libfive/eval/tape.hpp"
+#include "libfive/eval/deck.hpp"
 #include "libfive/eval/eval_xtree.hpp"
 
 const int Shape::MESH_DIV_EMPTY;
@@ -31,11 +32,18 @@ Shape::Shape(Kernel::Tree t, std::map<Kernel::Tree::Id, float> vars)
     : tree(t), vars(vars), vert_vbo(QOpenGLBuffer::VertexBuffer),
       tri_vbo(QOpenGLBuffer::IndexBuffer)
 {
-    // Construct evaluators to run meshing (in parallel)
+    // Construct evaluators to run meshing (in parallel), flattening
+    // the tree once and then forking the Deck for the other evaluators
+    auto deck = std::make_shared<Kernel::Deck>(t);
+
+    // The same model is re-rendered at several resolutions (and after
+    // variable edits), so it's worth sharing pushed tapes between runs.
+    deck->cache.setCapacity(Kernel::TapeCache::TYPICAL_CAPACITY);
+
     es.reserve(8);
     for (unsigned i=0; i < es.capacity(); ++i)
     {
-        es.emplace_back(Kernel::XTreeEvaluator(t, vars));
+        es.emplace_back(Kernel::XTreeEvaluator(i ? deck->fork() : deck, vars));
     }
 
     connect(this, &Shape::gotMesh, this, &Shape::redraw);
@@ -240,6 +248,7 @@ void Shape::startRender(RenderSettings s)
             }
             s.div = (s.div == MESH_DIV_NEW_VARS) ? default_div : 0;
         }
+        render_vars = vars;
 
         target_div = s.div;
 
@@ -281,10 +290,10 @@ void Shape::setHover(bool h)
 
 ////////////////////////////////////////////////////////////////////////////////
 
-std::pair<Kernel::JacobianEvaluator*, Kernel::Tape::Handle>
+std::pair<Kernel::AdjointEvaluator*, Kernel::Tape::Handle>
 Shape::dragFrom(const QVector3D& v)
 {
-    auto e = new Kernel::JacobianEvaluator(tree, vars);
+    auto e = new Kernel::AdjointEvaluator(tree, vars);
     auto o = e->evalAndPush({v.x(), v.y(), v.z()});
     return std::make_pair(e, o.second);
 }
@@ -367,6 +376,20 @@ Shape::BoundedMesh Shape::renderMesh(RenderSettings s)
     mesh_settings.max_err = pow(10, -s.settings.quality);
     mesh_settings.alg = s.alg;
 
-    auto m = Kernel::Mesh::render(es.data(), r, mesh_settings);
+    // The refiner discards its tree when asked for a coarser resolution,
+    // so previews that are coarser than its tree are rendered from
+    // scratch; once we're back down to its resolution, it only rebuilds
+    // the cells that depend on variables changed since then.
+    std::unique_ptr<Kernel::Mesh> m;
+    if (s.alg == Kernel::DUAL_CONTOURING &&
+        (refined_div == MESH_DIV_EMPTY || s.div <= refined_div))
+    {
+        m = refiner.render(es.data(), r, mesh_settings, render_vars);
+        refined_div = m ? s.div : MESH_DIV_EMPTY;
+    }
+    else
+    {
+        m = Kernel::Mesh::render(es.data(), r, mesh_settings);
+    }
     return {m.release(), r};
 }